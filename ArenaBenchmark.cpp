@@ -0,0 +1,166 @@
+// ArenaBenchmark.cpp : Compares heap and query_arena scratch memory on the injection path.
+//
+// Every query repeats the scratch work of run_query_injection followed by the legacy detector in
+// run_query: copy the statement twice, lowercase one copy, append an injected OR clause, then
+// lowercase and split the result around the "=". Each thread runs its share of the queries with
+// the scratch strings taken either from the heap or from its query_arena, and times every query.
+// operator new is replaced with the counting version from allocation_tracker.h, so the heap
+// allocations each thread makes are counted.
+//
+// usage: ArenaBenchmark [threads] [queries per thread]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "query_arena.h"
+#include "tautology_detector.h"
+
+// this program replaces operator new and delete with the counting versions
+#define ALLOCATION_TRACKER_REPLACE_NEW
+#include "allocation_tracker.h"
+
+namespace
+{
+    const std::string_view injections[] = { " or 1=1;", " or 2=2;", " or 'hi'='hi';", " or 'hack'='hack';" };
+
+    std::vector<std::string> statements()
+    {
+        return {
+            "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'",
+            "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred';",
+            "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='" + std::string(200, 'x') + "'",
+            "SELECT ID, NAME, PASSWORD FROM USERS WHERE PASSWORD='" + std::string(2000, 'y') + "'",
+        };
+    }
+
+    // the scratch strings of run_query_injection and the legacy detector, all from scratch
+    bool screen_injected(const std::string& sql, size_t variant, std::pmr::memory_resource* scratch)
+    {
+        std::pmr::string injected_sql(sql.begin(), sql.end(), scratch);
+        std::pmr::string local_copy(sql.begin(), sql.end(), scratch);
+        std::transform(local_copy.begin(), local_copy.end(), local_copy.begin(), ::tolower);
+        if (local_copy.back() == ';')
+        {
+            injected_sql.pop_back();
+        }
+        injected_sql.append(injections[variant % 4]);
+        return detect_tautology_legacy(injected_sql, scratch);
+    }
+
+    struct thread_result
+    {
+        std::vector<double> nanoseconds;
+        size_t heap_allocations = 0;
+        size_t detections = 0;
+        query_arena_stats arena;
+    };
+
+    void run_thread(bool use_arena, size_t queries, const std::vector<std::string>& sql, std::atomic<bool>& go, thread_result& result)
+    {
+        result.nanoseconds.resize(queries);
+        // the first query on a thread builds its arena, keep that out of the counts
+        thread_query_arena();
+        while (!go.load(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+
+        allocation_scope counting;
+        for (size_t i = 0; i < queries; ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            bool detected;
+            if (use_arena)
+            {
+                query_arena_scope scope;
+                detected = screen_injected(sql[i % sql.size()], i, query_arena_scope::resource());
+            }
+            else
+            {
+                detected = screen_injected(sql[i % sql.size()], i, std::pmr::get_default_resource());
+            }
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            result.nanoseconds[i] = std::chrono::duration<double, std::nano>(elapsed).count();
+            result.detections += detected ? 1 : 0;
+        }
+        result.heap_allocations = counting.allocations();
+        result.arena = thread_query_arena().stats();
+    }
+
+    double percentile(const std::vector<double>& sorted, double fraction)
+    {
+        return sorted[std::min(sorted.size() - 1, static_cast<size_t>(fraction * static_cast<double>(sorted.size())))];
+    }
+
+    void run_mode(const char* name, bool use_arena, size_t threads, size_t queries)
+    {
+        const std::vector<std::string> sql = statements();
+        std::vector<thread_result> results(threads);
+        std::vector<std::thread> workers;
+        std::atomic<bool> go(false);
+        for (size_t t = 0; t < threads; ++t)
+        {
+            workers.emplace_back(run_thread, use_arena, queries, std::cref(sql), std::ref(go), std::ref(results[t]));
+        }
+        auto start = std::chrono::steady_clock::now();
+        go.store(true, std::memory_order_release);
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::vector<double> all;
+        all.reserve(threads * queries);
+        size_t allocations = 0;
+        size_t detections = 0;
+        query_arena_stats arena;
+        for (const auto& result : results)
+        {
+            all.insert(all.end(), result.nanoseconds.begin(), result.nanoseconds.end());
+            allocations += result.heap_allocations;
+            detections += result.detections;
+            arena.allocations += result.arena.allocations;
+            arena.bytes += result.arena.bytes;
+            arena.upstream_allocations += result.arena.upstream_allocations;
+            arena.resets += result.arena.resets;
+            arena.high_water = std::max(arena.high_water, result.arena.high_water);
+            arena.block_size = std::max(arena.block_size, result.arena.block_size);
+        }
+        std::sort(all.begin(), all.end());
+
+        const double total = static_cast<double>(threads * queries);
+        std::cout << std::fixed << std::setprecision(2);
+        std::cout << name << ": " << std::setw(6) << allocations / total << " heap allocations/query, "
+            << std::setprecision(0) << total / seconds << " queries/s, " << detections << " detections" << std::endl;
+        std::cout << "  latency ns  p50 " << percentile(all, 0.50) << "  p99 " << percentile(all, 0.99)
+            << "  p99.9 " << percentile(all, 0.999) << "  max " << all.back() << std::endl;
+        if (use_arena)
+        {
+            std::cout << "  arena       " << arena.allocations << " allocations, " << arena.bytes << " bytes, "
+                << arena.upstream_allocations << " heap spills, " << arena.resets << " resets, high water "
+                << arena.high_water << " bytes, block " << arena.block_size << " bytes" << std::endl;
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    size_t threads = argc > 1 ? std::stoul(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+    size_t queries = argc > 2 ? std::stoul(argv[2]) : 200000;
+
+    std::cout << "Query Arena Benchmark (" << threads << " threads x " << queries << " queries)" << std::endl;
+
+    run_mode("heap ", false, threads, queries);
+    run_mode("arena", true, threads, queries);
+
+    return 0;
+}
@@ -0,0 +1,67 @@
+// AuditLog.cpp : Runs the run_query injection rules over a memory-mapped SQL query log.
+//
+// Every flagged statement is printed with its line, its offset, the rule that fired and the text
+// that gave it away.
+//
+// usage: AuditLog <log file> [--threads N] [--chunk MB] [--quiet]
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "log_ingest.h"
+
+int main(int argc, char* argv[])
+{
+    std::string path;
+    size_t threads = thread_pool::default_size();
+    size_t chunk_megabytes = 8;
+    bool quiet = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) threads = std::stoul(argv[++i]);
+        else if (arg == "--chunk" && i + 1 < argc) chunk_megabytes = std::stoul(argv[++i]);
+        else if (arg == "--quiet") quiet = true;
+        else if (path.empty()) path = arg;
+        else
+        {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return -1;
+        }
+    }
+
+    if (path.empty())
+    {
+        std::cerr << "usage: AuditLog <log file> [--threads N] [--chunk MB] [--quiet]" << std::endl;
+        return -1;
+    }
+
+    mapped_file log;
+    if (!log.open(path))
+    {
+        std::cerr << "Failed to map the log. ERROR = " << log.error() << std::endl;
+        return -1;
+    }
+
+    thread_pool pool(threads);
+    audit_report report = audit_sql_log(pool, log.contents(), (chunk_megabytes == 0 ? 1 : chunk_megabytes) * 1024 * 1024);
+
+    if (!quiet)
+    {
+        for (const auto& finding : report.findings)
+        {
+            std::cout << "line " << finding.line << " (offset " << finding.offset << "): " << injection_rule_name(finding.verdict.rule)
+                << " " << injection_evidence(finding.verdict) << ": " << finding.statement << '\n';
+        }
+        std::cout << std::flush;
+    }
+
+    std::cerr << report.bytes << " bytes, " << report.statements << " statements, " << report.findings.size() << " flagged in "
+        << report.chunks << " chunks, " << std::fixed << std::setprecision(3) << report.seconds << " s, "
+        << report.gigabytes_per_second() << " GB/s, " << std::setprecision(0) << report.statements_per_second()
+        << " statements/s (" << pool.size() << " threads)" << std::endl;
+
+    return report.findings.empty() ? 0 : 1;
+}
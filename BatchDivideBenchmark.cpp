@@ -0,0 +1,223 @@
+// BatchDivideBenchmark.cpp : Google Benchmark suite for divide_batch against a loop over divide().
+//
+//  BM_DivideLoop            divide() from error_paths.h per pair, the zero denominators caught
+//  BM_DivideBatchScalar     the portable kernel
+//  BM_DivideBatchSse        4 lanes at a time
+//  BM_DivideBatchAvx2       8 lanes at a time, skipped on CPUs without AVX2
+//  BM_DivideBatchParallel   divide_batch split over a thread_pool
+//
+// Arrays run from 1K to 16M lanes, with no zero denominators and with 1% of them zero. Each kernel
+// is checked against the scalar one before it is timed.
+//
+// Results are written as JSON to BatchDivideBenchmark.json unless --benchmark_out is given, and two
+// runs can be compared with compare_benchmarks.py.
+//
+// usage: BatchDivideBenchmark [--benchmark_filter=REGEX] [--benchmark_out=FILE] ...
+
+#include <cstring>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "batch_divide.h"
+#include "error_paths.h"
+
+namespace
+{
+    const int64_t lane_counts[] = { 1024, 65536, 1 << 20, 1 << 24 };
+    const int64_t zero_rates[] = { 0, 10 };
+
+    struct operands
+    {
+        std::vector<float> numerators;
+        std::vector<float> denominators;
+    };
+
+    // built once per size and rate, the large ones take a while to fill
+    const operands& shared_operands(int64_t lanes, int64_t per_mille)
+    {
+        static std::map<std::pair<int64_t, int64_t>, operands> built;
+        operands& found = built[std::make_pair(lanes, per_mille)];
+        if (found.numerators.empty())
+        {
+            std::minstd_rand random(405);
+            found.numerators.resize(static_cast<size_t>(lanes));
+            found.denominators.resize(static_cast<size_t>(lanes));
+            for (int64_t i = 0; i < lanes; ++i)
+            {
+                found.numerators[i] = static_cast<float>(random() % 10000) / 7.0f;
+                found.denominators[i] = static_cast<int64_t>(random() % 1000) < per_mille ? 0.0f : static_cast<float>(1 + random() % 100);
+            }
+        }
+        return found;
+    }
+
+    thread_pool& shared_pool()
+    {
+        static thread_pool pool;
+        return pool;
+    }
+
+    // false if the kernel disagrees with the scalar one anywhere
+    bool matches_scalar(batch_divide_detail::word_function divide_word, const operands& input)
+    {
+        const size_t count = input.numerators.size();
+        std::vector<float> expected_results(count), results(count);
+        std::vector<uint64_t> expected_mask(divide_mask_words(count)), mask(divide_mask_words(count));
+        batch_divide_detail::divide_words(batch_divide_detail::divide_word_scalar, input.numerators.data(), input.denominators.data(),
+            expected_results.data(), count, expected_mask.data(), 0, expected_mask.size());
+        batch_divide_detail::divide_words(divide_word, input.numerators.data(), input.denominators.data(),
+            results.data(), count, mask.data(), 0, mask.size());
+        return results == expected_results && mask == expected_mask;
+    }
+
+    void BM_DivideLoop(benchmark::State& state)
+    {
+        const operands& input = shared_operands(state.range(0), state.range(1));
+        const size_t count = input.numerators.size();
+        std::vector<float> results(count);
+        std::vector<uint64_t> mask(divide_mask_words(count));
+        for (auto _ : state)
+        {
+            std::fill(mask.begin(), mask.end(), 0);
+            for (size_t i = 0; i < count; ++i)
+            {
+                try
+                {
+                    results[i] = divide(input.numerators[i], input.denominators[i]);
+                }
+                catch (const std::invalid_argument&)
+                {
+                    results[i] = 0;
+                    mask[i / 64] |= uint64_t(1) << (i % 64);
+                }
+            }
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+        state.SetBytesProcessed(state.iterations() * state.range(0) * 3 * static_cast<int64_t>(sizeof(float)));
+    }
+
+    void run_kernel(benchmark::State& state, batch_divide_detail::word_function divide_word)
+    {
+        const operands& input = shared_operands(state.range(0), state.range(1));
+        if (!matches_scalar(divide_word, input))
+        {
+            state.SkipWithError("kernel disagrees with the scalar divide");
+            return;
+        }
+        const size_t count = input.numerators.size();
+        std::vector<float> results(count);
+        std::vector<uint64_t> mask(divide_mask_words(count));
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(batch_divide_detail::divide_words(divide_word, input.numerators.data(), input.denominators.data(),
+                results.data(), count, mask.data(), 0, mask.size()));
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+        state.SetBytesProcessed(state.iterations() * state.range(0) * 3 * static_cast<int64_t>(sizeof(float)));
+    }
+
+    void BM_DivideBatchScalar(benchmark::State& state)
+    {
+        run_kernel(state, batch_divide_detail::divide_word_scalar);
+    }
+
+#if defined(BATCH_DIVIDE_X86)
+    void BM_DivideBatchSse(benchmark::State& state)
+    {
+        run_kernel(state, batch_divide_detail::divide_word_sse);
+    }
+
+    void BM_DivideBatchAvx2(benchmark::State& state)
+    {
+        if (!batch_divide_detail::cpu_has_avx2())
+        {
+            state.SkipWithError("no AVX2 on this CPU");
+            return;
+        }
+        run_kernel(state, batch_divide_detail::divide_word_avx2);
+    }
+#endif
+
+    void BM_DivideBatchParallel(benchmark::State& state)
+    {
+        const operands& input = shared_operands(state.range(0), state.range(1));
+        const size_t count = input.numerators.size();
+        std::vector<float> results(count);
+        std::vector<uint64_t> mask(divide_mask_words(count));
+        thread_pool& pool = shared_pool();
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(divide_batch(pool, input.numerators.data(), input.denominators.data(), results.data(), count, mask.data()));
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+        state.SetBytesProcessed(state.iterations() * state.range(0) * 3 * static_cast<int64_t>(sizeof(float)));
+        state.counters["threads"] = static_cast<double>(pool.size());
+    }
+
+    void register_benchmarks()
+    {
+        std::vector<benchmark::internal::Benchmark*> all;
+        all.push_back(benchmark::RegisterBenchmark("BM_DivideLoop", BM_DivideLoop));
+        all.push_back(benchmark::RegisterBenchmark("BM_DivideBatchScalar", BM_DivideBatchScalar));
+#if defined(BATCH_DIVIDE_X86)
+        all.push_back(benchmark::RegisterBenchmark("BM_DivideBatchSse", BM_DivideBatchSse));
+        all.push_back(benchmark::RegisterBenchmark("BM_DivideBatchAvx2", BM_DivideBatchAvx2));
+#endif
+        all.push_back(benchmark::RegisterBenchmark("BM_DivideBatchParallel", BM_DivideBatchParallel)->UseRealTime());
+
+        for (auto* registered : all)
+        {
+            registered->ArgNames({ "lanes", "per_mille" });
+            for (int64_t lanes : lane_counts)
+            {
+                for (int64_t rate : zero_rates)
+                {
+                    registered->Args({ lanes, rate });
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    bool has_out = false;
+    std::vector<char*> args;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (std::strncmp(argv[i], "--benchmark_out=", 16) == 0)
+        {
+            has_out = true;
+        }
+        args.push_back(argv[i]);
+    }
+
+    // JSON results by default so runs can be compared
+    char default_out[] = "--benchmark_out=BatchDivideBenchmark.json";
+    char default_format[] = "--benchmark_out_format=json";
+    if (!has_out)
+    {
+        args.push_back(default_out);
+        args.push_back(default_format);
+    }
+
+    int count = static_cast<int>(args.size());
+    args.push_back(NULL);
+    benchmark::Initialize(&count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(count, args.data()))
+    {
+        return -1;
+    }
+
+    register_benchmarks();
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -1,12 +1,36 @@
 // BufferOverflow.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
 
+#include <cstdio>
 #include <iomanip>
 #include <iostream>
 #include <limits> //added to check character limits
 #include <string> //added to allow string
 
-int main()
+#include "fixed_string.h"
+#include "line_reader.h"
+
+// reads the next line into value. A line longer than the value's capacity is cut off there, and
+//  record.truncated says so.
+template <size_t N>
+bool read_value(line_reader& reader, fixed_string<N>& value, line_record& record)
+{
+    if (!reader.next(record))
+    {
+        value.clear();
+        return false;
+    }
+    if (value.assign_truncated(record.text) != fixed_string_status::ok)
+    {
+        record.truncated = true;
+    }
+    return true;
+}
+
+// BufferOverFlow [file | -]
+//  with no arguments asks for one value. With a file, or - for stdin, checks every line of it
+//  against the same limit and reports the ones that were too long.
+int main(int argc, char* argv[])
 {
     std::cout << "Buffer Overflow Example" << std::endl;
 
@@ -17,14 +41,50 @@ int main()
     //  You must notify the user if they entered too much data.
 
     const std::string account_number = "CharlieBrown42";
-    char user_input[20];
-    std::cout << "Enter a value: ";
-    std::cin.getline(user_input, sizeof(user_input));
-
-    // Check if the input might have been truncated (meaning the buffer was filled)
-    if (std::cin.fail()) {
-        std::cin.clear(); // Clear the error state
-        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Discard remaining input
+    fixed_string<19> user_input;
+
+    // lines are read in blocks and never more than user_input.capacity characters of one are kept, the
+    //  input has its own inline storage and cannot be written past its end
+    if (argc > 1)
+    {
+        const std::string path = argv[1];
+        std::FILE* input = path == "-" ? stdin : std::fopen(path.c_str(), "rb");
+        if (input == NULL)
+        {
+            std::cout << "Failed to open " << path << std::endl;
+            return -1;
+        }
+
+        line_reader records(input, user_input.capacity);
+        line_record record;
+        while (read_value(records, user_input, record))
+        {
+            if (record.truncated)
+            {
+                std::cout << "Warning: line " << record.number << " has " << record.length << " characters, more than the "
+                    << user_input.capacity << " allowed. Input has been truncated to prevent buffer overflow." << std::endl;
+            }
+        }
+        if (!records.error().empty())
+        {
+            std::cout << "Failed to read " << path << ". ERROR = " << records.error() << std::endl;
+        }
+        std::cout << "Checked " << records.lines() << " values, " << records.overflows() << " too long." << std::endl;
+        std::cout << "Account Number = " << account_number << std::endl;
+        if (input != stdin)
+        {
+            std::fclose(input);
+        }
+        return records.error().empty() ? 0 : -1;
+    }
+
+    std::cout << "Enter a value: " << std::flush;
+    line_reader reader(stdin, user_input.capacity);
+    line_record record;
+    read_value(reader, user_input, record);
+
+    // Check if the input was truncated (meaning the line did not fit in the buffer)
+    if (record.truncated) {
         std::cout << "Warning: You entered too much data. Input has been truncated to prevent buffer overflow." << std::endl;
     }
     std::cout << "You entered: " << user_input << std::endl;
@@ -0,0 +1,250 @@
+// BulkLoad.cpp : Seeds a USERS table through the bulk loader and compares it with the
+//  initialize_database style of seeding (concatenated INSERT statements, no explicit transaction).
+//
+// usage: BulkLoad [--rows N] [--csv file] [--seed N] [--db file] [--batch N] [--synchronous MODE]
+//                 [--journal MODE] [--index-now] [--skip-legacy] [--export file]
+//        --seed loads random_users rows drawn from the seed instead of the numbered synthetic users
+//        --export writes the loaded USERS table to file as CSV, which --csv can load again
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "sqlite3.h"
+#include "bulk_loader.h"
+#include "output_sink.h"
+#include "user_batch.h"
+
+namespace
+{
+    const char* create_users_sql = "CREATE TABLE USERS(" \
+        "ID INT PRIMARY KEY     NOT NULL," \
+        "NAME           TEXT    NOT NULL," \
+        "PASSWORD       TEXT    NOT NULL);";
+
+    // opens a fresh database with an empty USERS table, removing any previous file
+    sqlite3* open_fresh(const std::string& path)
+    {
+        if (path != ":memory:")
+        {
+            std::remove(path.c_str());
+        }
+
+        sqlite3* db = NULL;
+        if (sqlite3_open(path.c_str(), &db) != SQLITE_OK)
+        {
+            std::cout << "Failed to connect to the database. ERROR=" << sqlite3_errmsg(db) << std::endl;
+            sqlite3_close(db);
+            return NULL;
+        }
+        if (!bulk_load_detail::exec(db, create_users_sql, "Create USERS table"))
+        {
+            sqlite3_close(db);
+            return NULL;
+        }
+        return db;
+    }
+
+    // the initialize_database approach: one sqlite3_exec of concatenated INSERTs per chunk, autocommit per row
+    bool legacy_seed(sqlite3* db, size_t rows, bulk_load_stats& stats)
+    {
+        auto start = std::chrono::steady_clock::now();
+        synthetic_users users(rows);
+        user_row row;
+        std::string sql;
+        size_t pending = 0;
+        stats = bulk_load_stats();
+
+        while (users(row))
+        {
+            sql += "INSERT INTO USERS (ID, NAME, PASSWORD)VALUES (" + std::to_string(row.id) + ", '" +
+                std::string(row.name) + "', '" + std::string(row.password) + "');";
+            ++stats.rows;
+            if (++pending == 1000)
+            {
+                if (!bulk_load_detail::exec(db, sql, "Legacy seeding")) return false;
+                sql.clear();
+                pending = 0;
+            }
+        }
+        if (pending > 0 && !bulk_load_detail::exec(db, sql, "Legacy seeding")) return false;
+
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return true;
+    }
+
+    // streams the USERS table to path as CSV a batch at a time, so a table of any size is never
+    //  held in memory at once
+    bool export_users(sqlite3* db, const std::string& path, size_t& exported)
+    {
+        std::ofstream output(path, std::ios::binary);
+        if (!output.is_open())
+        {
+            std::cout << "Failed to open " << path << std::endl;
+            return false;
+        }
+
+        sqlite3_stmt* select = NULL;
+        if (sqlite3_prepare_v2(db, "SELECT ID, NAME, PASSWORD FROM USERS ORDER BY ID", -1, &select, NULL) != SQLITE_OK)
+        {
+            std::cout << "Failed to prepare USERS export. ERROR = " << sqlite3_errmsg(db) << std::endl;
+            return false;
+        }
+
+        exported = 0;
+        output_sink sink(output, sink_format::csv);
+        user_batch batch;
+        // a csv result only writes the header, the row count is not known until the end
+        sink.begin_result("", 0);
+        int result = stream_users(select, batch, 4096, [&](const user_batch& rows)
+        {
+            for (const user_row& row : rows)
+            {
+                sink.write_row(row.id, row.name, row.password);
+            }
+            exported += rows.size();
+        });
+        sink.end_result();
+        sink.flush();
+        sqlite3_finalize(select);
+
+        if (result != SQLITE_DONE)
+        {
+            std::cout << "Data failed to be queried from USERS table. ERROR = " << sqlite3_errmsg(db) << std::endl;
+            return false;
+        }
+        if (!output)
+        {
+            std::cout << "Failed to write " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void report(const char* label, const bulk_load_stats& stats)
+    {
+        std::cout << std::left << std::setw(14) << label << std::right << std::setw(12) << stats.rows << " rows in "
+            << std::fixed << std::setprecision(3) << stats.seconds << " s = "
+            << std::setprecision(0) << stats.rows_per_second() << " rows/s" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    size_t rows = 100000;
+    std::string csv_path;
+    std::string db_path = "bulk_load.db";
+    std::string export_path;
+    bool run_legacy = true;
+    bool use_seed = false;
+    uint64_t seed = 0;
+    bulk_load_options options;
+    options.indexes.push_back("CREATE INDEX IF NOT EXISTS USERS_NAME ON USERS(NAME)");
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--rows" && has_value) rows = std::stoul(argv[++i]);
+        else if (arg == "--csv" && has_value) csv_path = argv[++i];
+        else if (arg == "--seed" && has_value)
+        {
+            seed = std::stoull(argv[++i], NULL, 0);
+            use_seed = true;
+        }
+        else if (arg == "--db" && has_value) db_path = argv[++i];
+        else if (arg == "--batch" && has_value) options.batch_rows = std::stoul(argv[++i]);
+        else if (arg == "--synchronous" && has_value) options.synchronous = argv[++i];
+        else if (arg == "--journal" && has_value) options.journal_mode = argv[++i];
+        else if (arg == "--index-now") options.defer_indexes = false;
+        else if (arg == "--skip-legacy") run_legacy = false;
+        else if (arg == "--export" && has_value) export_path = argv[++i];
+        else
+        {
+            std::cout << "Unknown argument: " << arg << std::endl;
+            return -1;
+        }
+    }
+
+    std::cout << "Bulk Load Example (" << db_path << ", batch " << options.batch_rows << ", synchronous "
+        << options.synchronous << ", journal " << options.journal_mode << ")" << std::endl;
+
+    int return_code = 0;
+
+    sqlite3* db = open_fresh(db_path);
+    if (db == NULL) return -1;
+
+    bulk_load_stats stats;
+    bool loaded;
+    if (csv_path.empty() && use_seed)
+    {
+        std::cout << "Random users from seed " << seed << std::endl;
+        loaded = bulk_load_users(db, random_users(rows, seed), options, stats);
+    }
+    else if (csv_path.empty())
+    {
+        loaded = bulk_load_users(db, synthetic_users(rows), options, stats);
+    }
+    else
+    {
+        csv_users users(csv_path);
+        if (!users.is_open())
+        {
+            std::cout << "Failed to open " << csv_path << std::endl;
+            sqlite3_close(db);
+            return -1;
+        }
+        loaded = bulk_load_users(db, users, options, stats);
+        if (users.skipped() > 0)
+        {
+            std::cout << users.skipped() << " malformed CSV lines skipped." << std::endl;
+        }
+    }
+
+    if (!loaded)
+    {
+        std::cout << "Bulk load failed." << std::endl;
+        return_code = -1;
+    }
+    report("bulk loader", stats);
+
+    if (loaded && !export_path.empty())
+    {
+        size_t exported = 0;
+        if (export_users(db, export_path, exported))
+        {
+            std::cout << exported << " rows exported to " << export_path << std::endl;
+        }
+        else
+        {
+            return_code = -1;
+        }
+    }
+    sqlite3_close(db);
+
+    if (run_legacy && csv_path.empty())
+    {
+        db = open_fresh(db_path);
+        if (db == NULL) return -1;
+
+        bulk_load_stats legacy_stats;
+        if (legacy_seed(db, rows, legacy_stats))
+        {
+            report("legacy seed", legacy_stats);
+            if (legacy_stats.rows_per_second() > 0)
+            {
+                std::cout << "speedup: " << std::setprecision(1) << stats.rows_per_second() / legacy_stats.rows_per_second() << "x" << std::endl;
+            }
+        }
+        else
+        {
+            return_code = -1;
+        }
+        sqlite3_close(db);
+    }
+
+    return return_code;
+}
@@ -0,0 +1,202 @@
+// ExceptionBenchmark.cpp : Google Benchmark suite comparing the thrown and returned errors of error_paths.h.
+//
+//  BM_Divide*        divide / try_divide over denominators of which the given per mille are zero,
+//                    with the failures caught or checked. 0 is the cost of the happy path alone.
+//  BM_CustomLogic*   the whole do_custom_application_logic chain, which always fails twice, with
+//                    std::cout discarded so the printing costs the same on both sides
+//
+// Every case also runs on several threads at once, since throwing on many threads at the same time
+// contends in the unwinder while returning an error does not.
+//
+// Results are written as JSON to ExceptionBenchmark.json unless --benchmark_out is given, and two
+// runs can be compared with compare_benchmarks.py.
+//
+// usage: ExceptionBenchmark [--benchmark_filter=REGEX] [--benchmark_out=FILE] ...
+
+#include <cstring>
+#include <random>
+#include <streambuf>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "error_paths.h"
+
+namespace
+{
+    const int64_t failure_rates[] = { 0, 1, 10, 100, 500, 1000 };
+    const size_t denominator_count = 4096;
+
+    // swallows everything written to it, so benchmarks measure the error paths rather than the console
+    class null_buffer : public std::streambuf
+    {
+    protected:
+        int overflow(int c) override { return traits_type::not_eof(c); }
+        std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+    };
+
+    null_buffer discard;
+
+    // denominators of which per_mille in a thousand are zero, spread at random
+    std::vector<float> make_denominators(int64_t per_mille)
+    {
+        std::vector<float> denominators(denominator_count);
+        std::minstd_rand random(405);
+        for (auto& denominator : denominators)
+        {
+            denominator = static_cast<int64_t>(random() % 1000) < per_mille ? 0.0f : static_cast<float>(1 + random() % 100);
+        }
+        return denominators;
+    }
+
+    void BM_DivideThrow(benchmark::State& state)
+    {
+        const std::vector<float> denominators = make_denominators(state.range(0));
+        size_t failures = 0;
+        for (auto _ : state)
+        {
+            float sum = 0;
+            for (float denominator : denominators)
+            {
+                try
+                {
+                    sum += divide(10.0f, denominator);
+                }
+                catch (const std::invalid_argument&)
+                {
+                    ++failures;
+                }
+            }
+            benchmark::DoNotOptimize(sum);
+        }
+        benchmark::DoNotOptimize(failures);
+        state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(denominators.size()));
+    }
+
+    void BM_DivideExpected(benchmark::State& state)
+    {
+        const std::vector<float> denominators = make_denominators(state.range(0));
+        size_t failures = 0;
+        for (auto _ : state)
+        {
+            float sum = 0;
+            for (float denominator : denominators)
+            {
+                auto result = try_divide(10.0f, denominator);
+                if (result)
+                {
+                    sum += *result;
+                }
+                else
+                {
+                    ++failures;
+                }
+            }
+            benchmark::DoNotOptimize(sum);
+        }
+        benchmark::DoNotOptimize(failures);
+        state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(denominators.size()));
+    }
+
+    void BM_CustomLogicThrow(benchmark::State& state)
+    {
+        std::streambuf* saved = NULL;
+        if (state.thread_index() == 0)
+        {
+            saved = std::cout.rdbuf(&discard);
+        }
+        size_t failures = 0;
+        for (auto _ : state)
+        {
+            try
+            {
+                do_custom_application_logic();
+            }
+            catch (const CustomApplicationException&)
+            {
+                ++failures;
+            }
+        }
+        benchmark::DoNotOptimize(failures);
+        if (state.thread_index() == 0)
+        {
+            std::cout.rdbuf(saved);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    void BM_CustomLogicExpected(benchmark::State& state)
+    {
+        std::streambuf* saved = NULL;
+        if (state.thread_index() == 0)
+        {
+            saved = std::cout.rdbuf(&discard);
+        }
+        size_t failures = 0;
+        for (auto _ : state)
+        {
+            if (!try_do_custom_application_logic())
+            {
+                ++failures;
+            }
+        }
+        benchmark::DoNotOptimize(failures);
+        if (state.thread_index() == 0)
+        {
+            std::cout.rdbuf(saved);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    void register_benchmarks()
+    {
+        auto* divide_throw = benchmark::RegisterBenchmark("BM_DivideThrow", BM_DivideThrow);
+        auto* divide_expected = benchmark::RegisterBenchmark("BM_DivideExpected", BM_DivideExpected);
+        for (int64_t rate : failure_rates)
+        {
+            divide_throw->Arg(rate);
+            divide_expected->Arg(rate);
+        }
+        divide_throw->ArgName("per_mille")->ThreadRange(1, 8)->UseRealTime();
+        divide_expected->ArgName("per_mille")->ThreadRange(1, 8)->UseRealTime();
+
+        benchmark::RegisterBenchmark("BM_CustomLogicThrow", BM_CustomLogicThrow)->ThreadRange(1, 8)->UseRealTime();
+        benchmark::RegisterBenchmark("BM_CustomLogicExpected", BM_CustomLogicExpected)->ThreadRange(1, 8)->UseRealTime();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    bool has_out = false;
+    std::vector<char*> args;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (std::strncmp(argv[i], "--benchmark_out=", 16) == 0)
+        {
+            has_out = true;
+        }
+        args.push_back(argv[i]);
+    }
+
+    // JSON results by default so runs can be compared
+    char default_out[] = "--benchmark_out=ExceptionBenchmark.json";
+    char default_format[] = "--benchmark_out_format=json";
+    if (!has_out)
+    {
+        args.push_back(default_out);
+        args.push_back(default_format);
+    }
+
+    int count = static_cast<int>(args.size());
+    args.push_back(NULL);
+    benchmark::Initialize(&count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(count, args.data()))
+    {
+        return -1;
+    }
+
+    register_benchmarks();
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
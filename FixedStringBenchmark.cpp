@@ -0,0 +1,192 @@
+// FixedStringBenchmark.cpp : Google Benchmark suite comparing fixed_string with std::string.
+//
+//  BM_Copy            copies a list of 4096 short names
+//  BM_Build           builds the list from string_views into the text
+//  BM_EqualSameSize   compares every name with another of the same length, mostly different text
+//  BM_EqualAnySize    compares every name with the next one, mostly of another length
+//
+// Every case runs for std::string and fixed_string<30>. The names are 3 to 12 characters, short
+// enough for the std::string small string buffer, so neither side allocates while comparing.
+//
+// Results are written as JSON to FixedStringBenchmark.json unless --benchmark_out is given, and
+// two runs can be compared with compare_benchmarks.py.
+//
+// usage: FixedStringBenchmark [--benchmark_filter=REGEX] [--benchmark_out=FILE] ...
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "fixed_string.h"
+
+namespace
+{
+    const size_t name_count = 4096;
+    typedef fixed_string<30> name_string;
+
+    // the text of name_count names, 3 to 12 lower case letters each
+    const std::vector<std::string>& name_text()
+    {
+        static const std::vector<std::string> names = []
+        {
+            std::vector<std::string> text(name_count);
+            std::minstd_rand random(1019);
+            for (auto& name : text)
+            {
+                name.resize(3 + random() % 10);
+                for (char& c : name)
+                {
+                    c = static_cast<char>('a' + random() % 26);
+                }
+            }
+            return text;
+        }();
+        return names;
+    }
+
+    void assign_text(std::string& value, std::string_view text) { value.assign(text.data(), text.size()); }
+    void assign_text(name_string& value, std::string_view text) { value.assign(text); }
+
+    template <typename String>
+    std::vector<String> make_names(const std::vector<std::string>& text)
+    {
+        std::vector<String> names(text.size());
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            assign_text(names[i], text[i]);
+        }
+        return names;
+    }
+
+    template <typename String>
+    void BM_Copy(benchmark::State& state)
+    {
+        const std::vector<String> names = make_names<String>(name_text());
+        for (auto _ : state)
+        {
+            std::vector<String> copy(names);
+            benchmark::DoNotOptimize(copy.data());
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(names.size()));
+    }
+
+    template <typename String>
+    void BM_Build(benchmark::State& state)
+    {
+        const std::vector<std::string>& text = name_text();
+        std::vector<std::string_view> views(text.begin(), text.end());
+        for (auto _ : state)
+        {
+            std::vector<String> names(views.size());
+            for (size_t i = 0; i < views.size(); ++i)
+            {
+                assign_text(names[i], views[i]);
+            }
+            benchmark::DoNotOptimize(names.data());
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(views.size()));
+    }
+
+    // counts the equal pairs of names[i] and names[others[i]]
+    template <typename String>
+    void compare_names(benchmark::State& state, const std::vector<size_t>& others)
+    {
+        const std::vector<String> names = make_names<String>(name_text());
+        for (auto _ : state)
+        {
+            size_t equal = 0;
+            for (size_t i = 0; i < names.size(); ++i)
+            {
+                equal += names[i] == names[others[i]] ? 1 : 0;
+            }
+            benchmark::DoNotOptimize(equal);
+        }
+        state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(names.size()));
+    }
+
+    template <typename String>
+    void BM_EqualSameSize(benchmark::State& state)
+    {
+        // pair each name with the next one of its length, so the length check never settles it
+        const std::vector<std::string>& text = name_text();
+        std::vector<size_t> order(text.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&text](size_t a, size_t b) { return text[a].size() < text[b].size(); });
+        std::vector<size_t> others(text.size());
+        for (size_t k = 0; k < order.size(); ++k)
+        {
+            const size_t next = k + 1 < order.size() && text[order[k + 1]].size() == text[order[k]].size() ? order[k + 1] : order[k];
+            others[order[k]] = next;
+        }
+        compare_names<String>(state, others);
+    }
+
+    template <typename String>
+    void BM_EqualAnySize(benchmark::State& state)
+    {
+        std::vector<size_t> others(name_count);
+        for (size_t i = 0; i < others.size(); ++i)
+        {
+            others[i] = (i + 1) % others.size();
+        }
+        compare_names<String>(state, others);
+    }
+
+    void register_benchmarks()
+    {
+        benchmark::RegisterBenchmark("BM_Copy/std::string", BM_Copy<std::string>);
+        benchmark::RegisterBenchmark("BM_Copy/fixed_string", BM_Copy<name_string>);
+        benchmark::RegisterBenchmark("BM_Build/std::string", BM_Build<std::string>);
+        benchmark::RegisterBenchmark("BM_Build/fixed_string", BM_Build<name_string>);
+        benchmark::RegisterBenchmark("BM_EqualSameSize/std::string", BM_EqualSameSize<std::string>);
+        benchmark::RegisterBenchmark("BM_EqualSameSize/fixed_string", BM_EqualSameSize<name_string>);
+        benchmark::RegisterBenchmark("BM_EqualAnySize/std::string", BM_EqualAnySize<std::string>);
+        benchmark::RegisterBenchmark("BM_EqualAnySize/fixed_string", BM_EqualAnySize<name_string>);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    bool has_out = false;
+    std::vector<char*> args;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (std::strncmp(argv[i], "--benchmark_out=", 16) == 0)
+        {
+            has_out = true;
+        }
+        args.push_back(argv[i]);
+    }
+
+    // JSON results by default so runs can be compared
+    char default_out[] = "--benchmark_out=FixedStringBenchmark.json";
+    char default_format[] = "--benchmark_out_format=json";
+    if (!has_out)
+    {
+        args.push_back(default_out);
+        args.push_back(default_format);
+    }
+
+    int count = static_cast<int>(args.size());
+    args.push_back(NULL);
+    benchmark::Initialize(&count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(count, args.data()))
+    {
+        return -1;
+    }
+
+    register_benchmarks();
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,138 @@
+// LineReaderBenchmark.cpp : Compares line_reader with iostream getline on a large input file.
+//
+//  getline   std::getline into a std::string, unbounded
+//  bounded   istream::getline into a fixed buffer, with the clear / ignore dance on overflow that
+//            BufferOverFlow.cpp used
+//  reader    line_reader block reads handing out string_views
+//
+// The input is generated once: mostly short records with a few that are longer than the limit.
+// Every reader must agree on the number of lines, overflows and kept bytes.
+//
+// usage: LineReaderBenchmark [lines] [file]
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+
+#include "line_reader.h"
+
+namespace
+{
+    const size_t record_limit = 256;
+
+    struct read_totals
+    {
+        uint64_t lines = 0;
+        uint64_t overflows = 0;
+        uint64_t kept_bytes = 0;
+        double seconds = 0;
+    };
+
+    void generate(const std::string& path, size_t lines)
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        std::minstd_rand random(405);
+        std::string line;
+        for (size_t i = 0; i < lines; ++i)
+        {
+            // one line in a thousand is too long
+            const size_t length = random() % 1000 == 0 ? record_limit + random() % 4096 : random() % 120;
+            line.assign(length, 'a');
+            for (size_t k = 0; k < length; k += 7)
+            {
+                line[k] = static_cast<char>('a' + random() % 26);
+            }
+            line += '\n';
+            out.write(line.data(), static_cast<std::streamsize>(line.size()));
+        }
+    }
+
+    template <typename Reader>
+    read_totals timed(Reader reader)
+    {
+        read_totals totals;
+        auto start = std::chrono::steady_clock::now();
+        reader(totals);
+        totals.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return totals;
+    }
+
+    void report(const char* name, const read_totals& totals, uint64_t file_bytes, const read_totals& baseline)
+    {
+        const bool agree = totals.lines == baseline.lines && totals.overflows == baseline.overflows && totals.kept_bytes == baseline.kept_bytes;
+        std::cout << std::fixed << std::setprecision(1) << name << std::setw(9) << static_cast<double>(file_bytes) / totals.seconds / 1e6 << " MB/s "
+            << std::setw(7) << static_cast<double>(totals.lines) / totals.seconds / 1e6 << " M lines/s  "
+            << totals.lines << " lines, " << totals.overflows << " overflows" << (agree ? "" : "  DISAGREE") << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t lines = argc > 1 ? std::stoul(argv[1]) : 5000000;
+    const std::string path = argc > 2 ? argv[2] : "LineReaderBenchmark.txt";
+
+    generate(path, lines);
+    uint64_t file_bytes = 0;
+    {
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        file_bytes = static_cast<uint64_t>(in.tellg());
+    }
+    std::cout << "Line Reader Benchmark (" << lines << " lines, " << file_bytes / (1024 * 1024) << " MB, limit "
+        << record_limit << ")" << std::endl;
+
+    read_totals getline_totals = timed([&path](read_totals& totals)
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            ++totals.lines;
+            totals.overflows += line.size() > record_limit ? 1 : 0;
+            totals.kept_bytes += line.size() > record_limit ? record_limit : line.size();
+        }
+    });
+
+    read_totals bounded_totals = timed([&path](read_totals& totals)
+    {
+        std::ifstream in(path, std::ios::binary);
+        char buffer[record_limit + 1];
+        while (in.getline(buffer, sizeof(buffer)) || in.gcount() > 0)
+        {
+            ++totals.lines;
+            totals.kept_bytes += std::strlen(buffer);
+            if (in.fail())
+            {
+                in.clear();
+                in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+                ++totals.overflows;
+            }
+        }
+    });
+
+    read_totals reader_totals = timed([&path](read_totals& totals)
+    {
+        std::FILE* input = std::fopen(path.c_str(), "rb");
+        line_reader reader(input, record_limit);
+        line_record record;
+        while (reader.next(record))
+        {
+            totals.kept_bytes += record.text.size();
+        }
+        totals.lines = reader.lines();
+        totals.overflows = reader.overflows();
+        std::fclose(input);
+    });
+
+    report("getline ", getline_totals, file_bytes, getline_totals);
+    report("bounded ", bounded_totals, file_bytes, getline_totals);
+    report("reader  ", reader_totals, file_bytes, getline_totals);
+
+    std::remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,114 @@
+// RandomBenchmark.cpp : Times filling large fixtures with rand() against xoshiro256 and parallel_fill.
+//
+//  rand         rand() % 100, as add_entries and run_query_injection used it
+//  mt19937      std::mt19937 with std::uniform_int_distribution
+//  xoshiro      xoshiro256::fill on one thread
+//  parallel     parallel_fill over a thread_pool
+//
+// then generates random USERS rows one at a time and with generate_random_users. The parallel
+// results are checked against a single thread run from the same seed, they must be identical.
+//
+// usage: RandomBenchmark [values] [users] [seed]
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bulk_loader.h"
+#include "fast_random.h"
+#include "thread_pool.h"
+
+namespace
+{
+    template <typename Body>
+    double timed(Body body)
+    {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void report(const char* name, size_t count, double seconds, const char* unit)
+    {
+        std::cout << std::fixed << std::setprecision(3) << name << std::setw(9) << seconds << " s "
+            << std::setprecision(1) << std::setw(9) << static_cast<double>(count) / seconds / 1e6 << " M " << unit << "/s" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t values = argc > 1 ? std::stoul(argv[1]) : 100000000;
+    const size_t users = argc > 2 ? std::stoul(argv[2]) : 10000000;
+    const uint64_t seed = argc > 3 ? std::stoull(argv[3], NULL, 0) : random_seed();
+
+    thread_pool pool;
+    std::cout << "Random Benchmark (" << values << " values, " << users << " users, seed " << seed << ", "
+        << pool.size() << " threads)" << std::endl;
+
+    std::vector<int32_t> data(values);
+    std::srand(static_cast<unsigned>(seed));
+    report("rand     ", values, timed([&]
+    {
+        for (auto& value : data) value = std::rand() % 100;
+    }), "values");
+
+    report("mt19937  ", values, timed([&]
+    {
+        std::mt19937 generator(static_cast<uint32_t>(seed));
+        std::uniform_int_distribution<int32_t> distribution(0, 99);
+        for (auto& value : data) value = distribution(generator);
+    }), "values");
+
+    report("xoshiro  ", values, timed([&]
+    {
+        xoshiro256 generator(seed);
+        generator.fill(data, 0, 99);
+    }), "values");
+
+    report("parallel ", values, timed([&]
+    {
+        parallel_fill(pool, seed, data, 0, 99);
+    }), "values");
+
+    // the same seed on a single thread must give the same values
+    {
+        thread_pool single(1);
+        std::vector<int32_t> again(values);
+        parallel_fill(single, seed, again, 0, 99);
+        std::cout << "parallel_fill " << (again == data ? "matches" : "DIFFERS FROM") << " the single thread fill" << std::endl;
+    }
+
+    std::vector<user_batch> shards;
+    report("users    ", users, timed([&]
+    {
+        random_users rows(users, seed);
+        user_row row;
+        size_t bytes = 0;
+        while (rows(row)) bytes += row.name.size() + row.password.size();
+        if (bytes == 0) std::cout << "no rows" << std::endl;
+    }), "rows");
+
+    report("users par", users, timed([&]
+    {
+        generate_random_users(pool, seed, users, 1, shards);
+    }), "rows");
+
+    {
+        random_users rows(users, seed);
+        user_row row;
+        bool same = true;
+        for (const auto& shard : shards)
+        {
+            for (user_row generated : shard)
+            {
+                same = same && rows(row) && row.id == generated.id && row.name == generated.name && row.password == generated.password;
+            }
+        }
+        std::cout << "generate_random_users " << (same ? "matches" : "DIFFERS FROM") << " random_users" << std::endl;
+    }
+    return 0;
+}
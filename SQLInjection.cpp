@@ -2,12 +2,34 @@
 //
 
 #include <algorithm>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <locale>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
 #include <tuple>
 #include <vector>
 
 #include "sqlite3.h"
+#include "async_query.h"
+#include "bulk_loader.h"
+#include "connection_pool.h"
+#include "index_manager.h"
+#include "injection_rules.h"
+#include "load_test.h"
+#include "output_sink.h"
+#include "query_metrics.h"
+#include "shadow_screen.h"
+#include "statement_cache.h"
+#include "user_batch.h"
+#include "user_cache.h"
+#include "tautology_detector.h"
+#include "verdict_cache.h"
 
 // DO NOT CHANGE
 typedef std::tuple<std::string, std::string, std::string> user_record;
@@ -73,54 +95,231 @@ bool initialize_database(sqlite3* db)
     return true;
 }
 
+// where run_query and friends report rejected or failed statements, per thread so load test
+//  workers can run quietly
+static thread_local std::ostream* query_log = &std::cout;
+
+// shape verdict cache used by is_suspected_injection on this thread, NULL to analyze every statement
+static thread_local verdict_cache* active_verdict_cache = NULL;
+
+// prepared statement cache used by run_query on this thread, NULL to run every statement through sqlite3_exec
+static thread_local statement_cache* active_statement_cache = NULL;
+
+// read-through USERS cache used by run_query on this thread for NAME lookups, NULL to send them all to SQLite
+static thread_local user_reader* active_user_reader = NULL;
+
+// shadow screener shared by every thread, NULL unless a candidate detector is being compared. While
+//  it is set every statement is screened in full, the verdict cache is bypassed so the candidate
+//  sees the same statements the detector in use does.
+static shadow_screener* active_shadow_screener = NULL;
+
+// fingerprints a statement once for both caches, returns NULL when neither cache is in use
+const sql_fingerprint* fingerprint_statement(std::string_view sql)
+{
+    static thread_local sql_fingerprint fingerprint;
+    if (active_verdict_cache == NULL && active_statement_cache == NULL)
+    {
+        return NULL;
+    }
+    stage_timer timing(query_stage::fingerprint);
+    fingerprint.compute(sql);
+    return &fingerprint;
+}
+
+// displays an error and returns true if the statement looks like a SQL injection
+bool is_suspected_injection(std::string_view sql, const sql_fingerprint* fingerprint)
+{
+    stage_timer timing(query_stage::screen);
+    const injection_verdict verdict = active_shadow_screener != NULL ? active_shadow_screener->screen(sql) :
+        (active_verdict_cache != NULL && fingerprint != NULL) ? active_verdict_cache->screen(sql, *fingerprint) : detect_injection(sql);
+    timing.stop();
+    if (verdict.detected)
+    {
+        record_rejection(verdict);
+        *query_log << "SQL Injection detected: " << injection_rule_description(verdict.rule) << " using '";
+        if (verdict.rule == injection_rule::tautology)
+        {
+            *query_log << "OR " << verdict.comparison.lhs << verdict.comparison.op << verdict.comparison.rhs;
+        }
+        else
+        {
+            *query_log << verdict.match;
+        }
+        *query_log << "'" << std::endl;
+        return true;
+    }
+    return false;
+}
+
+// runs a statement prepared by the statement cache, collecting rows the same way callback does
+bool run_cached_query(sqlite3* db, statement_cache& cache, sqlite3_stmt* stmt, std::vector< user_record >& records)
+{
+    execute_timer timing;
+    int result;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        row_copy_timer copying;
+        const char* columns[3] = { "", "", "" };
+        int column_count = std::min(sqlite3_column_count(stmt), 3);
+        for (int i = 0; i < column_count; ++i)
+        {
+            const unsigned char* text = sqlite3_column_text(stmt, i);
+            columns[i] = text ? reinterpret_cast<const char*>(text) : "NULL";
+        }
+        records.push_back(std::make_tuple(columns[0], columns[1], columns[2]));
+    }
+
+    cache.finish(stmt);
+    timing.stop();
+    if (result != SQLITE_DONE)
+    {
+        *query_log << "Data failed to be queried from USERS table. ERROR = " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+
+    record_query_rows(records.size());
+    return true;
+}
+
+// callback with the row copy timed, run_query uses it in place of callback when query metrics are built in
+static int timed_callback(void* possible_vector, int argc, char** argv, char** azColName)
+{
+    row_copy_timer copying;
+    return callback(possible_vector, argc, argv, azColName);
+}
+
+// callback for whatever run_query hands to sqlite3_exec, which is not always a three column SELECT
+//  once the statement cache sends PRAGMA and DDL there. Short rows and NULL columns are filled in
+//  the way run_cached_query fills them, before the row goes to callback.
+static int exec_callback(void* possible_vector, int argc, char** argv, char** azColName)
+{
+    char empty[] = "";
+    char null_text[] = "NULL";
+    char* columns[3] = { empty, empty, empty };
+    for (int i = 0; i < std::min(argc, 3); ++i)
+    {
+        columns[i] = argv[i] ? argv[i] : null_text;
+    }
+    return query_metrics_enabled ? timed_callback(possible_vector, std::min(argc, 3), columns, azColName) :
+        callback(possible_vector, std::min(argc, 3), columns, azColName);
+}
+
+// answers a SELECT ID, NAME, PASSWORD ... WHERE NAME='x' lookup from the user cache, returns false
+//  when the statement has to go to SQLite instead
+bool run_user_lookup(const sql_fingerprint& fingerprint, std::vector< user_record >& records)
+{
+    static const std::string lookup_shape = "select id , name , password from users where name = ?";
+    if (active_user_reader == NULL || fingerprint.literals.size() != 1 ||
+        fingerprint.literals[0].kind != sql_token_kind::string_literal ||
+        fingerprint.shape.compare(0, lookup_shape.size(), lookup_shape) != 0 ||
+        (fingerprint.shape.size() != lookup_shape.size() && fingerprint.shape.compare(lookup_shape.size(), std::string::npos, " ;") != 0))
+    {
+        return false;
+    }
+
+    static thread_local std::string name;
+    static thread_local cached_user user;
+    string_literal_value(fingerprint.literals[0].text, name);
+    switch (active_user_reader->by_name(name, user))
+    {
+    case user_lookup::found:
+        records.push_back(std::make_tuple(std::to_string(user.id), user.name, user.password));
+        return true;
+    case user_lookup::not_found:
+        return true;
+    default:
+        // names shared by several users, and failed reads, are left to SQLite
+        return false;
+    }
+}
+
 bool run_query(sqlite3* db, const std::string& sql, std::vector< user_record >& records)
 {
     // TODO: Fix this method to fail and display an error if there is a suspected SQL Injection
     //  NOTE: You cannot just flag 1=1 as an error, since 2=2 will work just as well. You need
     //  something more generic
 
+    stage_timer timing(query_stage::total);
+
     // clear any prior results
     records.clear();
 
-    std::string sql_lower = sql;
-    std::transform(sql_lower.begin(), sql_lower.end(), sql_lower.begin(), ::tolower);
+    // screen the statement, a shape already known to be clean skips the analysis
+    const sql_fingerprint* fingerprint = fingerprint_statement(sql);
+    if (is_suspected_injection(sql, fingerprint))
+    {
+        return false;
+    }
+
+    if (fingerprint != NULL && run_user_lookup(*fingerprint, records))
+    {
+        record_query_rows(records.size());
+        return true;
+    }
 
-    size_t where_pos = sql_lower.find(str_where);
+    // a write empties the user cache once it has run, there is no telling which rows it changed
+    std::optional<user_cache_statement> writing;
+    if (active_user_reader != NULL && may_change_users(sql))
+    {
+        writing.emplace(active_user_reader->shared_cache());
+    }
 
-    if (where_pos != std::string::npos) {
-        size_t or_pos = sql_lower.find(" or ", where_pos);
+    if (active_statement_cache != NULL && statement_cache::is_cacheable(*fingerprint))
+    {
+        sqlite3_stmt* stmt = active_statement_cache->prepare(*fingerprint);
+        if (stmt != NULL)
+        {
+            return run_cached_query(db, *active_statement_cache, stmt, records);
+        }
+        // the shape would not prepare, e.g. SQLite takes no parameter where it has a literal, so the
+        //  text runs as is below and any error is the one sqlite3_exec reports for it
+    }
 
-        if (or_pos != std::string::npos) {
-            size_t eq_pos = sql_lower.find("=", or_pos);
+    char* error_message;
+    execute_timer executing;
+    if (sqlite3_exec(db, sql.c_str(), exec_callback, &records, &error_message) != SQLITE_OK)
+    {
+        executing.stop();
+        *query_log << "Data failed to be queried from USERS table. ERROR = " << error_message << std::endl;
+        sqlite3_free(error_message);
+        return false;
+    }
+    executing.stop();
 
-            if (eq_pos != std::string::npos) {
-                std::string left_part = sql_lower.substr(or_pos + 4, eq_pos - (or_pos + 4));
+    record_query_rows(records.size());
+    return true;
+}
 
-                size_t end_pos = sql_lower.find(";", eq_pos);
-                if (end_pos == std::string::npos) {
-                    end_pos = sql_lower.length();
-                }
-                std::string right_part = sql_lower.substr(eq_pos + 1, end_pos - (eq_pos + 1));
+// screens and runs a query selecting ID, NAME, PASSWORD, decoding the rows straight into a typed batch
+bool run_query_batch(sqlite3* db, const std::string& sql, user_batch& batch)
+{
+    // clear any prior results
+    batch.clear();
 
-                left_part.erase(0, left_part.find_first_not_of(" \t\n\r\f\v"));
-                left_part.erase(left_part.find_last_not_of(" \t\n\r\f\v") + 1);
-                right_part.erase(0, right_part.find_first_not_of(" \t\n\r\f\v"));
-                right_part.erase(right_part.find_last_not_of(" \t\n\r\f\v") + 1);
+    const sql_fingerprint* fingerprint = fingerprint_statement(sql);
+    if (is_suspected_injection(sql, fingerprint))
+    {
+        return false;
+    }
 
-                if (left_part == right_part) {
-                    std::cout << "SQL Injection detected: Tautology attack using 'OR " << left_part << "=" << right_part << "'" << std::endl;
-                    return false;
-                }
-            }
-        }
+    if (active_statement_cache == NULL)
+    {
+        *query_log << "Batch queries require the statement cache." << std::endl;
+        return false;
     }
 
+    sqlite3_stmt* stmt = active_statement_cache->prepare(*fingerprint);
+    if (stmt == NULL)
+    {
+        *query_log << "Data failed to be queried from USERS table. ERROR = " << active_statement_cache->last_error() << std::endl;
+        return false;
+    }
 
-    char* error_message;
-    if (sqlite3_exec(db, sql.c_str(), callback, &records, &error_message) != SQLITE_OK)
+    int result = fetch_users(stmt, batch);
+    active_statement_cache->finish(stmt);
+    if (result != SQLITE_DONE)
     {
-        std::cout << "Data failed to be queried from USERS table. ERROR = " << error_message << std::endl;
-        sqlite3_free(error_message);
+        *query_log << "Data failed to be queried from USERS table. ERROR = " << sqlite3_errmsg(db) << std::endl;
         return false;
     }
 
@@ -175,6 +374,34 @@ void dump_results(const std::string& sql, const std::vector< user_record >& reco
     }
 }
 
+void dump_batch(output_sink& sink, const std::string& sql, const user_batch& batch)
+{
+    sink.begin_result(sql, batch.size());
+    for (const user_row& row : batch)
+    {
+        sink.write_row(row.id, row.name, row.password);
+    }
+    sink.end_result();
+}
+
+// the lookups run_queries and the load test repeat, which should be index searches rather than scans
+const std::vector<std::string> hot_user_lookups = {
+    "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'",
+};
+
+// creates the USERS secondary indexes and warns about hot lookups that still scan the table
+bool index_users(sqlite3* db)
+{
+    index_manager users_indexes(db);
+    if (users_indexes.ensure() < 0 || !users_indexes.analyze())
+    {
+        std::cout << "Failed to index the USERS table. ERROR = " << users_indexes.last_error() << std::endl;
+        return false;
+    }
+    users_indexes.check_plans(hot_user_lookups, std::cout);
+    return true;
+}
+
 // DO NOT CHANGE
 void run_queries(sqlite3* db)
 {
@@ -201,9 +428,354 @@ void run_queries(sqlite3* db)
 
 }
 
+// the same lookups as run_queries, read into a typed batch instead of user_record tuples
+void run_batch_queries(sqlite3* db)
+{
+    user_batch batch;
+    // flushed after each result so it stays in order with the other console output
+    output_sink sink(std::cout, sink_format::text, flush_policy::per_result);
+
+    std::string sql = "SELECT ID, NAME, PASSWORD FROM USERS";
+    if (!run_query_batch(db, sql, batch)) return;
+    dump_batch(sink, sql, batch);
+
+    sql = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'";
+    if (!run_query_batch(db, sql, batch)) return;
+    dump_batch(sink, sql, batch);
+}
+
+// runs the run_queries statements for one load test worker thread on its own connection and statement cache
+class load_test_runner
+{
+public:
+    load_test_runner(sqlite3* db, verdict_cache* verdicts, user_cache* users) : db(db), cache(db), silent(nullptr)
+    {
+        active_statement_cache = &cache;
+        active_verdict_cache = verdicts;
+        if (users != NULL)
+        {
+            reader.reset(new user_reader(db, *users));
+            active_user_reader = reader.get();
+        }
+        query_log = &silent;
+    }
+
+    ~load_test_runner()
+    {
+        active_statement_cache = NULL;
+        active_verdict_cache = NULL;
+        active_user_reader = NULL;
+        query_log = &std::cout;
+    }
+
+    load_test_runner(const load_test_runner&) = delete;
+    load_test_runner& operator=(const load_test_runner&) = delete;
+
+    bool operator()(load_query_kind kind)
+    {
+        switch (kind)
+        {
+        case load_query_kind::scan:
+            return run_query(db, "SELECT * from USERS", records);
+        case load_query_kind::injected:
+            return run_query_injection(db, lookup_sql, records);
+        case load_query_kind::lookup:
+        default:
+            return run_query(db, lookup_sql, records);
+        }
+    }
+
+    // runs one statement for an async_query_executor worker
+    bool operator()(const std::string& sql, std::vector< user_record >& results)
+    {
+        return run_query(db, sql, results);
+    }
+
+private:
+    const std::string lookup_sql = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'";
+    sqlite3* db;
+    statement_cache cache;
+    std::unique_ptr<user_reader> reader;
+    // stream with no buffer, everything written to it is dropped
+    std::ostream silent;
+    std::vector< user_record > records;
+};
+
+// issues the load test mix from this thread through an async_query_executor with options.threads
+//  workers, keeping depth statements in flight and submitting them batch at a time. Latency is
+//  measured from submission to the result arriving on the completion queue.
+load_test_report run_async_load_test(connection_pool& pool, const load_test_options& options, size_t depth, size_t batch,
+    verdict_cache* verdicts, user_cache* users)
+{
+    const std::string lookup_sql = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'";
+    const std::string scan_sql = "SELECT * from USERS";
+    const std::string injected_sql[] = { lookup_sql + " or 1=1;", lookup_sql + " or 2=2;", lookup_sql + " or 'hi'='hi';", lookup_sql + " or 'hack'='hack';" };
+
+    async_query_executor< user_record > executor(pool, options.threads,
+        [verdicts, users](sqlite3* db) { return load_test_runner(db, verdicts, users); });
+    completion_queue< user_record > done;
+
+    std::minstd_rand random(options.seed);
+    std::uniform_int_distribution<unsigned> percent(0, 99);
+    depth = std::max<size_t>(1, depth);
+    batch = std::max<size_t>(1, std::min(batch, depth));
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(options.queries);
+    load_test_report report;
+    size_t submitted = 0;
+    size_t in_flight = 0;
+    std::vector<std::string> statements;
+
+    auto begin = std::chrono::steady_clock::now();
+    auto elapsed_ns = [&begin]
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+    };
+
+    while (report.queries < options.queries)
+    {
+        // top up to depth outstanding statements, a whole batch at a time
+        while (submitted < options.queries && in_flight + batch <= depth)
+        {
+            size_t count = std::min(batch, options.queries - submitted);
+            statements.clear();
+            for (size_t k = 0; k < count; ++k)
+            {
+                unsigned roll = percent(random);
+                statements.push_back(roll < options.injected_percent ? injected_sql[roll % 4] :
+                    (roll < options.injected_percent + options.scan_percent ? scan_sql : lookup_sql));
+            }
+            // the tag carries the submission time
+            executor.submit_batch(statements, done, elapsed_ns());
+            submitted += count;
+            in_flight += count;
+        }
+
+        async_query_result< user_record > result;
+        if (!done.next(result))
+        {
+            break;
+        }
+        latencies.push_back(elapsed_ns() - result.tag);
+        report.accepted += result.status == async_query_status::completed ? 1 : 0;
+        ++report.queries;
+        --in_flight;
+    }
+
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    report.rejected = report.queries - report.accepted;
+    report.max_us = latencies.empty() ? 0 : static_cast<double>(*std::max_element(latencies.begin(), latencies.end())) / 1000.0;
+    report.p50_us = load_test_detail::percentile_us(latencies, 0.50);
+    report.p99_us = load_test_detail::percentile_us(latencies, 0.99);
+    return report;
+}
+
+// SQLInjection --load-test [--threads N] [--queries N] [--injected PCT] [--scan PCT] [--users N] [--db file]
+//                         [--warm-up shapes-file] [--no-verdict-cache] [--no-indexes] [--no-user-cache]
+//                         [--metrics file] [--async DEPTH] [--batch N] [--shadow NAME] [--shadow-report file]
+//  seeds a database, then runs the run_queries workload on N threads with one pooled connection each
+//  and a verdict cache and user cache shared by all of them. --metrics writes the per-stage query metrics to file
+//  afterwards, in builds with SQL_QUERY_METRICS defined. --async issues the workload from one thread through
+//  an async_query_executor with DEPTH statements in flight, submitted N to a batch. --shadow runs the
+//  NAME detector in the background on every statement run_query screens and reports how it compares
+//  with detect_injection, to stdout or to --shadow-report
+int run_load_test_mode(int argc, char* argv[])
+{
+    load_test_options options;
+    size_t extra_users = 0;
+    std::string db_path;
+    std::string warm_up_path;
+    std::string metrics_path;
+    bool use_verdict_cache = true;
+    bool use_indexes = true;
+    bool use_user_cache = true;
+    size_t async_depth = 0;
+    size_t async_batch = 1;
+    std::string shadow_name;
+    std::string shadow_report_path;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--load-test") continue;
+        else if (arg == "--threads" && has_value) options.threads = std::stoul(argv[++i]);
+        else if (arg == "--queries" && has_value) options.queries = std::stoul(argv[++i]);
+        else if (arg == "--injected" && has_value) options.injected_percent = static_cast<unsigned>(std::stoul(argv[++i]));
+        else if (arg == "--scan" && has_value) options.scan_percent = static_cast<unsigned>(std::stoul(argv[++i]));
+        else if (arg == "--users" && has_value) extra_users = std::stoul(argv[++i]);
+        else if (arg == "--db" && has_value) db_path = argv[++i];
+        else if (arg == "--warm-up" && has_value) warm_up_path = argv[++i];
+        else if (arg == "--no-verdict-cache") use_verdict_cache = false;
+        else if (arg == "--no-indexes") use_indexes = false;
+        else if (arg == "--no-user-cache") use_user_cache = false;
+        else if (arg == "--metrics" && has_value) metrics_path = argv[++i];
+        else if (arg == "--async" && has_value) async_depth = std::stoul(argv[++i]);
+        else if (arg == "--batch" && has_value) async_batch = std::stoul(argv[++i]);
+        else if (arg == "--shadow" && has_value) shadow_name = argv[++i];
+        else if (arg == "--shadow-report" && has_value) shadow_report_path = argv[++i];
+        else
+        {
+            std::cout << "Unknown argument: " << arg << std::endl;
+            return -1;
+        }
+    }
+    if (!options.valid())
+    {
+        std::cout << "--injected " << options.injected_percent << " and --scan " << options.scan_percent
+            << " add up to more than 100%" << std::endl;
+        return -1;
+    }
+
+    std::unique_ptr<shadow_screener> shadow;
+    if (!shadow_name.empty())
+    {
+        const shadow_detector* candidate = find_shadow_detector(shadow_name);
+        if (candidate == NULL)
+        {
+            std::cout << "Unknown detector " << shadow_name << ", expected one of " << shadow_detector_names() << std::endl;
+            return -1;
+        }
+        shadow.reset(new shadow_screener(*find_shadow_detector("rules"), *candidate));
+    }
+
+    std::string uri;
+    if (db_path.empty())
+    {
+        uri = connection_pool::shared_memory_uri("sql_injection_load_test");
+    }
+    else
+    {
+        std::remove(db_path.c_str());
+        uri = db_path;
+    }
+
+    std::cout << std::endl << "Load test: " << options.threads << " threads, " << options.queries << " queries ("
+        << options.injected_percent << "% injected, " << options.scan_percent << "% scans) on "
+        << (db_path.empty() ? "shared in-memory database" : db_path) << std::endl;
+    if (async_depth > 0)
+    {
+        std::cout << "Async: one submitting thread, " << async_depth << " statements in flight, batches of " << async_batch << std::endl;
+    }
+
+    connection_pool pool(uri, options.threads);
+    if (!pool.ok())
+    {
+        std::cout << "Failed to open the connection pool. ERROR=" << pool.error() << std::endl;
+        return -1;
+    }
+
+    // created before seeding, so the bulk load goes through its invalidation like any other write
+    user_cache users;
+
+    {
+        connection_pool::lease seed(pool);
+        if (!initialize_database(seed.get()))
+        {
+            std::cout << "Database Initialization Failed. Terminating." << std::endl;
+            return -1;
+        }
+
+        bulk_load_stats seeded;
+        if (extra_users > 0 && !bulk_load_users(seed.get(), users, synthetic_users(extra_users, 5), bulk_load_options(), seeded))
+        {
+            return -1;
+        }
+
+        if (use_indexes && !index_users(seed.get()))
+        {
+            return -1;
+        }
+    }
+
+    verdict_cache verdicts;
+    if (!warm_up_path.empty())
+    {
+        long loaded = verdicts.warm_up(warm_up_path);
+        if (loaded < 0)
+        {
+            std::cout << "Failed to open " << warm_up_path << std::endl;
+            return -1;
+        }
+        std::cout << "Verdict cache warmed up with " << loaded << " shapes." << std::endl;
+    }
+    verdict_cache* shared_verdicts = use_verdict_cache ? &verdicts : NULL;
+
+    user_cache* shared_users = use_user_cache ? &users : NULL;
+
+    active_shadow_screener = shadow.get();
+    load_test_report report;
+    try
+    {
+        report = async_depth > 0 ?
+            run_async_load_test(pool, options, async_depth, async_batch, shared_verdicts, shared_users) :
+            run_load_test(pool, options,
+                [shared_verdicts, shared_users](sqlite3* db) { return load_test_runner(db, shared_verdicts, shared_users); });
+    }
+    catch (const std::exception& error)
+    {
+        // a worker could not set up its runner, or a query threw
+        active_shadow_screener = NULL;
+        std::cout << "Load test failed. ERROR = " << error.what() << std::endl;
+        return -1;
+    }
+    active_shadow_screener = NULL;
+
+    std::cout << std::fixed << std::setprecision(1)
+        << report.queries << " queries (" << report.accepted << " accepted, " << report.rejected << " rejected) in "
+        << std::setprecision(3) << report.seconds << " s = " << std::setprecision(0) << report.queries_per_second() << " queries/s" << std::endl
+        << std::setprecision(1) << "latency p50 " << report.p50_us << " us, p99 " << report.p99_us << " us, max " << report.max_us << " us" << std::endl;
+    if (use_verdict_cache)
+    {
+        std::cout << "verdict cache hit ratio " << std::setprecision(3) << verdicts.hit_ratio() << " (" << verdicts.hits() << " hits, "
+            << verdicts.misses() << " misses)" << std::endl;
+    }
+    if (use_user_cache)
+    {
+        std::cout << "user cache " << users.memory_bytes() / 1024 << " KB, " << users.evictions() << " evictions" << std::endl;
+    }
+
+    if (!metrics_path.empty())
+    {
+        if (!query_metrics_enabled)
+        {
+            std::cout << "Query metrics are compiled out, rebuild with SQL_QUERY_METRICS defined to collect them." << std::endl;
+        }
+        if (!dump_query_metrics(metrics_path))
+        {
+            std::cout << "Failed to write " << metrics_path << std::endl;
+            return -1;
+        }
+        std::cout << "Query metrics written to " << metrics_path << std::endl;
+    }
+
+    if (shadow)
+    {
+        if (shadow_report_path.empty())
+        {
+            std::cout << std::endl;
+            shadow->write_report(std::cout);
+        }
+        else
+        {
+            std::ofstream report(shadow_report_path, std::ios::binary);
+            shadow->write_report(report);
+            if (!report)
+            {
+                std::cout << "Failed to write " << shadow_report_path << std::endl;
+                return -1;
+            }
+            std::cout << "Shadow report written to " << shadow_report_path << std::endl;
+        }
+    }
+
+    return 0;
+}
+
 // You can change main by adding stuff to it, but all of the existing code must remain, and be in the
 // in the order called, and with none of this existing code placed into conditional statements
-int main()
+int main(int argc, char* argv[])
 {
     // initialize random seed:
     srand(time(nullptr));
@@ -226,6 +798,12 @@ int main()
 
     std::cout << "Connected to the database." << std::endl;
 
+    // reuse prepared statements and injection verdicts for repeated query shapes
+    statement_cache query_cache(db);
+    active_statement_cache = &query_cache;
+    verdict_cache query_verdicts;
+    active_verdict_cache = &query_verdicts;
+
     // initialize our database
     if (!initialize_database(db))
     {
@@ -234,15 +812,32 @@ int main()
     }
     else
     {
+        index_users(db);
         run_queries(db);
+        run_batch_queries(db);
     }
 
+    std::cout << std::endl << "Statement cache: " << query_cache.hits() << " hits, " << query_cache.misses() << " misses, "
+        << query_cache.evictions() << " evictions." << std::endl;
+    std::cout << "Verdict cache: " << query_verdicts.hits() << " hits, " << query_verdicts.misses() << " misses." << std::endl;
+
+    // cached statements must be finalized before the connection can close
+    active_statement_cache = NULL;
+    active_verdict_cache = NULL;
+    query_cache.clear();
+
     // close the connection if opened
     if (db != NULL)
     {
         sqlite3_close(db);
     }
 
+    // any arguments select the multithreaded load test after the example has run
+    if (return_code == 0 && argc > 1)
+    {
+        return_code = run_load_test_mode(argc, argv);
+    }
+
     return return_code;
 }
 
@@ -0,0 +1,494 @@
+// SQLInjectionBenchmark.cpp : Google Benchmark suite for the SQLInjection.cpp hot paths.
+//
+// Covers run_query with clean and injected statements, run_query_injection, callback row
+// materialization, initialize_database seeding, dump_results and NAME point lookups with and
+// without the index_manager indexes or the user cache, over USERS tables from 4 rows
+// up to 10M rows and statements from 50 B up to 64 KB. Every table starts with the four
+// initialize_database rows and is topped up with the bulk loader, once per size.
+//
+// Results are written as JSON to SQLInjectionBenchmark.json unless --benchmark_out is given, and
+// two runs can be compared with compare_benchmarks.py.
+//
+// usage: SQLInjectionBenchmark [--max_rows=N] [--benchmark_filter=REGEX] [--benchmark_out=FILE] ...
+//        --max_rows drops the table sizes above N, the 10M row cases need a few GB of memory
+
+#include <cstring>
+#include <map>
+#include <streambuf>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+// the example program is compiled in as is, its main is renamed so this file can have its own
+#define main sql_injection_example_main
+#include "SQLInjection.cpp"
+#undef main
+
+namespace
+{
+    const int64_t table_sizes[] = { 4, 1000, 100000, 10000000 };
+    const int64_t statement_lengths[] = { 50, 1024, 65536 };
+
+    // swallows everything written to it, so benchmarks measure formatting rather than the console
+    class null_buffer : public std::streambuf
+    {
+    protected:
+        int overflow(int c) override { return traits_type::not_eof(c); }
+        std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+    };
+
+    null_buffer discard;
+    std::ostream silent(&discard);
+
+    // points std::cout and query_log at the discarding buffer for the life of the scope
+    class quiet_scope
+    {
+    public:
+        quiet_scope() : saved_cout(std::cout.rdbuf(&discard)), saved_log(query_log) { query_log = &silent; }
+        ~quiet_scope()
+        {
+            std::cout.rdbuf(saved_cout);
+            query_log = saved_log;
+        }
+
+        quiet_scope(const quiet_scope&) = delete;
+        quiet_scope& operator=(const quiet_scope&) = delete;
+
+    private:
+        std::streambuf* saved_cout;
+        std::ostream* saved_log;
+    };
+
+    // in-memory USERS tables by row count and indexing, kept for the whole run since the large ones are slow to build
+    std::map<std::pair<int64_t, bool>, sqlite3*> databases;
+
+    sqlite3* users_database(int64_t rows, bool indexed = false)
+    {
+        auto found = databases.find(std::make_pair(rows, indexed));
+        if (found != databases.end())
+        {
+            return found->second;
+        }
+
+        quiet_scope quiet;
+        sqlite3* db = NULL;
+        if (sqlite3_open(":memory:", &db) != SQLITE_OK || !initialize_database(db))
+        {
+            sqlite3_close(db);
+            return NULL;
+        }
+        if (rows > 4)
+        {
+            bulk_load_stats stats;
+            if (!bulk_load_users(db, synthetic_users(static_cast<size_t>(rows - 4), 5), bulk_load_options(), stats))
+            {
+                sqlite3_close(db);
+                return NULL;
+            }
+        }
+        if (indexed && !index_users(db))
+        {
+            sqlite3_close(db);
+            return NULL;
+        }
+        databases[std::make_pair(rows, indexed)] = db;
+        return db;
+    }
+
+    void close_databases()
+    {
+        for (auto& entry : databases)
+        {
+            sqlite3_close(entry.second);
+        }
+        databases.clear();
+    }
+
+    // a primary key lookup of exactly length bytes, padded with a literal the lookup has to compare
+    std::string clean_statement(size_t length)
+    {
+        std::string sql = "SELECT * FROM USERS WHERE ID=2 AND NAME<>'";
+        if (length > sql.size() + 1)
+        {
+            sql.append(length - sql.size() - 1, 'x');
+        }
+        sql += "'";
+        return sql;
+    }
+
+    // the clean statement with a run_query_injection style tautology on the end, still length bytes
+    std::string injected_statement(size_t length)
+    {
+        const std::string tautology = " or 1=1;";
+        return clean_statement(length > tautology.size() ? length - tautology.size() : 0) + tautology;
+    }
+
+    // installs a statement and verdict cache for run_query when enabled, otherwise run_query goes
+    //  through sqlite3_exec as it does by default
+    class cache_scope
+    {
+    public:
+        cache_scope(sqlite3* db, bool enabled) : statements(db)
+        {
+            if (enabled)
+            {
+                active_statement_cache = &statements;
+                active_verdict_cache = &verdicts;
+            }
+        }
+        ~cache_scope()
+        {
+            active_statement_cache = NULL;
+            active_verdict_cache = NULL;
+            statements.clear();
+        }
+
+        cache_scope(const cache_scope&) = delete;
+        cache_scope& operator=(const cache_scope&) = delete;
+
+    private:
+        statement_cache statements;
+        verdict_cache verdicts;
+    };
+
+    // args: rows, statement length, 1 to use the caches
+    void BM_RunQueryClean(benchmark::State& state)
+    {
+        sqlite3* db = users_database(state.range(0));
+        if (db == NULL)
+        {
+            state.SkipWithError("failed to build the USERS table");
+            return;
+        }
+        const std::string sql = clean_statement(static_cast<size_t>(state.range(1)));
+        cache_scope caches(db, state.range(2) != 0);
+        quiet_scope quiet;
+        std::vector< user_record > records;
+
+        for (auto _ : state)
+        {
+            if (!run_query(db, sql, records))
+            {
+                state.SkipWithError("clean statement was rejected");
+                break;
+            }
+            benchmark::DoNotOptimize(records.data());
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(sql.size()));
+    }
+
+    // args: rows, statement length, 1 to use the caches
+    void BM_RunQueryInjected(benchmark::State& state)
+    {
+        sqlite3* db = users_database(state.range(0));
+        if (db == NULL)
+        {
+            state.SkipWithError("failed to build the USERS table");
+            return;
+        }
+        const std::string sql = injected_statement(static_cast<size_t>(state.range(1)));
+        cache_scope caches(db, state.range(2) != 0);
+        quiet_scope quiet;
+        std::vector< user_record > records;
+
+        for (auto _ : state)
+        {
+            if (run_query(db, sql, records))
+            {
+                state.SkipWithError("injected statement was not detected");
+                break;
+            }
+            benchmark::DoNotOptimize(records.data());
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(sql.size()));
+    }
+
+    // args: rows, statement length
+    void BM_RunQueryInjection(benchmark::State& state)
+    {
+        sqlite3* db = users_database(state.range(0));
+        if (db == NULL)
+        {
+            state.SkipWithError("failed to build the USERS table");
+            return;
+        }
+        const std::string sql = clean_statement(static_cast<size_t>(state.range(1)));
+        quiet_scope quiet;
+        std::vector< user_record > records;
+        srand(405);
+
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(run_query_injection(db, sql, records));
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(sql.size()));
+    }
+
+    // callback on its own, one materialized row per call. args: rows per iteration
+    void BM_Callback(benchmark::State& state)
+    {
+        const size_t rows = static_cast<size_t>(state.range(0));
+        char id[] = "1234567";
+        char name[] = "user1234567";
+        char password[] = "pw1234567";
+        char* values[] = { id, name, password };
+        char* columns[] = { const_cast<char*>("ID"), const_cast<char*>("NAME"), const_cast<char*>("PASSWORD") };
+        std::vector< user_record > records;
+
+        for (auto _ : state)
+        {
+            records.clear();
+            for (size_t i = 0; i < rows; ++i)
+            {
+                callback(&records, 3, values, columns);
+            }
+            benchmark::DoNotOptimize(records.data());
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+    }
+
+    // SELECT * through run_query, every row materialized by callback. args: rows
+    void BM_SelectAll(benchmark::State& state)
+    {
+        sqlite3* db = users_database(state.range(0));
+        if (db == NULL)
+        {
+            state.SkipWithError("failed to build the USERS table");
+            return;
+        }
+        const std::string sql = "SELECT * from USERS";
+        quiet_scope quiet;
+        std::vector< user_record > records;
+
+        for (auto _ : state)
+        {
+            if (!run_query(db, sql, records))
+            {
+                state.SkipWithError("SELECT * failed");
+                break;
+            }
+            benchmark::DoNotOptimize(records.data());
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+    }
+
+    // CREATE TABLE plus the four example rows on a fresh connection
+    void BM_InitializeDatabase(benchmark::State& state)
+    {
+        quiet_scope quiet;
+        for (auto _ : state)
+        {
+            sqlite3* db = NULL;
+            sqlite3_open(":memory:", &db);
+            if (!initialize_database(db))
+            {
+                sqlite3_close(db);
+                state.SkipWithError("initialize_database failed");
+                break;
+            }
+            state.PauseTiming();
+            sqlite3_close(db);
+            state.ResumeTiming();
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * 4);
+    }
+
+    // initialize_database followed by the bulk loader up to the table size. args: rows
+    void BM_SeedUsers(benchmark::State& state)
+    {
+        quiet_scope quiet;
+        for (auto _ : state)
+        {
+            sqlite3* db = NULL;
+            sqlite3_open(":memory:", &db);
+            bulk_load_stats stats;
+            if (!initialize_database(db) ||
+                (state.range(0) > 4 && !bulk_load_users(db, synthetic_users(static_cast<size_t>(state.range(0) - 4), 5), bulk_load_options(), stats)))
+            {
+                sqlite3_close(db);
+                state.SkipWithError("seeding failed");
+                break;
+            }
+            state.PauseTiming();
+            sqlite3_close(db);
+            state.ResumeTiming();
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+    }
+
+    // dump_results formatting into a discarding stream. args: rows
+    void BM_DumpResults(benchmark::State& state)
+    {
+        sqlite3* db = users_database(state.range(0));
+        if (db == NULL)
+        {
+            state.SkipWithError("failed to build the USERS table");
+            return;
+        }
+        const std::string sql = "SELECT * from USERS";
+        std::vector< user_record > records;
+        quiet_scope quiet;
+        run_query(db, sql, records);
+
+        for (auto _ : state)
+        {
+            dump_results(sql, records);
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(records.size()));
+    }
+
+    // run_query on WHERE NAME=... for a row in the middle of the table. args: rows, 1 for the NAME indexes
+    void BM_PointLookup(benchmark::State& state)
+    {
+        sqlite3* db = users_database(state.range(0), state.range(1) != 0);
+        if (db == NULL)
+        {
+            state.SkipWithError("failed to build the USERS table");
+            return;
+        }
+        // rows above 4 are named userN by the bulk loader, the first four by initialize_database
+        const int64_t middle = state.range(0) / 2;
+        const std::string sql = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='" +
+            (middle > 4 ? "user" + std::to_string(middle) : std::string("Wilma")) + "'";
+        quiet_scope quiet;
+        std::vector< user_record > records;
+
+        for (auto _ : state)
+        {
+            if (!run_query(db, sql, records) || records.size() != 1)
+            {
+                state.SkipWithError("point lookup did not find exactly one row");
+                break;
+            }
+            benchmark::DoNotOptimize(records.data());
+        }
+    }
+
+    // the BM_PointLookup statement answered from the user cache after the first call, with the
+    //  statement and verdict caches on as in the load test. args: rows
+    void BM_UserCacheLookup(benchmark::State& state)
+    {
+        sqlite3* db = users_database(state.range(0), true);
+        if (db == NULL)
+        {
+            state.SkipWithError("failed to build the USERS table");
+            return;
+        }
+        const int64_t middle = state.range(0) / 2;
+        const std::string sql = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='" +
+            (middle > 4 ? "user" + std::to_string(middle) : std::string("Wilma")) + "'";
+        cache_scope caches(db, true);
+        user_cache users;
+        user_reader reader(db, users);
+        active_user_reader = &reader;
+        quiet_scope quiet;
+        std::vector< user_record > records;
+
+        for (auto _ : state)
+        {
+            if (!run_query(db, sql, records) || records.size() != 1)
+            {
+                state.SkipWithError("point lookup did not find exactly one row");
+                break;
+            }
+            benchmark::DoNotOptimize(records.data());
+        }
+        active_user_reader = NULL;
+        state.counters["hit_ratio"] = reader.hits() + reader.misses() > 0 ?
+            static_cast<double>(reader.hits()) / static_cast<double>(reader.hits() + reader.misses()) : 0;
+    }
+
+    void register_benchmarks(int64_t max_rows)
+    {
+        std::vector<int64_t> sizes;
+        for (int64_t rows : table_sizes)
+        {
+            if (rows <= max_rows)
+            {
+                sizes.push_back(rows);
+            }
+        }
+
+        auto* clean = benchmark::RegisterBenchmark("BM_RunQueryClean", BM_RunQueryClean);
+        auto* injected = benchmark::RegisterBenchmark("BM_RunQueryInjected", BM_RunQueryInjected);
+        auto* injection = benchmark::RegisterBenchmark("BM_RunQueryInjection", BM_RunQueryInjection);
+        clean->ArgNames({ "rows", "bytes", "cached" });
+        injected->ArgNames({ "rows", "bytes", "cached" });
+        injection->ArgNames({ "rows", "bytes" });
+        for (int64_t rows : sizes)
+        {
+            for (int64_t length : statement_lengths)
+            {
+                clean->Args({ rows, length, 0 })->Args({ rows, length, 1 });
+                injected->Args({ rows, length, 0 })->Args({ rows, length, 1 });
+                injection->Args({ rows, length });
+            }
+        }
+
+        auto* callback_rows = benchmark::RegisterBenchmark("BM_Callback", BM_Callback)->ArgName("rows");
+        auto* select_all = benchmark::RegisterBenchmark("BM_SelectAll", BM_SelectAll)->ArgName("rows")->Unit(benchmark::kMillisecond);
+        auto* seed = benchmark::RegisterBenchmark("BM_SeedUsers", BM_SeedUsers)->ArgName("rows")->Unit(benchmark::kMillisecond);
+        auto* dump = benchmark::RegisterBenchmark("BM_DumpResults", BM_DumpResults)->ArgName("rows")->Unit(benchmark::kMillisecond);
+        auto* lookup = benchmark::RegisterBenchmark("BM_PointLookup", BM_PointLookup)->ArgNames({ "rows", "indexed" })->Unit(benchmark::kMicrosecond);
+        auto* cached_lookup = benchmark::RegisterBenchmark("BM_UserCacheLookup", BM_UserCacheLookup)->ArgName("rows")->Unit(benchmark::kMicrosecond);
+        for (int64_t rows : sizes)
+        {
+            lookup->Args({ rows, 0 })->Args({ rows, 1 });
+            cached_lookup->Arg(rows);
+            callback_rows->Arg(rows);
+            select_all->Arg(rows);
+            seed->Arg(rows);
+            dump->Arg(rows);
+        }
+
+        benchmark::RegisterBenchmark("BM_InitializeDatabase", BM_InitializeDatabase);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int64_t max_rows = 10000000;
+    bool has_out = false;
+
+    // --max_rows is ours, everything else goes to Google Benchmark
+    std::vector<char*> args;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (std::strncmp(argv[i], "--max_rows=", 11) == 0)
+        {
+            max_rows = std::stoll(argv[i] + 11);
+            continue;
+        }
+        if (std::strncmp(argv[i], "--benchmark_out=", 16) == 0)
+        {
+            has_out = true;
+        }
+        args.push_back(argv[i]);
+    }
+
+    // JSON results by default so runs can be compared
+    char default_out[] = "--benchmark_out=SQLInjectionBenchmark.json";
+    char default_format[] = "--benchmark_out_format=json";
+    if (!has_out)
+    {
+        args.push_back(default_out);
+        args.push_back(default_format);
+    }
+
+    int count = static_cast<int>(args.size());
+    args.push_back(NULL);
+    benchmark::Initialize(&count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(count, args.data()))
+    {
+        return -1;
+    }
+
+    register_benchmarks(max_rows);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    close_databases();
+    return 0;
+}
@@ -0,0 +1,158 @@
+// ScreenSql.cpp : Offline SQL injection screening of captured traffic.
+//
+// Reads newline-delimited SQL from a file or stdin in large blocks, splits each block into
+// statements without copying them and screens every block in parallel with screen_statements.
+// Flagged statements are printed with their line number, the rule that fired and the text that
+// gave them away.
+//
+// usage: ScreenSql [file] [--threads N] [--quiet]
+//        with no file, or with -, statements are read from stdin
+
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "batch_screen.h"
+
+namespace
+{
+    const size_t block_size = 16 * 1024 * 1024;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string path;
+    size_t threads = thread_pool::default_size();
+    bool quiet = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) threads = std::stoul(argv[++i]);
+        else if (arg == "--quiet") quiet = true;
+        else if (path.empty()) path = arg;
+        else
+        {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return -1;
+        }
+    }
+
+    std::FILE* input = stdin;
+    if (!path.empty() && path != "-")
+    {
+        input = std::fopen(path.c_str(), "rb");
+        if (input == NULL)
+        {
+            std::cerr << "Failed to open " << path << std::endl;
+            return -1;
+        }
+    }
+
+    thread_pool pool(threads);
+    std::vector<char> block(block_size);
+    std::vector<std::string_view> statements;
+    std::vector<injection_verdict> verdicts;
+
+    size_t carried = 0;     // bytes of an unfinished last line moved to the front of the block
+    size_t line_number = 0; // line number of the first statement in the block
+    size_t total_statements = 0;
+    size_t total_flagged = 0;
+    size_t total_bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (;;)
+    {
+        size_t read = std::fread(block.data() + carried, 1, block.size() - carried, input);
+        size_t filled = carried + read;
+        total_bytes += read;
+        bool at_end = read == 0;
+        if (filled == 0)
+        {
+            break;
+        }
+
+        // only whole lines are screened, the tail waits for the next block unless the input is done
+        size_t complete = filled;
+        if (!at_end)
+        {
+            while (complete > 0 && block[complete - 1] != '\n')
+            {
+                --complete;
+            }
+            if (complete == 0)
+            {
+                if (filled == block.size())
+                {
+                    // a single line longer than the block, grow to hold it
+                    block.resize(block.size() * 2);
+                }
+                carried = filled;
+                continue;
+            }
+        }
+
+        statements.clear();
+        size_t begin = 0;
+        for (size_t i = 0; i <= complete; ++i)
+        {
+            if (i == complete || block[i] == '\n')
+            {
+                size_t end = i;
+                if (end > begin && block[end - 1] == '\r')
+                {
+                    --end;
+                }
+                if (i < complete || end > begin)
+                {
+                    statements.emplace_back(block.data() + begin, end - begin);
+                }
+                begin = i + 1;
+            }
+        }
+
+        total_flagged += screen_statements(pool, statements, verdicts);
+        total_statements += statements.size();
+
+        if (!quiet)
+        {
+            for (size_t i = 0; i < statements.size(); ++i)
+            {
+                if (verdicts[i].detected)
+                {
+                    std::string line = "line " + std::to_string(line_number + i + 1) + ": " + injection_rule_name(verdicts[i].rule) +
+                        " " + injection_evidence(verdicts[i]) + ": ";
+                    std::cout.write(line.data(), static_cast<std::streamsize>(line.size()));
+                    std::cout.write(statements[i].data(), static_cast<std::streamsize>(statements[i].size()));
+                    std::cout.put('\n');
+                }
+            }
+        }
+        line_number += statements.size();
+
+        if (at_end)
+        {
+            break;
+        }
+        carried = filled - complete;
+        std::copy(block.begin() + complete, block.begin() + filled, block.begin());
+    }
+
+    if (input != stdin)
+    {
+        std::fclose(input);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::flush;
+    std::cerr << total_statements << " statements, " << total_flagged << " flagged, " << std::fixed << std::setprecision(3)
+        << seconds << " s, " << std::setprecision(1) << (seconds > 0 ? static_cast<double>(total_bytes) / seconds / 1e6 : 0) << " MB/s, "
+        << std::setprecision(0) << (seconds > 0 ? static_cast<double>(total_statements) / seconds : 0) << " statements/s ("
+        << pool.size() << " threads)" << std::endl;
+
+    return total_flagged > 0 ? 1 : 0;
+}
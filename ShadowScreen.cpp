@@ -0,0 +1,98 @@
+// ShadowScreen.cpp : Replays captured SQL through two injection detectors and reports where they differ.
+//
+// Every statement is screened by the primary detector on this thread, the way run_query would,
+// and by the candidate detector in the background through a shadow_screener. The report lists
+// the statements the two disagree on and the latency of each detector over the same statements.
+// Run it against the same capture with two builds and diff the reports; --no-latency leaves out
+// the timings so the reports only differ if a verdict changed. Unlike --shadow in a live run,
+// nothing is dropped when the queue fills up: the replay waits for the candidate to catch up, so
+// every statement is compared and the counts in the report are the same from run to run.
+//
+// usage: ShadowScreen [file] [--primary NAME] [--candidate NAME] [--queue N] [--report FILE] [--no-latency]
+//        NAME is rules, lexer, simd or legacy, by default the primary is rules and the candidate simd.
+//        With no file, or with -, statements are read from stdin, one per line.
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "shadow_screen.h"
+
+int main(int argc, char* argv[])
+{
+    std::string path;
+    std::string report_path;
+    std::string primary_name = "rules";
+    std::string candidate_name = "simd";
+    size_t queue_limit = 64 * 1024;
+    bool include_latency = true;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--primary" && has_value) primary_name = argv[++i];
+        else if (arg == "--candidate" && has_value) candidate_name = argv[++i];
+        else if (arg == "--queue" && has_value) queue_limit = std::stoul(argv[++i]);
+        else if (arg == "--report" && has_value) report_path = argv[++i];
+        else if (arg == "--no-latency") include_latency = false;
+        else if (path.empty()) path = arg;
+        else
+        {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return -1;
+        }
+    }
+
+    const shadow_detector* primary = find_shadow_detector(primary_name);
+    const shadow_detector* candidate = find_shadow_detector(candidate_name);
+    if (primary == NULL || candidate == NULL)
+    {
+        std::cerr << "Unknown detector " << (primary == NULL ? primary_name : candidate_name)
+            << ", expected one of " << shadow_detector_names() << std::endl;
+        return -1;
+    }
+
+    std::ifstream file;
+    std::istream* input = &std::cin;
+    if (!path.empty() && path != "-")
+    {
+        file.open(path, std::ios::binary);
+        if (!file)
+        {
+            std::cerr << "Failed to open " << path << std::endl;
+            return -1;
+        }
+        input = &file;
+    }
+
+    shadow_screener shadow(*primary, *candidate, queue_limit);
+    std::string statement;
+    while (std::getline(*input, statement))
+    {
+        if (!statement.empty() && statement.back() == '\r')
+        {
+            statement.pop_back();
+        }
+        if (!statement.empty())
+        {
+            shadow.screen_waiting(statement);
+        }
+    }
+
+    if (report_path.empty())
+    {
+        shadow.write_report(std::cout, include_latency);
+        return 0;
+    }
+
+    std::ofstream report(report_path, std::ios::binary);
+    shadow.write_report(report, include_latency);
+    if (!report)
+    {
+        std::cerr << "Failed to write " << report_path << std::endl;
+        return -1;
+    }
+    std::cerr << "Shadow report written to " << report_path << std::endl;
+    return 0;
+}
@@ -4,64 +4,7 @@
 #include <iostream>
 #include <stdexcept>  //added stdexcept
 
-// Custom exception derived from std::exception
-class CustomApplicationException : public std::exception {
-    private:
-        std::string message;
-    public:
-        CustomApplicationException(const std::string& msg) : message(msg) {}
-
-        // Override the what() method to provide custom error message
-        const char* what() const noexcept override {
-            return message.c_str();
-        }
-};
-
-bool do_even_more_custom_application_logic()
-{
-    // TODO: Throw any standard exception
-
-    std::cout << "Running Even More Custom Application Logic." << std::endl;
-    throw std::runtime_error("Something went wrong in even more custom logic!");
-    return true;
-}
-void do_custom_application_logic()
-{
-    // TODO: Wrap the call to do_even_more_custom_application_logic()
-    //  with an exception handler that catches std::exception, displays
-    //  a message and the exception.what(), then continues processing
-    std::cout << "Running Custom Application Logic." << std::endl;
-
-    try {
-        if (do_even_more_custom_application_logic())
-        {
-            std::cout << "Even More Custom Application Logic Succeeded." << std::endl;
-        }
-    }
-
-    // TODO: Throw a custom exception derived from std::exception
-    //  and catch it explictly in main
-
-    catch (const std::exception& e) {
-        std::cout << "Caught an exception in custom application logic: " << e.what() << std::endl;
-    }
-
-    // Throwing a custom exception derived from std::exception
-    throw CustomApplicationException("Custom logic failed with a specific error!");
-
-    std::cout << "Leaving Custom Application Logic." << std::endl; // Unreachable code after throw
-}
-
-float divide(float num, float den)
-{
-    // TODO: Throw an exception to deal with divide by zero errors using
-    //  a standard C++ defined exception
-
-    if (den == 0) {
-        throw std::invalid_argument("Division by zero is not allowed!");
-    }
-    return (num / den);
-}
+#include "error_paths.h"
 
 void do_division() noexcept
 {
@@ -80,6 +23,20 @@ void do_division() noexcept
     }
 }
 
+void try_do_division() noexcept
+{
+    float numerator = 10.0f;
+    float denominator = 0;
+
+    auto result = try_divide(numerator, denominator);
+    if (result) {
+        std::cout << "divide(" << numerator << ", " << denominator << ") = " << *result << std::endl;
+    }
+    else {
+        std::cout << "Error during division: " << result.error().message << std::endl;
+    }
+}
+
 int main()
 {
     std::cout << "Exceptions Tests!" << std::endl;
@@ -107,6 +64,13 @@ int main()
         std::cout << "Main caught an unknown exception!" << std::endl;
     }
 
+    // the same calls again, with every failure returned instead of thrown
+    try_do_division();
+    auto custom = try_do_custom_application_logic();
+    if (!custom) {
+        std::cout << "Main got an error: " << custom.error().message << std::endl;
+    }
+
     std::cout << "Program completed." << std::endl;
     return 0;
 }
@@ -0,0 +1,147 @@
+// TautologyBenchmark.cpp : Compares the tautology detectors used by run_query.
+//
+//  legacy  the original copy/lowercase/find detector
+//  lexer   the single pass sql_lexer detector
+//  simd    the vectorized marker scan feeding the lexer only at OR keywords
+//  rules   the constexpr automaton of injection_rules.h, which also checks the UNION, stacked
+//          query and comment rules in the same pass
+//
+// The short statements are the ones run_queries sends, plus every variant run_query_injection can
+// produce. The long statements are multi-kilobyte IN-lists and literals. The rule statements are
+// caught only by the rules detector, they show what the extra rules cost.
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "injection_rules.h"
+#include "simd_scanner.h"
+#include "tautology_detector.h"
+
+namespace
+{
+    std::vector<std::string> short_queries()
+    {
+        return {
+            "SELECT * from USERS",
+            "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'",
+            "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' or 1=1;",
+            "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' or 2=2;",
+            "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' or 'hi'='hi';",
+            "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' or 'hack'='hack';",
+        };
+    }
+
+    std::vector<std::string> long_queries()
+    {
+        std::string in_list = "SELECT ID, NAME, PASSWORD FROM USERS WHERE ID IN (";
+        for (int i = 0; i < 1000; ++i)
+        {
+            in_list += (i == 0 ? "" : ", ") + std::to_string(i * 7919);
+        }
+        in_list += ")";
+
+        std::string literal = "SELECT ID, NAME, PASSWORD FROM USERS WHERE PASSWORD='" + std::string(8192, 'x') + "'";
+
+        return { in_list, in_list + " or 1=1;", literal, literal + " or 'a'='a';" };
+    }
+
+    std::vector<std::string> rule_queries()
+    {
+        return {
+            "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' UNION SELECT name, sql, type FROM sqlite_master",
+            "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' UNION ALL SELECT 1, 2, 3",
+            "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'; DROP TABLE USERS;",
+            "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred';INSERT INTO USERS VALUES(9, 'x', 'y')",
+            "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='admin'--' AND PASSWORD='x'",
+            "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='admin'/*' AND PASSWORD='x'*/",
+            "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='union select; drop --'",
+        };
+    }
+
+    template <typename Detector>
+    double nanoseconds_per_query(const std::vector<std::string>& queries, Detector detector, size_t iterations, size_t& detections)
+    {
+        detections = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            for (const auto& sql : queries)
+            {
+                detections += detector(sql) ? 1 : 0;
+            }
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double, std::nano>(elapsed).count() /
+            static_cast<double>(iterations * queries.size());
+    }
+
+    void run_set(const char* name, const std::vector<std::string>& queries, size_t iterations)
+    {
+        std::cout << std::endl << name << " statements (" << iterations << " x " << queries.size() << ")" << std::endl;
+
+        // all detectors must agree on every statement before their timings mean anything
+        for (const auto& sql : queries)
+        {
+            bool legacy = detect_tautology_legacy(sql);
+            bool lexer = detect_tautology(sql).detected;
+            bool simd = detect_tautology_simd(sql).detected;
+            bool rules = detect_injection(sql).detected;
+            std::cout << (legacy == lexer && lexer == simd && simd == rules ? "  agree    " : "  DISAGREE ") << (lexer ? "injected " : "clean    ")
+                << (sql.size() > 70 ? sql.substr(0, 60) + "... (" + std::to_string(sql.size()) + " bytes)" : sql) << std::endl;
+        }
+
+        size_t legacy_detections = 0;
+        size_t lexer_detections = 0;
+        size_t simd_detections = 0;
+        size_t rules_detections = 0;
+        double legacy_ns = nanoseconds_per_query(queries, [](const std::string& sql) { return detect_tautology_legacy(sql); }, iterations, legacy_detections);
+        double lexer_ns = nanoseconds_per_query(queries, [](const std::string& sql) { return detect_tautology(sql).detected; }, iterations, lexer_detections);
+        double simd_ns = nanoseconds_per_query(queries, [](const std::string& sql) { return detect_tautology_simd(sql).detected; }, iterations, simd_detections);
+        double rules_ns = nanoseconds_per_query(queries, [](const std::string& sql) { return detect_injection(sql).detected; }, iterations, rules_detections);
+
+        std::cout << std::fixed << std::setprecision(1);
+        std::cout << "legacy detector: " << std::setw(10) << legacy_ns << " ns/query (" << legacy_detections << " detections)" << std::endl;
+        std::cout << "lexer detector:  " << std::setw(10) << lexer_ns << " ns/query (" << lexer_detections << " detections, "
+            << legacy_ns / lexer_ns << "x)" << std::endl;
+        std::cout << "simd detector:   " << std::setw(10) << simd_ns << " ns/query (" << simd_detections << " detections, "
+            << legacy_ns / simd_ns << "x)" << std::endl;
+        std::cout << "rules detector:  " << std::setw(10) << rules_ns << " ns/query (" << rules_detections << " detections, "
+            << legacy_ns / rules_ns << "x)" << std::endl;
+    }
+
+    void run_rule_set(const std::vector<std::string>& queries, size_t iterations)
+    {
+        std::cout << std::endl << "rule statements (" << iterations << " x " << queries.size() << ")" << std::endl;
+        for (const auto& sql : queries)
+        {
+            injection_verdict verdict = detect_injection(sql);
+            std::cout << "  " << std::left << std::setw(10) << (verdict.detected ? injection_rule_name(verdict.rule) : "clean") << std::right
+                << (sql.size() > 70 ? sql.substr(0, 60) + "..." : sql) << std::endl;
+        }
+
+        size_t simd_detections = 0;
+        size_t rules_detections = 0;
+        double simd_ns = nanoseconds_per_query(queries, [](const std::string& sql) { return detect_tautology_simd(sql).detected; }, iterations, simd_detections);
+        double rules_ns = nanoseconds_per_query(queries, [](const std::string& sql) { return detect_injection(sql).detected; }, iterations, rules_detections);
+
+        std::cout << std::fixed << std::setprecision(1);
+        std::cout << "simd detector:   " << std::setw(10) << simd_ns << " ns/query (" << simd_detections << " detections)" << std::endl;
+        std::cout << "rules detector:  " << std::setw(10) << rules_ns << " ns/query (" << rules_detections << " detections)" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = argc > 1 ? std::stoul(argv[1]) : 200000;
+
+    std::cout << "Tautology Detector Benchmark (simd scanner: " << sql_scan_isa() << ")" << std::endl;
+
+    run_set("short", short_queries(), iterations);
+    run_set("long", long_queries(), iterations / 100 + 1);
+    run_rule_set(rule_queries(), iterations);
+
+    return 0;
+}
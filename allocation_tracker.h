@@ -0,0 +1,213 @@
+// allocation_tracker.h : Counts heap allocations so tests can hold code paths to an allocation budget.
+//
+// Two tools:
+//
+//  counting_allocator   a std allocator that counts the buffers one container allocates, for
+//                       checking a growth policy or a reserve
+//  allocation_scope     counts every operator new on the current thread between its construction
+//                       and the call to allocations(), whatever allocated: containers, strings,
+//                       std::function, make_shared and so on
+//
+// allocation_scope relies on operator new and delete being replaced with the counting versions.
+// Exactly one translation unit of the program defines ALLOCATION_TRACKER_REPLACE_NEW before
+// including this header to get them; without them allocation_tracking_enabled() is false and every
+// scope counts 0. The counters are per thread, so a scope only sees its own thread's allocations and
+// a test is not disturbed by work on other threads.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+struct allocation_totals
+{
+    size_t allocations = 0;
+    size_t deallocations = 0;
+    // bytes requested from operator new, not counting what was freed
+    size_t bytes = 0;
+};
+
+namespace allocation_tracker_detail
+{
+    // trivially constructed, so using it from operator new never allocates
+    inline allocation_totals& thread_totals() noexcept
+    {
+        static thread_local allocation_totals totals;
+        return totals;
+    }
+
+    inline bool& replaced() noexcept
+    {
+        static bool installed = false;
+        return installed;
+    }
+
+    inline void note_allocation(size_t size) noexcept
+    {
+        allocation_totals& totals = thread_totals();
+        ++totals.allocations;
+        totals.bytes += size;
+    }
+
+    inline void note_deallocation(void* pointer) noexcept
+    {
+        if (pointer != nullptr)
+        {
+            ++thread_totals().deallocations;
+        }
+    }
+}
+
+// true when the counting operator new is linked in
+inline bool allocation_tracking_enabled() noexcept
+{
+    return allocation_tracker_detail::replaced();
+}
+
+// allocations and deallocations made by this thread since construction or the last reset
+class allocation_scope
+{
+public:
+    allocation_scope() noexcept : start(allocation_tracker_detail::thread_totals()) {}
+
+    void reset() noexcept { start = allocation_tracker_detail::thread_totals(); }
+
+    allocation_totals counted() const noexcept
+    {
+        const allocation_totals& now = allocation_tracker_detail::thread_totals();
+        allocation_totals difference;
+        difference.allocations = now.allocations - start.allocations;
+        difference.deallocations = now.deallocations - start.deallocations;
+        difference.bytes = now.bytes - start.bytes;
+        return difference;
+    }
+
+    size_t allocations() const noexcept { return counted().allocations; }
+    size_t deallocations() const noexcept { return counted().deallocations; }
+    size_t bytes() const noexcept { return counted().bytes; }
+
+private:
+    allocation_totals start;
+};
+
+// what one counting_allocator, and every copy of it, has allocated
+struct allocation_counts
+{
+    size_t allocations = 0;
+    size_t deallocations = 0;
+    // bytes currently allocated and the most there ever were at once
+    size_t bytes = 0;
+    size_t peak_bytes = 0;
+};
+
+template <typename T>
+struct counting_allocator
+{
+    typedef T value_type;
+
+    allocation_counts* counts;
+
+    explicit counting_allocator(allocation_counts* counts) noexcept : counts(counts) {}
+
+    template <typename U>
+    counting_allocator(const counting_allocator<U>& other) noexcept : counts(other.counts) {}
+
+    T* allocate(size_t count)
+    {
+        T* memory = std::allocator<T>().allocate(count);
+        ++counts->allocations;
+        counts->bytes += count * sizeof(T);
+        counts->peak_bytes = std::max(counts->peak_bytes, counts->bytes);
+        return memory;
+    }
+
+    void deallocate(T* memory, size_t count) noexcept
+    {
+        ++counts->deallocations;
+        counts->bytes -= count * sizeof(T);
+        std::allocator<T>().deallocate(memory, count);
+    }
+
+    template <typename U>
+    bool operator==(const counting_allocator<U>& other) const noexcept { return counts == other.counts; }
+    template <typename U>
+    bool operator!=(const counting_allocator<U>& other) const noexcept { return counts != other.counts; }
+};
+
+#if defined(ALLOCATION_TRACKER_REPLACE_NEW)
+
+// the array and nothrow forms of the standard library forward to these
+namespace allocation_tracker_detail
+{
+    inline void* allocate(size_t size)
+    {
+        note_allocation(size);
+        if (void* pointer = std::malloc(size == 0 ? 1 : size))
+        {
+            return pointer;
+        }
+        throw std::bad_alloc();
+    }
+
+    inline void* allocate_aligned(size_t size, std::align_val_t alignment)
+    {
+        note_allocation(size);
+        const size_t align = std::max(static_cast<size_t>(alignment), sizeof(void*));
+        void* pointer = nullptr;
+#if defined(_WIN32)
+        pointer = _aligned_malloc(size == 0 ? 1 : size, align);
+#else
+        if (posix_memalign(&pointer, align, size == 0 ? 1 : size) != 0)
+        {
+            pointer = nullptr;
+        }
+#endif
+        if (pointer == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return pointer;
+    }
+
+    inline void release(void* pointer) noexcept
+    {
+        note_deallocation(pointer);
+        std::free(pointer);
+    }
+
+    inline void free_aligned(void* pointer) noexcept
+    {
+        note_deallocation(pointer);
+#if defined(_WIN32)
+        _aligned_free(pointer);
+#else
+        std::free(pointer);
+#endif
+    }
+
+    const bool installed = (replaced() = true);
+}
+
+void* operator new(size_t size) { return allocation_tracker_detail::allocate(size); }
+void* operator new[](size_t size) { return allocation_tracker_detail::allocate(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return allocation_tracker_detail::allocate_aligned(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return allocation_tracker_detail::allocate_aligned(size, alignment); }
+
+void operator delete(void* pointer) noexcept { allocation_tracker_detail::release(pointer); }
+void operator delete[](void* pointer) noexcept { allocation_tracker_detail::release(pointer); }
+void operator delete(void* pointer, size_t) noexcept { allocation_tracker_detail::release(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { allocation_tracker_detail::release(pointer); }
+
+void operator delete(void* pointer, std::align_val_t) noexcept { allocation_tracker_detail::free_aligned(pointer); }
+void operator delete[](void* pointer, std::align_val_t) noexcept { allocation_tracker_detail::free_aligned(pointer); }
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept { allocation_tracker_detail::free_aligned(pointer); }
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept { allocation_tracker_detail::free_aligned(pointer); }
+
+#endif
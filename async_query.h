@@ -0,0 +1,482 @@
+// async_query.h : Asynchronous query execution on a fixed pool of connection-owning workers.
+//
+// async_query_executor starts one worker per pooled connection. Each worker leases its connection
+// for its whole life and builds its own query runner on it, the way the load test workers do, then
+// takes jobs off a shared queue. A caller submits a statement, or a batch of statements that run
+// back to back on one worker, and either gets a std::future for the results or has each result
+// pushed to a completion_queue it drains when it likes. The caller's thread is free while the
+// statements are screened and executed, so one thread can keep many lookups in flight.
+//
+// Every statement gets an id. cancel(id) drops a statement that has not started yet. A statement
+// that is already running is interrupted with sqlite3_interrupt, and its result is reported as
+// cancelled whatever the runner returned.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "sqlite3.h"
+#include "connection_pool.h"
+
+enum class async_query_status
+{
+    completed,
+    // rejected by screening, or failed in SQLite
+    failed,
+    cancelled
+};
+
+template <typename Record>
+struct async_query_result
+{
+    uint64_t id = 0;
+    // the value passed to submit, e.g. to match the result to a request
+    uint64_t tag = 0;
+    async_query_status status = async_query_status::failed;
+    std::vector<Record> records;
+};
+
+template <typename Record>
+struct async_query_handle
+{
+    uint64_t id = 0;
+    std::future< async_query_result<Record> > result;
+};
+
+template <typename Record>
+struct async_batch_handle
+{
+    // the statements have consecutive ids starting here, in submission order
+    uint64_t first_id = 0;
+    std::future< std::vector< async_query_result<Record> > > results;
+};
+
+// results delivered in the order they finish, for a caller that has many statements in flight
+template <typename Record>
+class completion_queue
+{
+public:
+    typedef async_query_result<Record> result_type;
+
+    completion_queue() {}
+
+    completion_queue(const completion_queue&) = delete;
+    completion_queue& operator=(const completion_queue&) = delete;
+
+    void push(result_type result)
+    {
+        // notified under the lock, so a caller that takes the last result and destroys the queue
+        //  cannot do so while this is still signalling
+        std::lock_guard<std::mutex> lock(mutex);
+        results.push_back(std::move(result));
+        ready.notify_one();
+    }
+
+    // waits for the next result, false once the queue is closed and drained
+    bool next(result_type& result)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this] { return closed || !results.empty(); });
+        return take(result);
+    }
+
+    // false if no result arrived within timeout
+    template <typename Rep, typename Period>
+    bool next_for(const std::chrono::duration<Rep, Period>& timeout, result_type& result)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait_for(lock, timeout, [this] { return closed || !results.empty(); });
+        return take(result);
+    }
+
+    bool try_next(result_type& result)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return take(result);
+    }
+
+    // wakes every waiter, next returns false once the results already queued are taken
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        ready.notify_all();
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return results.size();
+    }
+
+private:
+    std::deque<result_type> results;
+    mutable std::mutex mutex;
+    std::condition_variable ready;
+    bool closed = false;
+
+    bool take(result_type& result)
+    {
+        if (results.empty())
+        {
+            return false;
+        }
+        result = std::move(results.front());
+        results.pop_front();
+        return true;
+    }
+};
+
+template <typename Record>
+class async_query_executor
+{
+public:
+    typedef async_query_result<Record> result_type;
+
+    // starts threads workers, at most one per pooled connection. make_runner(sqlite3*) is called on
+    //  each worker thread and must return a callable bool(const std::string& sql, std::vector<Record>& records)
+    //  that runs one statement and returns false if it was rejected or failed. The runner is
+    //  destroyed on its thread before the connection is returned.
+    //  Returns once every worker has its runner. If make_runner throws on any of them, the workers
+    //  are stopped and the first exception is rethrown here.
+    template <typename RunnerFactory>
+    async_query_executor(connection_pool& pool, size_t threads, RunnerFactory make_runner)
+    {
+        typedef runner_holder< std::decay_t<decltype(make_runner(static_cast<sqlite3*>(NULL)))> > holder_type;
+
+        threads = std::max<size_t>(1, std::min(threads, pool.size()));
+        slots.resize(threads);
+        workers.reserve(threads);
+        for (size_t w = 0; w < threads; ++w)
+        {
+            workers.emplace_back([this, &pool, make_runner, w]
+            {
+                connection_pool::lease connection(pool);
+                std::optional<holder_type> runner;
+                std::exception_ptr error;
+                try
+                {
+                    runner.emplace(make_runner, connection.get());
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    slots[w].db = connection.get();
+                    ++started_workers;
+                    if (error && !startup_error)
+                    {
+                        startup_error = error;
+                    }
+                }
+                started.notify_all();
+                if (runner)
+                {
+                    work(runner->runner, w);
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                slots[w].db = NULL;
+            });
+        }
+
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            started.wait(lock, [this, threads] { return started_workers == threads; });
+            error = startup_error;
+            stopping = static_cast<bool>(error);
+        }
+        if (error)
+        {
+            // nothing can have been submitted yet, the workers that did start return at once
+            stop();
+            std::rethrow_exception(error);
+        }
+    }
+
+    // runs every queued statement, then stops the workers
+    ~async_query_executor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        stop();
+    }
+
+    async_query_executor(const async_query_executor&) = delete;
+    async_query_executor& operator=(const async_query_executor&) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    async_query_handle<Record> submit(std::string sql, uint64_t tag = 0)
+    {
+        job queued(delivery::future, tag);
+        queued.statements.push_back(std::move(sql));
+        async_query_handle<Record> handle;
+        handle.result = queued.single.get_future();
+        handle.id = enqueue(std::move(queued));
+        return handle;
+    }
+
+    // the result goes to done, returns the statement's id
+    uint64_t submit(std::string sql, completion_queue<Record>& done, uint64_t tag = 0)
+    {
+        job queued(delivery::queue, tag);
+        queued.statements.push_back(std::move(sql));
+        queued.done = &done;
+        return enqueue(std::move(queued));
+    }
+
+    // runs the statements back to back on one worker, for one queue operation and one wake up
+    //  instead of one per statement. The results come back together, in submission order.
+    async_batch_handle<Record> submit_batch(std::vector<std::string> statements, uint64_t tag = 0)
+    {
+        job queued(delivery::batch_future, tag);
+        queued.statements = std::move(statements);
+        async_batch_handle<Record> handle;
+        handle.results = queued.batch.get_future();
+        handle.first_id = enqueue(std::move(queued));
+        return handle;
+    }
+
+    // each result goes to done as soon as it finishes, returns the id of the first statement
+    uint64_t submit_batch(std::vector<std::string> statements, completion_queue<Record>& done, uint64_t tag = 0)
+    {
+        job queued(delivery::queue, tag);
+        queued.statements = std::move(statements);
+        queued.done = &done;
+        return enqueue(std::move(queued));
+    }
+
+    // cancels a statement that has not finished, false if it already has or the id is unknown
+    bool cancel(uint64_t id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = pending.find(id);
+        if (found == pending.end())
+        {
+            return false;
+        }
+        found->second = true;
+        interrupt(id);
+        return true;
+    }
+
+    // cancels every statement that has not finished and returns how many there were
+    size_t cancel_all()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& entry : pending)
+        {
+            entry.second = true;
+        }
+        for (const auto& slot : slots)
+        {
+            if (slot.running != 0)
+            {
+                sqlite3_interrupt(slot.db);
+            }
+        }
+        return pending.size();
+    }
+
+    // statements submitted and not yet finished
+    size_t outstanding() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pending.size();
+    }
+
+private:
+    enum class delivery { future, batch_future, queue };
+
+    // builds a runner in place, so it need not be movable
+    template <typename Runner>
+    struct runner_holder
+    {
+        template <typename RunnerFactory>
+        runner_holder(const RunnerFactory& make_runner, sqlite3* db) : runner(make_runner(db)) {}
+
+        Runner runner;
+    };
+
+    struct job
+    {
+        job() {}
+        job(delivery how, uint64_t tag) : how(how), tag(tag) {}
+
+        delivery how = delivery::queue;
+        uint64_t tag = 0;
+        uint64_t first_id = 0;
+        std::vector<std::string> statements;
+        completion_queue<Record>* done = NULL;
+        std::promise<result_type> single;
+        std::promise< std::vector<result_type> > batch;
+    };
+
+    struct worker_slot
+    {
+        sqlite3* db = NULL;
+        // id of the statement the worker is running, 0 when idle
+        uint64_t running = 0;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<worker_slot> slots;
+    std::deque<job> queue;
+    // cancelled flag of every statement that has not finished
+    std::unordered_map<uint64_t, bool> pending;
+    uint64_t next_id = 1;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    // workers that have built their runner or failed to
+    size_t started_workers = 0;
+    std::condition_variable started;
+    std::exception_ptr startup_error;
+
+    // stopping must be set
+    void stop()
+    {
+        wake.notify_all();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    uint64_t enqueue(job queued)
+    {
+        uint64_t first_id;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            first_id = next_id;
+            next_id += queued.statements.size();
+            queued.first_id = first_id;
+            for (size_t k = 0; k < queued.statements.size(); ++k)
+            {
+                pending.emplace(first_id + k, false);
+            }
+            queue.push_back(std::move(queued));
+        }
+        wake.notify_one();
+        return first_id;
+    }
+
+    // mutex must be held
+    void interrupt(uint64_t id)
+    {
+        for (const auto& slot : slots)
+        {
+            if (slot.running == id)
+            {
+                sqlite3_interrupt(slot.db);
+            }
+        }
+    }
+
+    template <typename Runner>
+    void work(Runner& runner, size_t w)
+    {
+        for (;;)
+        {
+            job current;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty())
+                {
+                    return;
+                }
+                current = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            std::vector<result_type> batch_results;
+            for (size_t k = 0; k < current.statements.size(); ++k)
+            {
+                result_type result;
+                result.id = current.first_id + k;
+                result.tag = current.tag;
+                run(runner, w, current.statements[k], result);
+
+                switch (current.how)
+                {
+                case delivery::future:
+                    current.single.set_value(std::move(result));
+                    break;
+                case delivery::batch_future:
+                    batch_results.push_back(std::move(result));
+                    break;
+                case delivery::queue:
+                    current.done->push(std::move(result));
+                    break;
+                }
+            }
+            if (current.how == delivery::batch_future)
+            {
+                current.batch.set_value(std::move(batch_results));
+            }
+        }
+    }
+
+    template <typename Runner>
+    void run(Runner& runner, size_t w, const std::string& sql, result_type& result)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = pending.find(result.id);
+            if (found->second)
+            {
+                pending.erase(found);
+                result.status = async_query_status::cancelled;
+                return;
+            }
+            slots[w].running = result.id;
+        }
+
+        bool ok = false;
+        try
+        {
+            ok = runner(sql, result.records);
+        }
+        catch (...)
+        {
+            ok = false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        slots[w].running = 0;
+        auto found = pending.find(result.id);
+        const bool cancelled = found->second;
+        pending.erase(found);
+        if (cancelled)
+        {
+            result.records.clear();
+            result.status = async_query_status::cancelled;
+        }
+        else
+        {
+            result.status = ok ? async_query_status::completed : async_query_status::failed;
+        }
+    }
+};
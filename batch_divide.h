@@ -0,0 +1,207 @@
+// batch_divide.h : Divides arrays of floats, reporting zero denominators in a bitmask instead of throwing.
+//
+// divide_batch writes numerators[i] / denominators[i] to results[i] for a whole array at once,
+// 8 lanes at a time with AVX2 or 4 with SSE, picked at runtime, with a scalar fallback on other
+// CPUs and architectures. A lane whose denominator is zero, the case divide() in error_paths.h throws
+// for, gets a result of 0 and its bit set in a mask of one bit per lane, so one bad pair neither
+// stops the batch nor costs an exception. The mask is built 64 lanes at a time and a word that
+// stays zero means every division in it was valid.
+//
+// The thread_pool overload splits very large arrays into runs of whole mask words, so no two
+// threads ever write the same word.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "thread_pool.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BATCH_DIVIDE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define BATCH_DIVIDE_TARGET_AVX2
+#else
+#define BATCH_DIVIDE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace batch_divide_detail
+{
+    const size_t lanes_per_word = 64;
+
+    inline size_t count_bits(uint64_t word) noexcept
+    {
+#if defined(_MSC_VER) && defined(_M_X64)
+        return static_cast<size_t>(__popcnt64(word));
+#elif defined(_MSC_VER)
+        return static_cast<size_t>(__popcnt(static_cast<uint32_t>(word)) + __popcnt(static_cast<uint32_t>(word >> 32)));
+#else
+        return static_cast<size_t>(__builtin_popcountll(word));
+#endif
+    }
+
+    // lanes [begin, end) of one mask word, returns the word
+    inline uint64_t divide_scalar(const float* numerators, const float* denominators, float* results, size_t begin, size_t end) noexcept
+    {
+        uint64_t zero = 0;
+        for (size_t i = begin; i < end; ++i)
+        {
+            const bool is_zero = denominators[i] == 0;
+            results[i] = is_zero ? 0.0f : numerators[i] / denominators[i];
+            zero |= static_cast<uint64_t>(is_zero) << (i - begin);
+        }
+        return zero;
+    }
+
+#if defined(BATCH_DIVIDE_X86)
+    // one full word of 64 lanes starting at begin
+    inline uint64_t divide_word_sse(const float* numerators, const float* denominators, float* results, size_t begin) noexcept
+    {
+        const __m128 zero_value = _mm_setzero_ps();
+        uint64_t zero = 0;
+        for (size_t k = 0; k < lanes_per_word; k += 4)
+        {
+            const __m128 denominator = _mm_loadu_ps(denominators + begin + k);
+            const __m128 is_zero = _mm_cmpeq_ps(denominator, zero_value);
+            const __m128 quotient = _mm_div_ps(_mm_loadu_ps(numerators + begin + k), denominator);
+            // the zero lanes hold inf or nan from the division, replaced by 0
+            _mm_storeu_ps(results + begin + k, _mm_andnot_ps(is_zero, quotient));
+            zero |= static_cast<uint64_t>(_mm_movemask_ps(is_zero)) << k;
+        }
+        return zero;
+    }
+
+    BATCH_DIVIDE_TARGET_AVX2 inline uint64_t divide_word_avx2(const float* numerators, const float* denominators, float* results, size_t begin) noexcept
+    {
+        const __m256 zero_value = _mm256_setzero_ps();
+        uint64_t zero = 0;
+        for (size_t k = 0; k < lanes_per_word; k += 8)
+        {
+            const __m256 denominator = _mm256_loadu_ps(denominators + begin + k);
+            const __m256 is_zero = _mm256_cmp_ps(denominator, zero_value, _CMP_EQ_OQ);
+            const __m256 quotient = _mm256_div_ps(_mm256_loadu_ps(numerators + begin + k), denominator);
+            _mm256_storeu_ps(results + begin + k, _mm256_andnot_ps(is_zero, quotient));
+            zero |= static_cast<uint64_t>(_mm256_movemask_ps(is_zero)) << k;
+        }
+        return zero;
+    }
+
+    inline bool cpu_has_avx2() noexcept
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+        __cpuid(info, 1);
+        // the OS must save the YMM registers (OSXSAVE and XCR0 bits 1 and 2)
+        if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 0x6) != 0x6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }
+#endif
+
+    inline uint64_t divide_word_scalar(const float* numerators, const float* denominators, float* results, size_t begin) noexcept
+    {
+        return divide_scalar(numerators, denominators, results, begin, begin + lanes_per_word);
+    }
+
+    typedef uint64_t (*word_function)(const float*, const float*, float*, size_t);
+
+    inline word_function select_word() noexcept
+    {
+#if defined(BATCH_DIVIDE_X86)
+        return cpu_has_avx2() ? divide_word_avx2 : divide_word_sse;
+#else
+        return divide_word_scalar;
+#endif
+    }
+
+    // mask words [first_word, last_word) of an array of count lanes, returns the zero lanes found
+    inline size_t divide_words(word_function divide_word, const float* numerators, const float* denominators, float* results,
+        size_t count, uint64_t* zero_lanes, size_t first_word, size_t last_word) noexcept
+    {
+        size_t zeros = 0;
+        for (size_t w = first_word; w < last_word; ++w)
+        {
+            const size_t begin = w * lanes_per_word;
+            // the last word may be partial
+            const uint64_t word = begin + lanes_per_word <= count ?
+                divide_word(numerators, denominators, results, begin) :
+                divide_scalar(numerators, denominators, results, begin, count);
+            zero_lanes[w] = word;
+            zeros += word == 0 ? 0 : count_bits(word);
+        }
+        return zeros;
+    }
+
+    inline word_function selected_word() noexcept
+    {
+        static const word_function divide_word = select_word();
+        return divide_word;
+    }
+}
+
+// name of the kernel picked for this CPU: "avx2", "sse" or "scalar"
+inline const char* batch_divide_isa() noexcept
+{
+#if defined(BATCH_DIVIDE_X86)
+    return batch_divide_detail::cpu_has_avx2() ? "avx2" : "sse";
+#else
+    return "scalar";
+#endif
+}
+
+// number of mask words for count lanes
+inline size_t divide_mask_words(size_t count) noexcept
+{
+    return (count + batch_divide_detail::lanes_per_word - 1) / batch_divide_detail::lanes_per_word;
+}
+
+// results[i] = numerators[i] / denominators[i] for i in [0, count). Where denominators[i] is zero
+//  results[i] is 0 and bit i % 64 of zero_lanes[i / 64] is set, every other bit is cleared.
+//  zero_lanes must hold divide_mask_words(count) words. Returns the number of zero denominators.
+inline size_t divide_batch(const float* numerators, const float* denominators, float* results, size_t count, uint64_t* zero_lanes) noexcept
+{
+    using namespace batch_divide_detail;
+    return divide_words(selected_word(), numerators, denominators, results, count, zero_lanes, 0, divide_mask_words(count));
+}
+
+inline size_t divide_batch(const std::vector<float>& numerators, const std::vector<float>& denominators,
+    std::vector<float>& results, std::vector<uint64_t>& zero_lanes)
+{
+    const size_t count = numerators.size() < denominators.size() ? numerators.size() : denominators.size();
+    results.resize(count);
+    zero_lanes.resize(divide_mask_words(count));
+    return divide_batch(numerators.data(), denominators.data(), results.data(), count, zero_lanes.data());
+}
+
+// divide_batch split over the pool, for arrays large enough that one core cannot keep up with memory
+inline size_t divide_batch(thread_pool& pool, const float* numerators, const float* denominators, float* results, size_t count, uint64_t* zero_lanes)
+{
+    using namespace batch_divide_detail;
+    const word_function divide_word = selected_word();
+    std::atomic<size_t> zeros(0);
+    // 1024 words, 64K lanes and 768 KB of operands and results, per chunk at the least
+    pool.parallel_for(divide_mask_words(count), [&](size_t first_word, size_t last_word)
+    {
+        zeros.fetch_add(divide_words(divide_word, numerators, denominators, results, count, zero_lanes, first_word, last_word),
+            std::memory_order_relaxed);
+    }, 1024);
+    return zeros.load();
+}
+
+inline size_t divide_batch(thread_pool& pool, const std::vector<float>& numerators, const std::vector<float>& denominators,
+    std::vector<float>& results, std::vector<uint64_t>& zero_lanes)
+{
+    const size_t count = numerators.size() < denominators.size() ? numerators.size() : denominators.size();
+    results.resize(count);
+    zero_lanes.resize(divide_mask_words(count));
+    return divide_batch(pool, numerators.data(), denominators.data(), results.data(), count, zero_lanes.data());
+}
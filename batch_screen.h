@@ -0,0 +1,39 @@
+// batch_screen.h : Screens many statements at once, such as an audit log of captured SQL.
+//
+// The statements are split into chunks that run on a thread_pool and each one is screened with
+// detect_injection, the rule set run_query uses, so every rule that would reject a statement at
+// run time flags it here too. The rules are matched in place, so the statements are never copied
+// and screening does not allocate.
+
+#pragma once
+
+#include <atomic>
+#include <string_view>
+#include <vector>
+
+#include "injection_rules.h"
+#include "thread_pool.h"
+
+// writes the verdict for statements[i] to verdicts[i] and returns how many were flagged.
+//  The verdicts point into the statements, which must outlive them.
+inline size_t screen_statements(thread_pool& pool, const std::string_view* statements, size_t count, injection_verdict* verdicts)
+{
+    std::atomic<size_t> flagged(0);
+    pool.parallel_for(count, [&](size_t begin, size_t end)
+    {
+        size_t found = 0;
+        for (size_t i = begin; i < end; ++i)
+        {
+            verdicts[i] = detect_injection(statements[i]);
+            found += verdicts[i].detected ? 1 : 0;
+        }
+        flagged.fetch_add(found, std::memory_order_relaxed);
+    }, 256);
+    return flagged.load();
+}
+
+inline size_t screen_statements(thread_pool& pool, const std::vector<std::string_view>& statements, std::vector<injection_verdict>& verdicts)
+{
+    verdicts.resize(statements.size());
+    return screen_statements(pool, statements.data(), statements.size(), verdicts.data());
+}
@@ -0,0 +1,536 @@
+// bulk_loader.h : Seeds the USERS table with large numbers of rows.
+//
+// Rows come from a generator or a CSV file and are inserted through one prepared INSERT inside
+// batched transactions. The journal and sync PRAGMAs can be relaxed for the load, and are put back
+// to what they were once it is done, so a pooled connection does not go on without durability.
+// Secondary indexes can be built after the data is in rather than maintained row by row.
+
+#pragma once
+
+#include <chrono>
+#include <charconv>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "sqlite3.h"
+#include "fast_random.h"
+#include "thread_pool.h"
+#include "user_batch.h"
+
+struct bulk_load_options
+{
+    // rows per transaction
+    size_t batch_rows = 10000;
+    // PRAGMA synchronous value (OFF, NORMAL, FULL, EXTRA), empty to leave unchanged
+    std::string synchronous = "OFF";
+    // PRAGMA journal_mode value (DELETE, TRUNCATE, PERSIST, MEMORY, WAL, OFF), empty to leave unchanged
+    std::string journal_mode = "MEMORY";
+    // CREATE INDEX statements for the table
+    std::vector<std::string> indexes;
+    // build the indexes after the rows are loaded instead of before
+    bool defer_indexes = true;
+};
+
+struct bulk_load_stats
+{
+    size_t rows = 0;
+    double seconds = 0;
+
+    double rows_per_second() const { return seconds > 0 ? static_cast<double>(rows) / seconds : 0; }
+};
+
+namespace bulk_load_detail
+{
+    inline bool is_one_of(const std::string& value, std::initializer_list<const char*> allowed)
+    {
+        for (const char* candidate : allowed)
+        {
+            if (sqlite3_stricmp(value.c_str(), candidate) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline bool exec(sqlite3* db, const std::string& sql, const char* what)
+    {
+        char* error_message = NULL;
+        if (sqlite3_exec(db, sql.c_str(), NULL, NULL, &error_message) != SQLITE_OK)
+        {
+            std::cout << what << " failed. ERROR = " << (error_message ? error_message : sqlite3_errmsg(db)) << std::endl;
+            sqlite3_free(error_message);
+            return false;
+        }
+        return true;
+    }
+
+    // the PRAGMA values apply_pragmas replaced, empty for the ones it left alone
+    struct saved_pragmas
+    {
+        std::string synchronous;
+        std::string journal_mode;
+    };
+
+    // the current value of a PRAGMA, as the text of the first column SQLite returns for it
+    inline bool read_pragma(sqlite3* db, const char* name, std::string& value)
+    {
+        sqlite3_stmt* stmt = NULL;
+        const std::string sql = std::string("PRAGMA ") + name;
+        bool ok = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL) == SQLITE_OK &&
+            sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_text(stmt, 0) != NULL;
+        if (ok)
+        {
+            value = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        }
+        else
+        {
+            std::cout << "PRAGMA " << name << " could not be read. ERROR = " << sqlite3_errmsg(db) << std::endl;
+        }
+        sqlite3_finalize(stmt);
+        return ok;
+    }
+
+    // sets the PRAGMAs in options, keeping the values they had in saved so restore_pragmas can put
+    //  them back, also after a failure part way through
+    inline bool apply_pragmas(sqlite3* db, const bulk_load_options& options, saved_pragmas& saved)
+    {
+        // PRAGMA values cannot be bound, so only known values are ever put in the statement text
+        if (!options.synchronous.empty())
+        {
+            if (!is_one_of(options.synchronous, { "OFF", "NORMAL", "FULL", "EXTRA" }))
+            {
+                std::cout << "Invalid synchronous setting: " << options.synchronous << std::endl;
+                return false;
+            }
+            std::string previous;
+            if (!read_pragma(db, "synchronous", previous)) return false;
+            if (!exec(db, "PRAGMA synchronous=" + options.synchronous, "PRAGMA synchronous")) return false;
+            saved.synchronous = previous;
+        }
+        if (!options.journal_mode.empty())
+        {
+            if (!is_one_of(options.journal_mode, { "DELETE", "TRUNCATE", "PERSIST", "MEMORY", "WAL", "OFF" }))
+            {
+                std::cout << "Invalid journal_mode setting: " << options.journal_mode << std::endl;
+                return false;
+            }
+            std::string previous;
+            if (!read_pragma(db, "journal_mode", previous)) return false;
+            if (!exec(db, "PRAGMA journal_mode=" + options.journal_mode, "PRAGMA journal_mode")) return false;
+            saved.journal_mode = previous;
+        }
+        return true;
+    }
+
+    // puts back the PRAGMA values apply_pragmas replaced. synchronous reads back as 0 to 3, which
+    //  it also accepts, and journal_mode as one of its names in lower case.
+    inline bool restore_pragmas(sqlite3* db, const saved_pragmas& saved)
+    {
+        bool ok = true;
+        if (!saved.journal_mode.empty())
+        {
+            if (is_one_of(saved.journal_mode, { "DELETE", "TRUNCATE", "PERSIST", "MEMORY", "WAL", "OFF" }))
+            {
+                ok = exec(db, "PRAGMA journal_mode=" + saved.journal_mode, "PRAGMA journal_mode") && ok;
+            }
+            else
+            {
+                std::cout << "Unexpected journal_mode setting not restored: " << saved.journal_mode << std::endl;
+                ok = false;
+            }
+        }
+        if (!saved.synchronous.empty())
+        {
+            if (is_one_of(saved.synchronous, { "0", "1", "2", "3" }))
+            {
+                ok = exec(db, "PRAGMA synchronous=" + saved.synchronous, "PRAGMA synchronous") && ok;
+            }
+            else
+            {
+                std::cout << "Unexpected synchronous setting not restored: " << saved.synchronous << std::endl;
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    inline bool build_indexes(sqlite3* db, const bulk_load_options& options)
+    {
+        for (const auto& index : options.indexes)
+        {
+            if (!exec(db, index, "Index build")) return false;
+        }
+        return true;
+    }
+
+    // the load itself, with the PRAGMAs already applied
+    template <typename Generator>
+    bool load_rows(sqlite3* db, Generator&& next_row, const bulk_load_options& options, bulk_load_stats& stats)
+    {
+        if (!options.defer_indexes && !build_indexes(db, options)) return false;
+
+        sqlite3_stmt* insert = NULL;
+        if (sqlite3_prepare_v2(db, "INSERT INTO USERS (ID, NAME, PASSWORD) VALUES (?, ?, ?)", -1, &insert, NULL) != SQLITE_OK)
+        {
+            std::cout << "Failed to prepare USERS insert. ERROR = " << sqlite3_errmsg(db) << std::endl;
+            return false;
+        }
+
+        const size_t batch_rows = options.batch_rows == 0 ? 1 : options.batch_rows;
+        // rows inserted since BEGIN, and whether a transaction is open, which a failed first insert
+        //  leaves true with no rows in it
+        size_t in_transaction = 0;
+        bool transaction_open = false;
+        bool ok = true;
+        user_row row;
+
+        while (ok && next_row(row))
+        {
+            if (!transaction_open)
+            {
+                if (!exec(db, "BEGIN", "BEGIN TRANSACTION"))
+                {
+                    ok = false;
+                    break;
+                }
+                transaction_open = true;
+            }
+
+            sqlite3_bind_int64(insert, 1, row.id);
+            sqlite3_bind_text(insert, 2, row.name.data(), static_cast<int>(row.name.size()), SQLITE_STATIC);
+            sqlite3_bind_text(insert, 3, row.password.data(), static_cast<int>(row.password.size()), SQLITE_STATIC);
+            if (sqlite3_step(insert) != SQLITE_DONE)
+            {
+                std::cout << "Data failed to insert to USERS table. ERROR = " << sqlite3_errmsg(db) << std::endl;
+                ok = false;
+            }
+            sqlite3_reset(insert);
+
+            if (ok)
+            {
+                ++stats.rows;
+                if (++in_transaction == batch_rows)
+                {
+                    ok = exec(db, "COMMIT", "COMMIT");
+                    if (ok)
+                    {
+                        transaction_open = false;
+                        in_transaction = 0;
+                    }
+                }
+            }
+        }
+
+        if (transaction_open)
+        {
+            // rows already committed in earlier batches stay, a failed batch is rolled back as a whole
+            if (ok)
+            {
+                ok = exec(db, "COMMIT", "COMMIT");
+            }
+            if (!ok)
+            {
+                // a failed COMMIT can have rolled back already
+                if (sqlite3_get_autocommit(db) == 0)
+                {
+                    exec(db, "ROLLBACK", "ROLLBACK");
+                }
+                stats.rows -= in_transaction;
+            }
+        }
+        sqlite3_finalize(insert);
+
+        if (ok && options.defer_indexes)
+        {
+            ok = build_indexes(db, options);
+        }
+        return ok;
+    }
+}
+
+// inserts every row produced by next_row(user_row&), which returns false when there are no more rows.
+//  The views in the row only need to stay valid until next_row is called again. The PRAGMAs in
+//  options are back to their previous values when this returns, whether the load worked or not.
+template <typename Generator>
+bool bulk_load_users(sqlite3* db, Generator&& next_row, const bulk_load_options& options, bulk_load_stats& stats)
+{
+    using namespace bulk_load_detail;
+
+    stats = bulk_load_stats();
+    auto start = std::chrono::steady_clock::now();
+
+    saved_pragmas saved;
+    bool ok = apply_pragmas(db, options, saved) && load_rows(db, std::forward<Generator>(next_row), options, stats);
+    ok = restore_pragmas(db, saved) && ok;
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return ok;
+}
+
+// generates count rows of made up users with IDs first_id, first_id + 1, ...
+class synthetic_users
+{
+public:
+    explicit synthetic_users(size_t count, int64_t first_id = 1) : remaining(count), id(first_id) {}
+
+    bool operator()(user_row& row)
+    {
+        if (remaining == 0)
+        {
+            return false;
+        }
+        --remaining;
+
+        name.assign("user");
+        password.assign("pw");
+        char digits[24];
+        auto end = std::to_chars(digits, digits + sizeof(digits), id).ptr;
+        name.append(digits, end);
+        password.append(digits, end);
+
+        row.id = id++;
+        row.name = name;
+        row.password = password;
+        return true;
+    }
+
+private:
+    size_t remaining;
+    int64_t id;
+    std::string name;
+    std::string password;
+};
+
+// generates count rows of users with random names and passwords and IDs first_id, first_id + 1, ...
+//  Each row is drawn from its own stream of the seed, stream ID, so the same seed always gives the
+//  same table and any row or range of rows can be regenerated on its own, on any thread.
+//  Names are a random prefix followed by the ID, so they never repeat.
+class random_users
+{
+public:
+    random_users(size_t count, uint64_t seed, int64_t first_id = 1) : remaining(count), seed(seed), id(first_id) {}
+
+    bool operator()(user_row& row)
+    {
+        if (remaining == 0)
+        {
+            return false;
+        }
+        --remaining;
+
+        make(seed, id, name, password);
+        row.id = id++;
+        row.name = name;
+        row.password = password;
+        return true;
+    }
+
+    // the row with this ID for this seed
+    static void make(uint64_t seed, int64_t id, std::string& name, std::string& password)
+    {
+        static const char letters[] = "abcdefghijklmnopqrstuvwxyz";
+        static const char symbols[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+        xoshiro256 random(seed, static_cast<uint64_t>(id));
+        name.clear();
+        for (uint32_t k = 0, length = 3 + random.below(8); k < length; ++k)
+        {
+            name += letters[random.below(sizeof(letters) - 1)];
+        }
+        char digits[24];
+        auto end = std::to_chars(digits, digits + sizeof(digits), id).ptr;
+        name.append(digits, end);
+
+        password.clear();
+        for (uint32_t k = 0, length = 8 + random.below(9); k < length; ++k)
+        {
+            password += symbols[random.below(sizeof(symbols) - 1)];
+        }
+    }
+
+private:
+    size_t remaining;
+    uint64_t seed;
+    int64_t id;
+    std::string name;
+    std::string password;
+};
+
+// generates the random_users rows for IDs first_id .. first_id + count - 1 on the pool, into one
+//  batch per shard of shard_rows rows in ID order. The batches are the same for the same seed
+//  whatever the pool size.
+inline void generate_random_users(thread_pool& pool, uint64_t seed, size_t count, int64_t first_id,
+    std::vector<user_batch>& shards, size_t shard_rows = 64 * 1024)
+{
+    if (shard_rows == 0)
+    {
+        shard_rows = 1;
+    }
+    shards.resize((count + shard_rows - 1) / shard_rows);
+    pool.parallel_for(shards.size(), [&](size_t first, size_t last)
+    {
+        std::string name;
+        std::string password;
+        for (size_t shard = first; shard < last; ++shard)
+        {
+            const size_t begin = shard * shard_rows;
+            const size_t end = begin + shard_rows < count ? begin + shard_rows : count;
+            user_batch& batch = shards[shard];
+            batch.clear();
+            batch.reserve(end - begin);
+            for (size_t row = begin; row < end; ++row)
+            {
+                const int64_t id = first_id + static_cast<int64_t>(row);
+                random_users::make(seed, id, name, password);
+                batch.append(id, name, password);
+            }
+        }
+    });
+}
+
+// reads ID,NAME,PASSWORD rows from a CSV file. Fields may be double-quoted with "" as an escaped quote,
+//  and a quoted field may span lines, so whatever output_sink writes in its csv encoding reads back
+//  the same. A first line whose ID is not a number is taken as a header and skipped.
+class csv_users
+{
+public:
+    explicit csv_users(const std::string& path) : input(path) {}
+
+    bool is_open() const { return input.is_open(); }
+    size_t line_number() const { return lines; }
+    size_t skipped() const { return bad_lines; }
+
+    bool operator()(user_row& row)
+    {
+        while (std::getline(input, line))
+        {
+            ++lines;
+            // a line break inside a quoted field belongs to the field, the row goes on on the next line
+            while (ends_inside_quotes(line) && std::getline(input, continuation))
+            {
+                ++lines;
+                line.push_back('\n');
+                line += continuation;
+            }
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+            if (line.empty())
+            {
+                continue;
+            }
+
+            size_t pos = 0;
+            if (!next_field(pos, id_text) || !next_field(pos, name) || !next_field(pos, password))
+            {
+                ++bad_lines;
+                continue;
+            }
+
+            int64_t id = 0;
+            auto parsed = std::from_chars(id_text.data(), id_text.data() + id_text.size(), id);
+            if (parsed.ec != std::errc() || parsed.ptr != id_text.data() + id_text.size())
+            {
+                if (lines != 1)
+                {
+                    std::cout << "Skipping CSV line " << lines << ": ID is not a number" << std::endl;
+                    ++bad_lines;
+                }
+                continue;
+            }
+
+            row.id = id;
+            row.name = name;
+            row.password = password;
+            return true;
+        }
+        return false;
+    }
+
+private:
+    std::ifstream input;
+    std::string line;
+    std::string continuation;
+    std::string id_text;
+    std::string name;
+    std::string password;
+    size_t lines = 0;
+    size_t bad_lines = 0;
+
+    // true if text stops part way through a quoted field
+    static bool ends_inside_quotes(const std::string& text)
+    {
+        bool quoted = false;
+        bool field_start = true;
+        for (size_t pos = 0; pos < text.size(); ++pos)
+        {
+            const char c = text[pos];
+            if (quoted)
+            {
+                if (c == '"')
+                {
+                    if (pos + 1 < text.size() && text[pos + 1] == '"')
+                    {
+                        ++pos;
+                    }
+                    else
+                    {
+                        quoted = false;
+                    }
+                }
+                continue;
+            }
+            quoted = c == '"' && field_start;
+            field_start = c == ',';
+        }
+        return quoted;
+    }
+
+    // decodes the field starting at pos into field, leaving pos after the following comma
+    bool next_field(size_t& pos, std::string& field)
+    {
+        field.clear();
+        if (pos > line.size())
+        {
+            return false;
+        }
+
+        if (pos < line.size() && line[pos] == '"')
+        {
+            ++pos;
+            while (pos < line.size())
+            {
+                if (line[pos] == '"')
+                {
+                    if (pos + 1 < line.size() && line[pos + 1] == '"')
+                    {
+                        field.push_back('"');
+                        pos += 2;
+                        continue;
+                    }
+                    ++pos;
+                    break;
+                }
+                field.push_back(line[pos++]);
+            }
+        }
+        else
+        {
+            size_t comma = line.find(',', pos);
+            size_t end = comma == std::string::npos ? line.size() : comma;
+            field.assign(line, pos, end - pos);
+            pos = end;
+        }
+
+        // step over the separator, a missing separator means this was the last field
+        pos = (pos < line.size() && line[pos] == ',') ? pos + 1 : line.size() + 1;
+        return true;
+    }
+};
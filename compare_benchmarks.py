@@ -0,0 +1,86 @@
+# compare_benchmarks.py : Flags regressions between two Google Benchmark JSON result files.
+#
+# Benchmarks are matched by name. When a run used --benchmark_repetitions the median aggregate is
+# compared, otherwise the mean of the iteration entries. A benchmark regresses when the candidate
+# time is more than --threshold slower than the baseline. Exits with 1 if anything regressed, so
+# the script can gate a change.
+#
+# usage: python3 compare_benchmarks.py baseline.json candidate.json [--threshold 0.05] [--metric real_time|cpu_time]
+
+import argparse
+import json
+import sys
+
+UNIT_TO_NS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def load_times(path, metric):
+    with open(path) as f:
+        results = json.load(f)
+
+    medians = {}
+    samples = {}
+    for entry in results.get("benchmarks", []):
+        if entry.get("error_occurred"):
+            continue
+        scale = UNIT_TO_NS.get(entry.get("time_unit", "ns"), 1.0)
+        time = entry[metric] * scale
+        name = entry.get("run_name", entry["name"])
+        if entry.get("run_type") == "aggregate":
+            if entry.get("aggregate_name") == "median":
+                medians[name] = time
+        else:
+            samples.setdefault(name, []).append(time)
+
+    times = {name: sum(values) / len(values) for name, values in samples.items()}
+    times.update(medians)
+    return times
+
+
+def format_ns(ns):
+    for unit, scale in (("s", 1e9), ("ms", 1e6), ("us", 1e3)):
+        if ns >= scale:
+            return "%.3f %s" % (ns / scale, unit)
+    return "%.1f ns" % ns
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Flags regressions between two Google Benchmark JSON files.")
+    parser.add_argument("baseline")
+    parser.add_argument("candidate")
+    parser.add_argument("--threshold", type=float, default=0.05,
+                        help="relative slowdown that counts as a regression (default 0.05, 5%%)")
+    parser.add_argument("--metric", choices=("real_time", "cpu_time"), default="cpu_time")
+    args = parser.parse_args()
+
+    baseline = load_times(args.baseline, args.metric)
+    candidate = load_times(args.candidate, args.metric)
+
+    regressions = 0
+    width = max([len(name) for name in list(baseline) + list(candidate)] + [9])
+    print("%-*s %14s %14s %9s" % (width, "benchmark", "baseline", "candidate", "change"))
+    for name in sorted(baseline):
+        if name not in candidate:
+            print("%-*s %14s %14s %9s  missing" % (width, name, format_ns(baseline[name]), "-", "-"))
+            continue
+        before = baseline[name]
+        after = candidate[name]
+        change = (after - before) / before if before > 0 else 0.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        elif change < -args.threshold:
+            flag = "  improved"
+        print("%-*s %14s %14s %+8.1f%%%s" % (width, name, format_ns(before), format_ns(after), change * 100, flag))
+
+    for name in sorted(set(candidate) - set(baseline)):
+        print("%-*s %14s %14s %9s  new" % (width, name, "-", format_ns(candidate[name]), "-"))
+
+    print("%d of %d benchmarks regressed by more than %.1f%% (%s)" %
+          (regressions, len(baseline), args.threshold * 100, args.metric))
+    return 1 if regressions > 0 else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,108 @@
+// connection_pool.h : Fixed size pool of SQLite connections for multithreaded query workloads.
+//
+// Connections are opened with SQLITE_OPEN_NOMUTEX, so SQLite does no locking of its own on them.
+// That is only safe because a connection is used by one thread at a time: a worker leases a
+// connection, owns it for as long as it holds the lease, and hands it back when done.
+//
+// Every connection opens the same database, which is either a file or a shared-cache in-memory
+// database named with shared_memory_uri.
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "sqlite3.h"
+
+class connection_pool
+{
+public:
+    static const int default_flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI | SQLITE_OPEN_NOMUTEX;
+
+    // URI of an in-memory database shared by every connection opened with it in this process
+    static std::string shared_memory_uri(const std::string& name)
+    {
+        return "file:" + name + "?mode=memory&cache=shared";
+    }
+
+    connection_pool(const std::string& uri, size_t size, int flags = default_flags)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            sqlite3* db = NULL;
+            if (sqlite3_open_v2(uri.c_str(), &db, flags, NULL) != SQLITE_OK)
+            {
+                error_message = db != NULL ? sqlite3_errmsg(db) : "out of memory";
+                sqlite3_close(db);
+                break;
+            }
+            // writers on a file database briefly lock readers out, wait rather than fail
+            sqlite3_busy_timeout(db, 5000);
+            all.push_back(db);
+        }
+        idle = all;
+    }
+
+    ~connection_pool()
+    {
+        // every lease must have been returned, an open statement would keep sqlite3_close from closing
+        for (sqlite3* db : all)
+        {
+            sqlite3_close(db);
+        }
+    }
+
+    connection_pool(const connection_pool&) = delete;
+    connection_pool& operator=(const connection_pool&) = delete;
+
+    // false if any connection failed to open, error() has the reason
+    bool ok() const { return error_message.empty() && !all.empty(); }
+    const std::string& error() const { return error_message; }
+    size_t size() const { return all.size(); }
+
+    // waits for an idle connection and takes it out of the pool
+    sqlite3* acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this] { return !idle.empty(); });
+        sqlite3* db = idle.back();
+        idle.pop_back();
+        return db;
+    }
+
+    // returns a connection taken with acquire
+    void release(sqlite3* db)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            idle.push_back(db);
+        }
+        available.notify_one();
+    }
+
+    // holds a connection for the lifetime of the lease
+    class lease
+    {
+    public:
+        explicit lease(connection_pool& pool) : pool(pool), db(pool.acquire()) {}
+        ~lease() { pool.release(db); }
+
+        lease(const lease&) = delete;
+        lease& operator=(const lease&) = delete;
+
+        sqlite3* get() const { return db; }
+
+    private:
+        connection_pool& pool;
+        sqlite3* db;
+    };
+
+private:
+    std::vector<sqlite3*> all;
+    std::vector<sqlite3*> idle;
+    std::mutex mutex;
+    std::condition_variable available;
+    std::string error_message;
+};
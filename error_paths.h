@@ -0,0 +1,129 @@
+// error_paths.h : The error paths of the Exceptions program, each one thrown and returned.
+//
+// divide and the custom application logic report their failures with exceptions, try_divide and
+// the try_ functions fail the same way but return the error through expected. Source.cpp runs
+// both, and ExceptionBenchmark.cpp and BatchDivideBenchmark.cpp time them.
+
+#pragma once
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "expected.h"
+
+// Custom exception derived from std::exception
+class CustomApplicationException : public std::exception {
+    private:
+        std::string message;
+    public:
+        CustomApplicationException(const std::string& msg) : message(msg) {}
+
+        // Override the what() method to provide custom error message
+        const char* what() const noexcept override {
+            return message.c_str();
+        }
+};
+
+inline bool do_even_more_custom_application_logic()
+{
+    // TODO: Throw any standard exception
+
+    std::cout << "Running Even More Custom Application Logic." << std::endl;
+    throw std::runtime_error("Something went wrong in even more custom logic!");
+    return true;
+}
+inline void do_custom_application_logic()
+{
+    // TODO: Wrap the call to do_even_more_custom_application_logic()
+    //  with an exception handler that catches std::exception, displays
+    //  a message and the exception.what(), then continues processing
+    std::cout << "Running Custom Application Logic." << std::endl;
+
+    try {
+        if (do_even_more_custom_application_logic())
+        {
+            std::cout << "Even More Custom Application Logic Succeeded." << std::endl;
+        }
+    }
+
+    // TODO: Throw a custom exception derived from std::exception
+    //  and catch it explictly in main
+
+    catch (const std::exception& e) {
+        std::cout << "Caught an exception in custom application logic: " << e.what() << std::endl;
+    }
+
+    // Throwing a custom exception derived from std::exception
+    throw CustomApplicationException("Custom logic failed with a specific error!");
+
+    std::cout << "Leaving Custom Application Logic." << std::endl; // Unreachable code after throw
+}
+
+inline float divide(float num, float den)
+{
+    // TODO: Throw an exception to deal with divide by zero errors using
+    //  a standard C++ defined exception
+
+    if (den == 0) {
+        throw std::invalid_argument("Division by zero is not allowed!");
+    }
+    return (num / den);
+}
+
+// failures returned through expected rather than thrown. The messages are static text, so an error
+//  is two words and reporting one never allocates.
+enum class app_error_code
+{
+    division_by_zero,
+    even_more_logic_failed,
+    custom_logic_failed
+};
+
+struct app_error
+{
+    app_error_code code;
+    const char* message;
+};
+
+inline app_error make_app_error(app_error_code code) noexcept
+{
+    static const char* const messages[] = {
+        "Division by zero is not allowed!",
+        "Something went wrong in even more custom logic!",
+        "Custom logic failed with a specific error!"
+    };
+    return app_error{ code, messages[static_cast<int>(code)] };
+}
+
+// the functions above without exceptions, each fails the same way but returns the error
+
+// these two print as they go, like the throwing versions, so they are not noexcept
+inline expected<bool, app_error> try_do_even_more_custom_application_logic()
+{
+    std::cout << "Running Even More Custom Application Logic." << std::endl;
+    return unexpected(make_app_error(app_error_code::even_more_logic_failed));
+}
+
+inline expected<void, app_error> try_do_custom_application_logic()
+{
+    std::cout << "Running Custom Application Logic." << std::endl;
+
+    auto even_more = try_do_even_more_custom_application_logic();
+    if (!even_more) {
+        std::cout << "Caught an exception in custom application logic: " << even_more.error().message << std::endl;
+    }
+    else if (*even_more) {
+        std::cout << "Even More Custom Application Logic Succeeded." << std::endl;
+    }
+
+    return unexpected(make_app_error(app_error_code::custom_logic_failed));
+}
+
+inline expected<float, app_error> try_divide(float num, float den) noexcept
+{
+    if (den == 0) {
+        return unexpected(make_app_error(app_error_code::division_by_zero));
+    }
+    return (num / den);
+}
@@ -0,0 +1,77 @@
+// expected.h : A value or an error, returned instead of thrown.
+//
+// expected<T, E> is a small C++17 stand-in for std::expected: it holds either the result of a call
+// or the reason it failed, and the caller checks which. Failing costs a return, not a throw, so it
+// suits failures that are routine rather than exceptional. E is meant to be cheap to copy, an error
+// code with a message that points at static text, so reporting a failure never allocates.
+//
+// expected<void, E> is for calls that have no result, only success or an error.
+
+#pragma once
+
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+template <typename E>
+class unexpected
+{
+public:
+    constexpr explicit unexpected(E error) : error_value(std::move(error)) {}
+
+    constexpr const E& error() const noexcept { return error_value; }
+
+private:
+    E error_value;
+};
+
+template <typename E>
+unexpected(E) -> unexpected<E>;
+
+template <typename T, typename E>
+class expected
+{
+public:
+    constexpr expected() : state(std::in_place_index<0>) {}
+    constexpr expected(T value) : state(std::in_place_index<0>, std::move(value)) {}
+    constexpr expected(unexpected<E> failure) : state(std::in_place_index<1>, failure.error()) {}
+
+    constexpr bool has_value() const noexcept { return state.index() == 0; }
+    constexpr explicit operator bool() const noexcept { return has_value(); }
+
+    // only when has_value()
+    constexpr T& value() & { return *std::get_if<0>(&state); }
+    constexpr const T& value() const& { return *std::get_if<0>(&state); }
+    constexpr T& operator*() & { return value(); }
+    constexpr const T& operator*() const& { return value(); }
+
+    // only when !has_value()
+    constexpr const E& error() const& { return *std::get_if<1>(&state); }
+
+    template <typename U>
+    constexpr T value_or(U&& fallback) const&
+    {
+        return has_value() ? value() : static_cast<T>(std::forward<U>(fallback));
+    }
+
+private:
+    std::variant<T, E> state;
+};
+
+template <typename E>
+class expected<void, E>
+{
+public:
+    constexpr expected() noexcept {}
+    constexpr expected(unexpected<E> failure) : failed(true), error_value(failure.error()) {}
+
+    constexpr bool has_value() const noexcept { return !failed; }
+    constexpr explicit operator bool() const noexcept { return has_value(); }
+
+    // only when !has_value()
+    constexpr const E& error() const& { return error_value; }
+
+private:
+    bool failed = false;
+    E error_value{};
+};
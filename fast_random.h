@@ -0,0 +1,215 @@
+// fast_random.h : Seedable xoshiro256** generator, per-thread instances and deterministic parallel fills.
+//
+// xoshiro256 is small (32 bytes of state), fast and statistically strong, and, unlike rand(), every
+// instance is independent: nothing is shared between threads and the same seed always gives the
+// same numbers. A generator is seeded with a seed and a stream number, so one seed yields any
+// number of unrelated sequences, such as one per test or one per shard of a large fill.
+//
+// parallel_fill splits the output into fixed size shards, each filled from its own stream of the
+// seed, so the result depends only on the seed and never on the number of threads or the order in
+// which they ran. A failing run is replayed exactly by passing the same seed again.
+//
+// random_seed() is the process wide seed: the RANDOM_SEED environment variable when set, otherwise
+// taken from the clock. Print it when a run starts so the run can be repeated.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <string_view>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace fast_random_detail
+{
+    // the splitmix64 finalizer, turns nearby inputs into unrelated outputs
+    inline uint64_t mix(uint64_t value) noexcept
+    {
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+        return value ^ (value >> 31);
+    }
+
+    inline uint64_t rotate_left(uint64_t value, int count) noexcept
+    {
+        return (value << count) | (value >> (64 - count));
+    }
+
+    inline uint64_t initial_seed()
+    {
+        const char* text = std::getenv("RANDOM_SEED");
+        if (text != NULL && *text != '\0')
+        {
+            return std::strtoull(text, NULL, 0);
+        }
+        return static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count());
+    }
+
+    inline std::atomic<uint64_t>& process_seed()
+    {
+        static std::atomic<uint64_t> seed(initial_seed());
+        return seed;
+    }
+
+    inline std::atomic<uint64_t>& thread_streams()
+    {
+        static std::atomic<uint64_t> streams(0);
+        return streams;
+    }
+
+    // values per shard of a parallel fill, fixed so the output does not depend on the thread count
+    const size_t shard_size = 64 * 1024;
+}
+
+// xoshiro256** by Blackman and Vigna. Meets the UniformRandomBitGenerator requirements, so it also
+//  works with the std distributions and std::shuffle.
+class xoshiro256
+{
+public:
+    typedef uint64_t result_type;
+
+    explicit xoshiro256(uint64_t seed = 0, uint64_t stream = 0) noexcept
+    {
+        reseed(seed, stream);
+    }
+
+    // the state is filled by splitmix64 from the seed and stream, never all zero
+    void reseed(uint64_t seed, uint64_t stream = 0) noexcept
+    {
+        uint64_t sequence = seed ^ fast_random_detail::mix(stream + 0x9E3779B97F4A7C15ull);
+        for (auto& word : state)
+        {
+            sequence += 0x9E3779B97F4A7C15ull;
+            word = fast_random_detail::mix(sequence);
+        }
+    }
+
+    static constexpr result_type min() noexcept { return 0; }
+    static constexpr result_type max() noexcept { return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()() noexcept
+    {
+        const uint64_t result = fast_random_detail::rotate_left(state[1] * 5, 7) * 9;
+        const uint64_t shifted = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= shifted;
+        state[3] = fast_random_detail::rotate_left(state[3], 45);
+        return result;
+    }
+
+    // uniform in [0, bound), bound > 0. Lemire's multiply and shift, unbiased, and it only divides
+    //  in the rare case a value has to be redrawn.
+    uint32_t below(uint32_t bound) noexcept
+    {
+        uint64_t product = static_cast<uint64_t>(static_cast<uint32_t>((*this)() >> 32)) * bound;
+        uint32_t low = static_cast<uint32_t>(product);
+        if (low < bound)
+        {
+            const uint32_t threshold = (0u - bound) % bound;
+            while (low < threshold)
+            {
+                product = static_cast<uint64_t>(static_cast<uint32_t>((*this)() >> 32)) * bound;
+                low = static_cast<uint32_t>(product);
+            }
+        }
+        return static_cast<uint32_t>(product >> 32);
+    }
+
+    // uniform in [low, high]
+    int32_t between(int32_t low, int32_t high) noexcept
+    {
+        const uint64_t span = static_cast<uint64_t>(static_cast<int64_t>(high) - low) + 1;
+        if (span > std::numeric_limits<uint32_t>::max())
+        {
+            return static_cast<int32_t>(static_cast<uint32_t>((*this)() >> 32));
+        }
+        return static_cast<int32_t>(low + static_cast<int64_t>(below(static_cast<uint32_t>(span))));
+    }
+
+    // count raw 64 bit values
+    void fill(uint64_t* out, size_t count) noexcept
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            out[i] = (*this)();
+        }
+    }
+
+    // count values uniform in [low, high]
+    void fill(int32_t* out, size_t count, int32_t low, int32_t high) noexcept
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            out[i] = between(low, high);
+        }
+    }
+
+    // every element of out, keeping its size
+    void fill(std::vector<int32_t>& out, int32_t low, int32_t high) noexcept
+    {
+        fill(out.data(), out.size(), low, high);
+    }
+
+private:
+    uint64_t state[4];
+};
+
+inline uint64_t random_seed() noexcept
+{
+    return fast_random_detail::process_seed().load(std::memory_order_relaxed);
+}
+
+// affects generators created afterwards, including the thread_random of threads that have not used it yet
+inline void set_random_seed(uint64_t seed) noexcept
+{
+    fast_random_detail::process_seed().store(seed, std::memory_order_relaxed);
+}
+
+// a stream number for a name, e.g. a test name, so a named run can be repeated on its own
+inline uint64_t random_stream(std::string_view name) noexcept
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : name)
+    {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// this thread's generator, seeded from random_seed() on first use with a stream per thread. The
+//  streams are numbered in the order threads first call this, so only single threaded use replays
+//  exactly; seed a xoshiro256 explicitly where threads race.
+inline xoshiro256& thread_random() noexcept
+{
+    static thread_local xoshiro256 generator(random_seed(), fast_random_detail::thread_streams().fetch_add(1, std::memory_order_relaxed));
+    return generator;
+}
+
+// fills out with values uniform in [low, high], the same values for the same seed whatever the pool size
+inline void parallel_fill(thread_pool& pool, uint64_t seed, int32_t* out, size_t count, int32_t low, int32_t high)
+{
+    using fast_random_detail::shard_size;
+    const size_t shards = (count + shard_size - 1) / shard_size;
+    pool.parallel_for(shards, [&](size_t first, size_t last)
+    {
+        for (size_t shard = first; shard < last; ++shard)
+        {
+            const size_t begin = shard * shard_size;
+            const size_t end = begin + shard_size < count ? begin + shard_size : count;
+            xoshiro256 generator(seed, shard);
+            generator.fill(out + begin, end - begin, low, high);
+        }
+    });
+}
+
+inline void parallel_fill(thread_pool& pool, uint64_t seed, std::vector<int32_t>& out, int32_t low, int32_t high)
+{
+    parallel_fill(pool, seed, out.data(), out.size(), low, high);
+}
@@ -0,0 +1,167 @@
+// fixed_string.h : Fixed capacity string stored inline, for short fixed-width fields.
+//
+// fixed_string<N> holds at most N characters in a block of 16, 32, ... bytes inside the object
+// itself, so it never allocates and copying it is a copy of that block. The last byte of the block
+// holds the length and every byte between the end of the text and the length is zero, so c_str()
+// needs no extra work and two strings are equal exactly when their blocks are: equality is a
+// compare of whole 16 byte lanes, with no length check and no loop over characters.
+//
+// Literals are checked at compile time, a literal longer than N does not compile, and compare
+// against a fixed_string through that same conversion. Compare other text with view(). Runtime text that
+// does not fit is never silently cut off: assign reports overflow and leaves the string as it was,
+// assign_truncated keeps the first N characters and reports that it did.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FIXED_STRING_SSE2 1
+#include <emmintrin.h>
+#endif
+
+enum class fixed_string_status
+{
+    ok,
+    // the text was cut off at the capacity
+    truncated,
+    // the text did not fit and nothing was changed
+    overflow
+};
+
+namespace fixed_string_detail
+{
+    // bytes are compared a 16 byte lane at a time, size is a multiple of 16
+    inline bool equal_blocks(const char* a, const char* b, size_t size) noexcept
+    {
+#if defined(FIXED_STRING_SSE2)
+        for (size_t offset = 0; offset < size; offset += 16)
+        {
+            const __m128i left = _mm_load_si128(reinterpret_cast<const __m128i*>(a + offset));
+            const __m128i right = _mm_load_si128(reinterpret_cast<const __m128i*>(b + offset));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(left, right)) != 0xFFFF)
+            {
+                return false;
+            }
+        }
+        return true;
+#else
+        return std::memcmp(a, b, size) == 0;
+#endif
+    }
+}
+
+template <size_t N>
+class fixed_string
+{
+    static_assert(N > 0 && N <= 254, "fixed_string is for short fields, the length is kept in one byte");
+
+public:
+    static constexpr size_t capacity = N;
+    // the text, its terminating NUL and the length byte, rounded up to whole 16 byte lanes
+    static constexpr size_t storage_size = (N + 2 + 15) / 16 * 16;
+
+    constexpr fixed_string() noexcept {}
+
+    // from a literal, a literal longer than N is a compile error
+    template <size_t M>
+    constexpr fixed_string(const char (&text)[M]) noexcept
+    {
+        static_assert(M - 1 <= N, "literal is longer than the fixed_string capacity");
+        for (size_t k = 0; k + 1 < M; ++k)
+        {
+            chars[k] = text[k];
+        }
+        chars[length_index] = static_cast<char>(M - 1);
+    }
+
+    // the whole text or nothing: overflow leaves the string unchanged
+    fixed_string_status assign(std::string_view text) noexcept
+    {
+        if (text.size() > N)
+        {
+            return fixed_string_status::overflow;
+        }
+        store(text.data(), text.size());
+        return fixed_string_status::ok;
+    }
+
+    // keeps the first N characters of text when it is longer
+    fixed_string_status assign_truncated(std::string_view text) noexcept
+    {
+        const bool fits = text.size() <= N;
+        store(text.data(), fits ? text.size() : N);
+        return fits ? fixed_string_status::ok : fixed_string_status::truncated;
+    }
+
+    // the whole text or nothing, like assign
+    fixed_string_status append(std::string_view text) noexcept
+    {
+        const size_t length = size();
+        if (text.size() > N - length)
+        {
+            return fixed_string_status::overflow;
+        }
+        if (!text.empty())
+        {
+            std::memcpy(chars + length, text.data(), text.size());
+        }
+        chars[length_index] = static_cast<char>(length + text.size());
+        return fixed_string_status::ok;
+    }
+
+    void clear() noexcept
+    {
+        std::memset(chars, 0, storage_size);
+    }
+
+    constexpr size_t size() const noexcept { return static_cast<unsigned char>(chars[length_index]); }
+    constexpr bool empty() const noexcept { return size() == 0; }
+    constexpr bool full() const noexcept { return size() == N; }
+    constexpr const char* data() const noexcept { return chars; }
+    constexpr const char* c_str() const noexcept { return chars; }
+    constexpr char operator[](size_t index) const noexcept { return chars[index]; }
+
+    constexpr std::string_view view() const noexcept { return std::string_view(chars, size()); }
+    constexpr operator std::string_view() const noexcept { return view(); }
+    std::string str() const { return std::string(chars, size()); }
+
+    friend bool operator==(const fixed_string& left, const fixed_string& right) noexcept
+    {
+        return fixed_string_detail::equal_blocks(left.chars, right.chars, storage_size);
+    }
+    friend bool operator!=(const fixed_string& left, const fixed_string& right) noexcept { return !(left == right); }
+    friend bool operator<(const fixed_string& left, const fixed_string& right) noexcept { return left.view() < right.view(); }
+
+    friend std::ostream& operator<<(std::ostream& out, const fixed_string& text) { return out << text.view(); }
+
+private:
+    static constexpr size_t length_index = storage_size - 1;
+
+    alignas(16) char chars[storage_size] = {};
+
+    void store(const char* text, size_t length) noexcept
+    {
+        // a fixed size clear is a few vector stores, cheaper than zeroing just the old tail
+        std::memset(chars, 0, storage_size);
+        if (length > 0)
+        {
+            std::memcpy(chars, text, length);
+        }
+        chars[length_index] = static_cast<char>(length);
+    }
+};
+
+namespace std
+{
+    template <size_t N>
+    struct hash< fixed_string<N> >
+    {
+        size_t operator()(const fixed_string<N>& text) const noexcept { return hash<string_view>()(text.view()); }
+    };
+}
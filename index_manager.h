@@ -0,0 +1,295 @@
+// index_manager.h : Secondary indexes for the USERS table and query plan checks.
+//
+// The USERS schema only has the primary key on ID, so every WHERE NAME=... lookup is a full table
+// scan. index_manager owns a list of secondary indexes, by default one covering index that starts
+// with NAME and lets a NAME lookup return ID, NAME and PASSWORD without touching the table. An
+// index on NAME alone would add nothing: the covering index serves every lookup it could. It
+// creates the missing indexes, drops them, and refreshes the planner statistics. check_plans runs EXPLAIN QUERY
+// PLAN on the statements a program runs most often and warns about each one that filters rows
+// but is planned as a scan.
+
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "sqlite3.h"
+#include "sql_lexer.h"
+
+struct index_spec
+{
+    std::string name;
+    // comma separated column list, in index order
+    std::string columns;
+};
+
+struct query_plan_step
+{
+    int id = 0;
+    int parent = 0;
+    // e.g. "SEARCH USERS USING COVERING INDEX IDX_USERS_LOOKUP (NAME=?)" or "SCAN USERS"
+    std::string detail;
+};
+
+class index_manager
+{
+public:
+    explicit index_manager(sqlite3* db, std::string table = "USERS", std::vector<index_spec> indexes = default_indexes())
+        : db(db), table(std::move(table)), specs(std::move(indexes)) {}
+
+    static std::vector<index_spec> default_indexes()
+    {
+        return {
+            { "IDX_USERS_LOOKUP", "NAME, ID, PASSWORD" },
+        };
+    }
+
+    const std::vector<index_spec>& indexes() const { return specs; }
+
+    // the CREATE INDEX statements, also usable as bulk_load_options::indexes. Empty if a name or
+    //  column list is not made of plain identifiers.
+    std::vector<std::string> create_statements()
+    {
+        std::vector<std::string> statements;
+        if (valid_names())
+        {
+            for (const auto& spec : specs)
+            {
+                statements.push_back(create_statement(spec));
+            }
+        }
+        return statements;
+    }
+
+    bool exists(const std::string& index_name)
+    {
+        sqlite3_stmt* stmt = NULL;
+        if (sqlite3_prepare_v2(db, "SELECT 1 FROM sqlite_master WHERE type='index' AND name=?1", -1, &stmt, NULL) != SQLITE_OK)
+        {
+            error = sqlite3_errmsg(db);
+            return false;
+        }
+        sqlite3_bind_text(stmt, 1, index_name.c_str(), static_cast<int>(index_name.size()), SQLITE_TRANSIENT);
+        const bool found = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+        return found;
+    }
+
+    // creates every index that does not exist yet and returns how many were created, or -1 on error
+    int ensure()
+    {
+        if (!valid_names())
+        {
+            return -1;
+        }
+        int created = 0;
+        for (const auto& spec : specs)
+        {
+            if (exists(spec.name))
+            {
+                continue;
+            }
+            if (!exec(create_statement(spec)))
+            {
+                return -1;
+            }
+            ++created;
+        }
+        return created;
+    }
+
+    bool drop()
+    {
+        if (!valid_names())
+        {
+            return false;
+        }
+        for (const auto& spec : specs)
+        {
+            if (!exec("DROP INDEX IF EXISTS " + spec.name))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // refreshes the planner statistics for the table, worth doing after a bulk load
+    bool analyze()
+    {
+        return valid_names() && exec("ANALYZE " + table);
+    }
+
+    // the EXPLAIN QUERY PLAN rows for a single statement, false if it cannot be prepared
+    bool query_plan(const std::string& sql, std::vector<query_plan_step>& plan)
+    {
+        plan.clear();
+        const std::string explain = "EXPLAIN QUERY PLAN " + sql;
+        sqlite3_stmt* stmt = NULL;
+        const char* tail = NULL;
+        if (sqlite3_prepare_v2(db, explain.c_str(), static_cast<int>(explain.size() + 1), &stmt, &tail) != SQLITE_OK)
+        {
+            error = sqlite3_errmsg(db);
+            return false;
+        }
+        if (stmt == NULL || !is_blank(tail))
+        {
+            sqlite3_finalize(stmt);
+            error = stmt == NULL ? "empty statement" : "multiple statements are not allowed";
+            return false;
+        }
+
+        int result;
+        while ((result = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            query_plan_step step;
+            step.id = sqlite3_column_int(stmt, 0);
+            step.parent = sqlite3_column_int(stmt, 1);
+            const unsigned char* detail = sqlite3_column_text(stmt, 3);
+            step.detail = detail ? reinterpret_cast<const char*>(detail) : "";
+            plan.push_back(step);
+        }
+        sqlite3_finalize(stmt);
+        if (result != SQLITE_DONE)
+        {
+            error = sqlite3_errmsg(db);
+            return false;
+        }
+        return true;
+    }
+
+    // true if the statement has a WHERE clause but some step of its plan reads the whole table or index
+    bool scans_for_lookup(const std::string& sql, const std::vector<query_plan_step>& plan) const
+    {
+        if (!has_where_clause(sql))
+        {
+            return false;
+        }
+        for (const auto& step : plan)
+        {
+            if (step.detail.compare(0, 5, "SCAN ") == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // writes a warning for every hot statement that filters rows with a full scan and returns how
+    //  many there were. Statements that cannot be planned are warned about and counted too.
+    size_t check_plans(const std::vector<std::string>& hot_statements, std::ostream& warnings)
+    {
+        size_t flagged = 0;
+        std::vector<query_plan_step> plan;
+        for (const auto& sql : hot_statements)
+        {
+            if (!query_plan(sql, plan))
+            {
+                warnings << "Query plan warning: cannot plan \"" << sql << "\". ERROR = " << error << std::endl;
+                ++flagged;
+                continue;
+            }
+            if (scans_for_lookup(sql, plan))
+            {
+                warnings << "Query plan warning: \"" << sql << "\" is a full scan:";
+                for (const auto& step : plan)
+                {
+                    warnings << " " << step.detail << ";";
+                }
+                warnings << std::endl;
+                ++flagged;
+            }
+        }
+        return flagged;
+    }
+
+    const std::string& last_error() const { return error; }
+
+private:
+    sqlite3* db;
+    std::string table;
+    std::vector<index_spec> specs;
+    std::string error;
+
+    std::string create_statement(const index_spec& spec) const
+    {
+        return "CREATE INDEX IF NOT EXISTS " + spec.name + " ON " + table + "(" + spec.columns + ")";
+    }
+
+    bool exec(const std::string& sql)
+    {
+        char* error_message = NULL;
+        if (sqlite3_exec(db, sql.c_str(), NULL, NULL, &error_message) != SQLITE_OK)
+        {
+            error = error_message ? error_message : sqlite3_errmsg(db);
+            sqlite3_free(error_message);
+            return false;
+        }
+        return true;
+    }
+
+    // names and column lists are spliced into DDL, so they may only hold identifier characters
+    static bool is_identifier_list(std::string_view text, bool allow_list)
+    {
+        if (text.empty())
+        {
+            return false;
+        }
+        for (char c : text)
+        {
+            const bool word = (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_';
+            if (!word && !(allow_list && (c == ',' || c == ' ')))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool valid_names()
+    {
+        if (!is_identifier_list(table, false))
+        {
+            error = "invalid table name " + table;
+            return false;
+        }
+        for (const auto& spec : specs)
+        {
+            if (!is_identifier_list(spec.name, false) || !is_identifier_list(spec.columns, true))
+            {
+                error = "invalid index " + spec.name + "(" + spec.columns + ")";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool has_where_clause(std::string_view sql)
+    {
+        sql_lexer lexer(sql);
+        for (sql_token token = lexer.next_significant(); token.kind != sql_token_kind::end; token = lexer.next_significant())
+        {
+            if (token.is_keyword("where"))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool is_blank(const char* tail)
+    {
+        while (tail != NULL && *tail != '\0')
+        {
+            if (*tail != ' ' && *tail != '\t' && *tail != '\r' && *tail != '\n' && *tail != ';')
+            {
+                return false;
+            }
+            ++tail;
+        }
+        return true;
+    }
+};
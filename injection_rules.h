@@ -0,0 +1,500 @@
+// injection_rules.h : SQL injection rule set matched by one compile-time built automaton.
+//
+// Each rule is a keyword pattern in rule_patterns:
+//
+//  tautology      OR followed by an always-true comparison (OR 1=1, OR 'a'='a', OR x=x, OR (1=1), OR TRUE)
+//  union_select   UNION [ALL] SELECT appended to read other tables
+//  stacked_query  a second statement after ";" (; DROP ..., ; INSERT ...)
+//  comment        "--" or "/*", used to cut off the rest of the intended statement
+//
+// The patterns are compiled by constexpr functions into an Aho-Corasick automaton, folded into a
+// full transition table, so the table is part of the binary and nothing is built at runtime.
+// Patterns are written in a normalized alphabet: letters are lowercased, a run of whitespace
+// becomes one space, and a space is also fed wherever a word meets punctuation or a literal, so
+// the spaces in a pattern act as word boundaries. That normalization is folded into a second
+// table indexed by byte class, so detect_injection does one lookup per byte outside quoted
+// literals, whatever the number of rules. A tautology match only says where an OR keyword is,
+// the comparison after it is checked with the same test detect_tautology uses.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "sql_lexer.h"
+#include "tautology_detector.h"
+
+enum class injection_rule
+{
+    tautology,
+    union_select,
+    stacked_query,
+    comment
+};
+
+const size_t injection_rule_count = 4;
+
+struct injection_verdict
+{
+    bool detected = false;
+    injection_rule rule = injection_rule::tautology;
+    // the text that matched the rule, pointing into the screened statement
+    std::string_view match;
+    // for a tautology, the comparison that is always true
+    tautology_verdict comparison;
+};
+
+// short label for a rule, e.g. for metrics
+inline const char* injection_rule_name(injection_rule rule) noexcept
+{
+    switch (rule)
+    {
+    case injection_rule::tautology: return "tautology";
+    case injection_rule::union_select: return "union";
+    case injection_rule::stacked_query: return "stacked";
+    case injection_rule::comment: return "comment";
+    }
+    return "unknown";
+}
+
+// how a rule is described when a statement is rejected
+inline const char* injection_rule_description(injection_rule rule) noexcept
+{
+    switch (rule)
+    {
+    case injection_rule::tautology: return "Tautology attack";
+    case injection_rule::union_select: return "UNION attack";
+    case injection_rule::stacked_query: return "Stacked query";
+    case injection_rule::comment: return "Comment truncation";
+    }
+    return "Injection";
+}
+
+// the text that gave a statement away: the always true comparison of a tautology, as OR 1=1,
+//  or what matched any other rule
+inline std::string injection_evidence(const injection_verdict& verdict)
+{
+    if (verdict.rule == injection_rule::tautology)
+    {
+        return "OR " + std::string(verdict.comparison.lhs) + std::string(verdict.comparison.op) + std::string(verdict.comparison.rhs);
+    }
+    return std::string(verdict.match);
+}
+
+namespace injection_rules_detail
+{
+    struct rule_pattern
+    {
+        injection_rule rule;
+        // in the normalized alphabet: lower case letters, single spaces, ; - / *
+        const char* text;
+    };
+
+    // adding a rule is adding a line here, the automaton and the scan stay one pass
+    constexpr rule_pattern rule_patterns[] = {
+        { injection_rule::tautology, " or " },
+        { injection_rule::union_select, " union select " },
+        { injection_rule::union_select, " union all select " },
+        { injection_rule::stacked_query, "; select " },
+        { injection_rule::stacked_query, "; insert " },
+        { injection_rule::stacked_query, "; update " },
+        { injection_rule::stacked_query, "; delete " },
+        { injection_rule::stacked_query, "; replace " },
+        { injection_rule::stacked_query, "; drop " },
+        { injection_rule::stacked_query, "; create " },
+        { injection_rule::stacked_query, "; alter " },
+        { injection_rule::stacked_query, "; attach " },
+        { injection_rule::stacked_query, "; detach " },
+        { injection_rule::stacked_query, "; pragma " },
+        { injection_rule::stacked_query, "; vacuum " },
+        { injection_rule::stacked_query, "; with " },
+        { injection_rule::comment, "--" },
+        { injection_rule::comment, "/*" },
+    };
+    constexpr size_t pattern_count = sizeof(rule_patterns) / sizeof(rule_patterns[0]);
+
+    // symbols of the normalized alphabet
+    constexpr size_t symbol_count = 32;
+    constexpr uint8_t space_symbol = 0;
+    // digits, other word characters, other punctuation and whole quoted literals
+    constexpr uint8_t other_symbol = 1;
+    constexpr uint8_t letter_symbol = 2;
+    constexpr uint8_t semicolon_symbol = 28;
+    constexpr uint8_t dash_symbol = 29;
+    constexpr uint8_t slash_symbol = 30;
+    constexpr uint8_t star_symbol = 31;
+
+    constexpr uint8_t symbol_of(char c) noexcept
+    {
+        if (c >= 'a' && c <= 'z') return static_cast<uint8_t>(letter_symbol + (c - 'a'));
+        if (c >= 'A' && c <= 'Z') return static_cast<uint8_t>(letter_symbol + (c - 'A'));
+        switch (c)
+        {
+        case ' ': case '\t': case '\n': case '\r': case '\f': case '\v': return space_symbol;
+        case ';': return semicolon_symbol;
+        case '-': return dash_symbol;
+        case '/': return slash_symbol;
+        case '*': return star_symbol;
+        default: return other_symbol;
+        }
+    }
+
+    enum char_kind : uint8_t { space_kind, word_kind, punct_kind, quote_kind };
+
+    // bytes that are fed to the automaton the same way share a class
+    constexpr size_t byte_class_count = 34;
+    constexpr uint8_t word_class = 27;
+    constexpr uint8_t punct_class = 32;
+    constexpr uint8_t quote_class = 33;
+
+    constexpr uint8_t class_of(unsigned char c) noexcept
+    {
+        if (c >= 'a' && c <= 'z') return static_cast<uint8_t>(1 + (c - 'a'));
+        if (c >= 'A' && c <= 'Z') return static_cast<uint8_t>(1 + (c - 'A'));
+        if ((c >= '0' && c <= '9') || c == '_' || c == '$' || c >= 0x80) return word_class;
+        switch (c)
+        {
+        case ' ': case '\t': case '\n': case '\r': case '\f': case '\v': return 0;
+        case ';': return 28;
+        case '-': return 29;
+        case '/': return 30;
+        case '*': return 31;
+        case '\'': case '"': case '`': case '[': return quote_class;
+        default: return punct_class;
+        }
+    }
+
+    constexpr char_kind kind_of_class(size_t byte_class) noexcept
+    {
+        return byte_class == 0 ? space_kind : byte_class <= word_class ? word_kind : byte_class == quote_class ? quote_kind : punct_kind;
+    }
+
+    // the symbol a byte of the class is fed as, a whole literal is fed as one other_symbol
+    constexpr uint8_t symbol_of_class(size_t byte_class) noexcept
+    {
+        if (byte_class == 0) return space_symbol;
+        if (byte_class <= 26) return static_cast<uint8_t>(letter_symbol + byte_class - 1);
+        switch (byte_class)
+        {
+        case 28: return semicolon_symbol;
+        case 29: return dash_symbol;
+        case 30: return slash_symbol;
+        case 31: return star_symbol;
+        default: return other_symbol;
+        }
+    }
+
+    constexpr std::array<uint8_t, 256> build_byte_classes() noexcept
+    {
+        std::array<uint8_t, 256> classes{};
+        for (size_t c = 0; c < 256; ++c)
+        {
+            classes[c] = class_of(static_cast<unsigned char>(c));
+        }
+        return classes;
+    }
+
+    constexpr size_t text_length(const char* text) noexcept
+    {
+        size_t length = 0;
+        while (text[length] != '\0')
+        {
+            ++length;
+        }
+        return length;
+    }
+
+    // a trie state per pattern character at most, plus the root
+    constexpr size_t state_capacity() noexcept
+    {
+        size_t states = 1;
+        for (const auto& pattern : rule_patterns)
+        {
+            states += text_length(pattern.text);
+        }
+        return states;
+    }
+
+    constexpr uint16_t no_state = 0xFFFF;
+
+    struct automaton
+    {
+        // next[state][symbol], complete: failure links are already followed
+        std::array<std::array<uint16_t, symbol_count>, state_capacity()> next{};
+        // 1 + the pattern that ends in each state (or in its longest matching suffix), 0 for none
+        std::array<uint8_t, state_capacity()> match{};
+        size_t states = 0;
+    };
+
+    constexpr automaton build_automaton() noexcept
+    {
+        automaton dfa;
+        for (auto& row : dfa.next)
+        {
+            for (auto& target : row)
+            {
+                target = no_state;
+            }
+        }
+
+        // the trie of the patterns
+        dfa.states = 1;
+        for (size_t p = 0; p < pattern_count; ++p)
+        {
+            size_t state = 0;
+            for (const char* c = rule_patterns[p].text; *c != '\0'; ++c)
+            {
+                const uint8_t symbol = symbol_of(*c);
+                if (dfa.next[state][symbol] == no_state)
+                {
+                    dfa.next[state][symbol] = static_cast<uint16_t>(dfa.states++);
+                }
+                state = dfa.next[state][symbol];
+            }
+            if (dfa.match[state] == 0)
+            {
+                dfa.match[state] = static_cast<uint8_t>(p + 1);
+            }
+        }
+
+        // breadth first over the trie, filling missing transitions from the failure state, which
+        //  is shallower and so already complete
+        std::array<uint16_t, state_capacity()> fail{};
+        std::array<uint16_t, state_capacity()> queue{};
+        size_t head = 0;
+        size_t tail = 0;
+        for (size_t symbol = 0; symbol < symbol_count; ++symbol)
+        {
+            uint16_t& target = dfa.next[0][symbol];
+            if (target == no_state)
+            {
+                target = 0;
+            }
+            else
+            {
+                fail[target] = 0;
+                queue[tail++] = target;
+            }
+        }
+        while (head < tail)
+        {
+            const uint16_t state = queue[head++];
+            if (dfa.match[state] == 0)
+            {
+                dfa.match[state] = dfa.match[fail[state]];
+            }
+            for (size_t symbol = 0; symbol < symbol_count; ++symbol)
+            {
+                uint16_t& target = dfa.next[state][symbol];
+                if (target == no_state)
+                {
+                    target = dfa.next[fail[state]][symbol];
+                }
+                else
+                {
+                    fail[target] = dfa.next[fail[state]][symbol];
+                    queue[tail++] = target;
+                }
+            }
+        }
+        return dfa;
+    }
+
+    // the symbols one byte is fed as, given the kind of byte before it: whitespace after anything
+    //  but whitespace is one space, a word meeting punctuation or a literal gets a space first
+    struct byte_step
+    {
+        uint8_t symbols[2] = { 0, 0 };
+        uint8_t count = 0;
+        char_kind kind = space_kind;
+    };
+
+    constexpr byte_step step_for(char_kind previous, size_t byte_class) noexcept
+    {
+        byte_step step;
+        const char_kind kind = kind_of_class(byte_class);
+        if (kind == space_kind)
+        {
+            if (previous != space_kind)
+            {
+                step.symbols[step.count++] = space_symbol;
+            }
+            return step;
+        }
+        const bool word = kind == word_kind;
+        if (previous != space_kind && (previous == word_kind) != word)
+        {
+            step.symbols[step.count++] = space_symbol;
+        }
+        step.symbols[step.count++] = symbol_of_class(byte_class);
+        step.kind = word ? word_kind : punct_kind;
+        return step;
+    }
+
+    // the automaton with the byte normalization folded in: one lookup per byte of the statement
+    constexpr uint16_t matched_flag = 0x8000;
+    constexpr uint16_t literal_flag = 0x4000;
+    constexpr uint16_t scan_state_mask = 0x3FFF;
+
+    struct scan_table
+    {
+        // next[state * 3 + kind of the previous byte][byte class], with matched_flag set when the
+        //  byte completes a pattern and literal_flag set when it opens a literal
+        std::array<std::array<uint16_t, byte_class_count>, state_capacity() * 3> next{};
+    };
+
+    constexpr scan_table build_scan_table(const automaton& dfa) noexcept
+    {
+        scan_table table;
+        for (size_t state = 0; state < dfa.states; ++state)
+        {
+            for (size_t previous = 0; previous < 3; ++previous)
+            {
+                for (size_t byte_class = 0; byte_class < byte_class_count; ++byte_class)
+                {
+                    const byte_step step = step_for(static_cast<char_kind>(previous), byte_class);
+                    size_t target = state;
+                    uint16_t flags = byte_class == quote_class ? literal_flag : 0;
+                    const char_kind kind = step.count == 0 ? static_cast<char_kind>(previous) : step.kind;
+                    for (size_t k = 0; k < step.count; ++k)
+                    {
+                        target = dfa.next[target][step.symbols[k]];
+                        if (dfa.match[target] != 0)
+                        {
+                            flags |= matched_flag;
+                        }
+                    }
+                    table.next[state * 3 + previous][byte_class] = static_cast<uint16_t>((target * 3 + kind) | flags);
+                }
+            }
+        }
+        return table;
+    }
+
+    static_assert(pattern_count < 255, "match ids are stored in a byte");
+    static_assert(state_capacity() * 3 <= scan_state_mask, "scan states are stored in 14 bits");
+
+    inline constexpr std::array<uint8_t, 256> byte_classes = build_byte_classes();
+    inline constexpr automaton rules_automaton = build_automaton();
+    inline constexpr scan_table rules_scan_table = build_scan_table(rules_automaton);
+
+    inline bool is_space(char c) noexcept
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+    }
+
+    // the text a pattern matched, found by walking back from where its last symbol was fed
+    inline std::string_view matched_text(std::string_view sql, const char* pattern, size_t offset) noexcept
+    {
+        size_t last = text_length(pattern);
+        size_t end = offset;
+        if (pattern[last - 1] == ' ')
+        {
+            // the closing boundary was fed by the byte after the match
+            --last;
+            while (end > 0 && is_space(sql[end - 1])) --end;
+        }
+        else
+        {
+            end = offset + 1;
+        }
+
+        size_t begin = end;
+        const size_t first = pattern[0] == ' ' ? 1 : 0;
+        for (size_t k = last; k > first; --k)
+        {
+            if (pattern[k - 1] == ' ')
+            {
+                while (begin > 0 && is_space(sql[begin - 1])) --begin;
+            }
+            else
+            {
+                --begin;
+            }
+        }
+        return sql.substr(begin, end - begin);
+    }
+
+    // the comparison after an OR keyword that ends just before offset
+    inline bool always_true_after(std::string_view sql, size_t offset, tautology_verdict& verdict) noexcept
+    {
+        sql_lexer lexer(sql.substr(offset));
+        sql_token lhs, op, rhs;
+        if (!tautology_detail::read_or_operand(lexer, lhs, op, rhs) || !tautology_detail::is_always_true(lhs, op, rhs))
+        {
+            return false;
+        }
+        verdict.detected = true;
+        verdict.lhs = lhs.text;
+        verdict.op = op.text;
+        verdict.rhs = rhs.text;
+        return true;
+    }
+
+    // feeds the byte at offset symbol by symbol to find which pattern it completed, true when that
+    //  pattern's rule holds
+    inline bool check_match(std::string_view sql, uint16_t scan_state, size_t byte_class, size_t offset, injection_verdict& verdict) noexcept
+    {
+        const automaton& dfa = rules_automaton;
+        const byte_step step = step_for(static_cast<char_kind>(scan_state % 3), byte_class);
+        size_t state = scan_state / 3;
+        for (size_t k = 0; k < step.count; ++k)
+        {
+            state = dfa.next[state][step.symbols[k]];
+            const uint8_t matched = dfa.match[state];
+            if (matched == 0)
+            {
+                continue;
+            }
+            const rule_pattern& pattern = rule_patterns[matched - 1];
+            if (pattern.rule == injection_rule::tautology && !always_true_after(sql, offset, verdict.comparison))
+            {
+                continue;
+            }
+            verdict.detected = true;
+            verdict.rule = pattern.rule;
+            verdict.match = matched_text(sql, pattern.text, offset);
+            return true;
+        }
+        return false;
+    }
+}
+
+// screens sql against every rule in one pass and reports the first rule that matches
+inline injection_verdict detect_injection(std::string_view sql) noexcept
+{
+    using namespace injection_rules_detail;
+
+    injection_verdict verdict;
+    const auto& next = rules_scan_table.next;
+    // the start of the statement is a word boundary
+    uint16_t state = static_cast<uint16_t>(rules_automaton.next[0][space_symbol] * 3 + space_kind);
+
+    const size_t size = sql.size();
+    for (size_t i = 0; i < size; ++i)
+    {
+        const uint8_t byte_class = byte_classes[static_cast<unsigned char>(sql[i])];
+        const uint16_t target = next[state][byte_class];
+        if (target & (matched_flag | literal_flag))
+        {
+            if ((target & matched_flag) && check_match(sql, state, byte_class, i, verdict))
+            {
+                return verdict;
+            }
+            if (target & literal_flag)
+            {
+                // a literal or quoted identifier is one symbol, nothing inside it can match a rule
+                const size_t end = sql.find(sql[i] == '[' ? ']' : sql[i], i + 1);
+                i = end == std::string_view::npos ? size : end;
+            }
+        }
+        state = target & scan_state_mask;
+    }
+
+    // the end of the statement closes the last word
+    check_match(sql, state, 0, size, verdict);
+    return verdict;
+}
@@ -0,0 +1,179 @@
+// line_reader.h : Bounded line reader over stdin, a file or a pipe.
+//
+// Input is read a block at a time straight from the file descriptor into one buffer that is
+// reused over and over: records are handed out as string_views into it, so reading a line costs no
+// allocation and no copy. When the unread tail gets close to the end of the buffer it is moved
+// back to the front, and since a record is never longer than the limit that move is at most
+// max_record_length bytes.
+//
+// A record longer than max_record_length is never buffered in full. The reader keeps its first
+// max_record_length bytes, drops the rest as it arrives, and hands the record out marked as
+// truncated with its real length, so the caller can report it. The next record starts cleanly at
+// the following line break.
+//
+// Reads return as soon as some input is available, so an interactive prompt gets its line at once.
+// Do not read the same FILE through stdio as well, the reader bypasses its buffer.
+
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+struct line_record
+{
+    // the line without its line break, at most max_record_length bytes. Valid until the next call to next().
+    std::string_view text;
+    // true if the line was longer than the limit and text holds only its start
+    bool truncated = false;
+    // length of the whole line, more than text.size() when truncated
+    size_t length = 0;
+    // 1 based line number
+    uint64_t number = 0;
+};
+
+class line_reader
+{
+public:
+    explicit line_reader(std::FILE* input, size_t max_record_length = 4096, size_t block_size = 64 * 1024)
+        : input(input), limit(max_record_length == 0 ? 1 : max_record_length),
+          block(block_size == 0 ? 4096 : block_size), capacity(limit + block),
+          buffer(new char[capacity]) {}
+
+    line_reader(const line_reader&) = delete;
+    line_reader& operator=(const line_reader&) = delete;
+
+    // reads the next line, false at the end of the input or on a read error (see error())
+    bool next(line_record& record)
+    {
+        for (;;)
+        {
+            // a complete line already buffered
+            const char* found = static_cast<const char*>(std::memchr(buffer.get() + scanned, '\n', end - scanned));
+            if (found != NULL)
+            {
+                const size_t line_end = static_cast<size_t>(found - buffer.get());
+                emit(record, line_end, true);
+                begin = line_end + 1;
+                scanned = begin;
+                return true;
+            }
+            scanned = end;
+
+            if (end - begin > limit)
+            {
+                // too long to ever hand out whole, keep the first limit bytes and drop the rest
+                skipped += end - (begin + limit);
+                last_dropped = buffer[end - 1];
+                end = begin + limit;
+                scanned = end;
+            }
+
+            if (at_end)
+            {
+                if (end == begin && skipped == 0)
+                {
+                    return false;
+                }
+                // the last line had no line break
+                emit(record, end, false);
+                begin = end;
+                scanned = end;
+                return true;
+            }
+
+            fill();
+        }
+    }
+
+    const std::string& error() const { return error_message; }
+    size_t max_record_length() const { return limit; }
+    uint64_t lines() const { return line_count; }
+    uint64_t overflows() const { return overflow_count; }
+    uint64_t bytes_read() const { return total_bytes; }
+
+private:
+    std::FILE* input;
+    size_t limit;
+    size_t block;
+    size_t capacity;
+    std::unique_ptr<char[]> buffer;
+    // unread data is [begin, end), no line break in [begin, scanned)
+    size_t begin = 0;
+    size_t end = 0;
+    size_t scanned = 0;
+    // bytes dropped from the line being read, past the limit
+    size_t skipped = 0;
+    char last_dropped = '\0';
+    bool at_end = false;
+    uint64_t line_count = 0;
+    uint64_t overflow_count = 0;
+    uint64_t total_bytes = 0;
+    std::string error_message;
+
+    void emit(line_record& record, size_t line_end, bool line_break)
+    {
+        size_t length = line_end - begin + skipped;
+        // a CR before the line break belongs to the line break, when the line was cut off right
+        //  before the break the CR was one of the dropped bytes
+        const char before_break = skipped > 0 && line_end == begin + limit ? last_dropped : (line_end > begin ? buffer[line_end - 1] : '\0');
+        if (line_break && length > 0 && before_break == '\r')
+        {
+            --length;
+        }
+        record.truncated = length > limit;
+        record.length = length;
+        record.text = std::string_view(buffer.get() + begin, record.truncated ? limit : length);
+        record.number = ++line_count;
+        overflow_count += record.truncated ? 1 : 0;
+        skipped = 0;
+    }
+
+    void fill()
+    {
+        if (capacity - end < block)
+        {
+            // move the unfinished line, at most limit bytes, back to the front
+            const size_t unread = end - begin;
+            std::memmove(buffer.get(), buffer.get() + begin, unread);
+            begin = 0;
+            end = unread;
+            scanned = unread;
+        }
+
+        for (;;)
+        {
+#if defined(_WIN32)
+            const int count = _read(_fileno(input), buffer.get() + end, static_cast<unsigned>(capacity - end));
+#else
+            const ssize_t count = ::read(fileno(input), buffer.get() + end, capacity - end);
+#endif
+            if (count > 0)
+            {
+                end += static_cast<size_t>(count);
+                total_bytes += static_cast<uint64_t>(count);
+                return;
+            }
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count < 0)
+            {
+                error_message = std::strerror(errno);
+            }
+            at_end = true;
+            return;
+        }
+    }
+};
@@ -0,0 +1,186 @@
+// load_test.h : Multithreaded query driver that reports throughput and latency percentiles.
+//
+// Each worker thread leases one connection from a connection_pool for the whole run, builds its
+// own query runner on that connection and issues its share of a lookup / full scan / injected
+// query mix. Per-query latencies are kept per thread and merged once every worker has finished.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "connection_pool.h"
+
+enum class load_query_kind
+{
+    lookup,   // point lookup by NAME
+    scan,     // full table scan
+    injected  // point lookup with an injected tautology
+};
+
+struct load_test_options
+{
+    size_t threads = 4;
+    // total number of queries across all threads
+    size_t queries = 100000;
+    // percentages of the mix, the rest are lookups
+    unsigned injected_percent = 20;
+    unsigned scan_percent = 10;
+    unsigned seed = 405;
+
+    // false if the injected and scan percentages add up to more than 100
+    bool valid() const { return injected_percent <= 100 && scan_percent <= 100 - injected_percent; }
+};
+
+struct load_test_report
+{
+    size_t queries = 0;
+    size_t accepted = 0;
+    size_t rejected = 0;
+    double seconds = 0;
+    double p50_us = 0;
+    double p99_us = 0;
+    double max_us = 0;
+
+    double queries_per_second() const { return seconds > 0 ? static_cast<double>(queries) / seconds : 0; }
+};
+
+namespace load_test_detail
+{
+    inline double percentile_us(std::vector<uint64_t>& nanoseconds, double fraction)
+    {
+        if (nanoseconds.empty())
+        {
+            return 0;
+        }
+        size_t rank = static_cast<size_t>(fraction * static_cast<double>(nanoseconds.size() - 1));
+        std::nth_element(nanoseconds.begin(), nanoseconds.begin() + rank, nanoseconds.end());
+        return static_cast<double>(nanoseconds[rank]) / 1000.0;
+    }
+}
+
+// runs the query mix on options.threads threads, at most one per pooled connection.
+//  make_runner(sqlite3*) is called on each worker thread and must return a callable
+//  bool(load_query_kind) that runs one query and returns false if it was rejected or failed.
+//  The runner is destroyed on its thread before the connection is returned. Throws
+//  std::invalid_argument if the mix adds up to more than 100%. If make_runner or a runner throws,
+//  the other workers stop after their current query and the first exception is rethrown here once
+//  they have all finished.
+template <typename RunnerFactory>
+load_test_report run_load_test(connection_pool& pool, const load_test_options& options, RunnerFactory make_runner)
+{
+    if (!options.valid())
+    {
+        throw std::invalid_argument("the injected and scan percentages add up to more than 100");
+    }
+
+    // a worker holds its connection for the whole run, so there can be no more workers than connections
+    const size_t threads = std::max<size_t>(1, std::min(options.threads, pool.size()));
+
+    std::vector< std::vector<uint64_t> > latencies(threads);
+    std::vector<size_t> accepted(threads, 0);
+    std::atomic<size_t> ready(0);
+    std::atomic<bool> start(false);
+    std::atomic<bool> failed(false);
+    std::mutex error_mutex;
+    std::exception_ptr first_error;
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (size_t t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&, t]
+        {
+            size_t share = options.queries / threads + (t < options.queries % threads ? 1 : 0);
+            std::vector<uint64_t>& samples = latencies[t];
+            samples.reserve(share);
+
+            connection_pool::lease connection(pool);
+            // a worker that fails to set up still counts as ready, or the run would never start
+            bool counted = false;
+            try
+            {
+                auto runner = make_runner(connection.get());
+                std::minstd_rand random(options.seed + static_cast<unsigned>(t));
+                std::uniform_int_distribution<unsigned> percent(0, 99);
+
+                // hold every worker until all are set up so the timed section is fully concurrent
+                ++ready;
+                counted = true;
+                while (!start.load(std::memory_order_acquire))
+                {
+                    std::this_thread::yield();
+                }
+
+                for (size_t i = 0; i < share && !failed.load(std::memory_order_relaxed); ++i)
+                {
+                    unsigned roll = percent(random);
+                    load_query_kind kind = roll < options.injected_percent ? load_query_kind::injected :
+                        (roll < options.injected_percent + options.scan_percent ? load_query_kind::scan : load_query_kind::lookup);
+
+                    auto begin = std::chrono::steady_clock::now();
+                    bool ok = runner(kind);
+                    auto elapsed = std::chrono::steady_clock::now() - begin;
+
+                    samples.push_back(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+                    accepted[t] += ok ? 1 : 0;
+                }
+            }
+            catch (...)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!first_error)
+                    {
+                        first_error = std::current_exception();
+                    }
+                }
+                failed.store(true, std::memory_order_relaxed);
+                if (!counted)
+                {
+                    ++ready;
+                }
+            }
+        });
+    }
+
+    while (ready.load() < threads)
+    {
+        std::this_thread::yield();
+    }
+    auto begin = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    if (first_error)
+    {
+        std::rethrow_exception(first_error);
+    }
+
+    load_test_report report;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::vector<uint64_t> all;
+    all.reserve(options.queries);
+    for (size_t t = 0; t < threads; ++t)
+    {
+        all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+        report.accepted += accepted[t];
+    }
+    report.queries = all.size();
+    report.rejected = report.queries - report.accepted;
+    report.p50_us = load_test_detail::percentile_us(all, 0.50);
+    report.p99_us = load_test_detail::percentile_us(all, 0.99);
+    report.max_us = all.empty() ? 0 : static_cast<double>(*std::max_element(all.begin(), all.end())) / 1000.0;
+    return report;
+}
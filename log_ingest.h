@@ -0,0 +1,382 @@
+// log_ingest.h : Memory-mapped ingestion of large SQL query logs for offline injection auditing.
+//
+// The log is mapped read-only and never copied. It is cut into chunks of roughly chunk_size bytes,
+// each ending on a line break, and the chunks are screened in parallel on a thread_pool. Inside a
+// chunk statements end at a line break that is not inside a quoted literal or comment. A ; does
+// not end one: each statement is screened whole, the way run_query gets it, so ; DROP ... after it
+// is caught by the stacked query rule.
+// Literals and block comments can run over line breaks, so a chunk can end in the middle of a
+// statement. Each chunk is split as if it started outside any literal, and reports the state it
+// ended in; when the merge finds a chunk that ended inside a literal or comment, it joins the
+// following chunks to it until the state is clear again and splits the joined text once more.
+// The findings, merged back in file order, are the same whatever the chunk size.
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "injection_rules.h"
+#include "thread_pool.h"
+
+// read-only memory mapping of a whole file
+class mapped_file
+{
+public:
+    mapped_file() = default;
+    ~mapped_file() { close(); }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    bool open(const std::string& path)
+    {
+        close();
+#if defined(_WIN32)
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            error_message = "cannot open " + path;
+            return false;
+        }
+        LARGE_INTEGER length;
+        GetFileSizeEx(file, &length);
+        length_bytes = static_cast<size_t>(length.QuadPart);
+        if (length_bytes > 0)
+        {
+            mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            view = mapping != NULL ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+            if (view == NULL)
+            {
+                error_message = "cannot map " + path;
+                close();
+                return false;
+            }
+        }
+#else
+        descriptor = ::open(path.c_str(), O_RDONLY);
+        if (descriptor < 0)
+        {
+            error_message = "cannot open " + path + ": " + std::strerror(errno);
+            return false;
+        }
+        struct stat info;
+        if (fstat(descriptor, &info) != 0)
+        {
+            error_message = "cannot stat " + path + ": " + std::strerror(errno);
+            close();
+            return false;
+        }
+        length_bytes = static_cast<size_t>(info.st_size);
+        if (length_bytes > 0)
+        {
+            view = mmap(NULL, length_bytes, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (view == MAP_FAILED)
+            {
+                view = NULL;
+                error_message = "cannot map " + path + ": " + std::strerror(errno);
+                close();
+                return false;
+            }
+            // the log is read front to back once
+            madvise(view, length_bytes, MADV_SEQUENTIAL);
+        }
+#endif
+        return true;
+    }
+
+    void close()
+    {
+#if defined(_WIN32)
+        if (view != NULL) UnmapViewOfFile(view);
+        if (mapping != NULL) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (view != NULL) munmap(view, length_bytes);
+        if (descriptor >= 0) ::close(descriptor);
+        descriptor = -1;
+#endif
+        view = NULL;
+        length_bytes = 0;
+    }
+
+    std::string_view contents() const
+    {
+        return std::string_view(static_cast<const char*>(view), length_bytes);
+    }
+
+    const std::string& error() const { return error_message; }
+
+private:
+    void* view = NULL;
+    size_t length_bytes = 0;
+    std::string error_message;
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int descriptor = -1;
+#endif
+};
+
+struct audit_finding
+{
+    size_t line;                 // 1 based line the statement starts on
+    size_t offset;               // byte offset of the statement in the log
+    std::string_view statement;  // points into the mapped log
+    injection_verdict verdict;   // the rule that fired, pointing into the mapped log
+};
+
+struct audit_report
+{
+    size_t bytes = 0;
+    size_t statements = 0;
+    size_t chunks = 0;
+    double seconds = 0;
+    std::vector<audit_finding> findings;
+
+    double gigabytes_per_second() const { return seconds > 0 ? static_cast<double>(bytes) / seconds / 1e9 : 0; }
+    double statements_per_second() const { return seconds > 0 ? static_cast<double>(statements) / seconds : 0; }
+};
+
+// where the statement splitter is at a point in the text
+enum class split_state
+{
+    normal,
+    single_quoted,
+    double_quoted,
+    line_comment,
+    block_comment
+};
+
+namespace log_ingest_detail
+{
+    // moves state past text[i] and returns the index of the next byte to look at, which skips the
+    //  second character of /* and */. boundary is set when a statement ends at i.
+    inline size_t split_step(std::string_view text, size_t i, split_state& state, bool& boundary) noexcept
+    {
+        const char c = text[i];
+        const char next = i + 1 < text.size() ? text[i + 1] : '\0';
+        boundary = false;
+
+        switch (state)
+        {
+        case split_state::normal:
+            if (c == '\'') state = split_state::single_quoted;
+            else if (c == '"') state = split_state::double_quoted;
+            else if (c == '-' && next == '-') state = split_state::line_comment;
+            else if (c == '/' && next == '*')
+            {
+                state = split_state::block_comment;
+                return i + 2;
+            }
+            else if (c == '\n') boundary = true;
+            break;
+        case split_state::single_quoted:
+            if (c == '\'') state = split_state::normal;
+            break;
+        case split_state::double_quoted:
+            if (c == '"') state = split_state::normal;
+            break;
+        case split_state::line_comment:
+            // a line comment ends at the line break, literals and block comments carry on past it
+            if (c == '\n')
+            {
+                state = split_state::normal;
+                boundary = true;
+            }
+            break;
+        case split_state::block_comment:
+            if (c == '*' && next == '/')
+            {
+                state = split_state::normal;
+                return i + 2;
+            }
+            break;
+        }
+        return i + 1;
+    }
+}
+
+// the state the splitter is in after text, starting from state
+inline split_state scan_split_state(std::string_view text, split_state state) noexcept
+{
+    bool boundary;
+    for (size_t i = 0; i < text.size(); i = log_ingest_detail::split_step(text, i, state, boundary))
+    {
+    }
+    return state;
+}
+
+// calls visit(statement, offset, line) for every non-blank statement in text, where line counts the
+//  line breaks before the statement, and sets end_state to the state at the end of text. Returns
+//  the number of line breaks in text.
+template <typename Visitor>
+size_t split_sql_statements(std::string_view text, Visitor visit, split_state& end_state)
+{
+    split_state state = split_state::normal;
+    size_t lines = 0;
+    size_t start = 0;
+    size_t start_line = 0;
+
+    // hands out text[start, end) with surrounding blanks trimmed, a statement never starts with a
+    //  line break because every line break in open text ends the statement before it
+    auto emit = [&](size_t end)
+    {
+        size_t first = start;
+        while (first < end && (text[first] == ' ' || text[first] == '\t' || text[first] == '\r'))
+        {
+            ++first;
+        }
+        size_t last = end;
+        while (last > first && (text[last - 1] == ' ' || text[last - 1] == '\t' || text[last - 1] == '\r'))
+        {
+            --last;
+        }
+        if (last > first)
+        {
+            visit(text.substr(first, last - first), first, start_line);
+        }
+    };
+
+    size_t i = 0;
+    while (i < text.size())
+    {
+        const bool line_break = text[i] == '\n';
+        bool boundary;
+        const size_t next = log_ingest_detail::split_step(text, i, state, boundary);
+        if (line_break)
+        {
+            ++lines;
+        }
+        if (boundary)
+        {
+            emit(i);
+            start = i + 1;
+            start_line = lines;
+        }
+        i = next;
+    }
+    emit(text.size());
+    end_state = state;
+    return lines;
+}
+
+template <typename Visitor>
+size_t split_sql_statements(std::string_view text, Visitor visit)
+{
+    split_state end_state;
+    return split_sql_statements(text, visit, end_state);
+}
+
+// screens every statement in log with detect_injection on the pool and returns the findings in
+//  file order
+inline audit_report audit_sql_log(thread_pool& pool, std::string_view log, size_t chunk_size = 8 * 1024 * 1024)
+{
+    audit_report report;
+    auto begin = std::chrono::steady_clock::now();
+
+    // cut the log on line breaks near every chunk_size bytes
+    std::vector<size_t> bounds(1, 0);
+    while (bounds.back() < log.size())
+    {
+        size_t cut = bounds.back() + (chunk_size == 0 ? 1 : chunk_size);
+        if (cut >= log.size())
+        {
+            cut = log.size();
+        }
+        else
+        {
+            const void* newline = std::memchr(log.data() + cut, '\n', log.size() - cut);
+            cut = newline == NULL ? log.size() : static_cast<size_t>(static_cast<const char*>(newline) - log.data()) + 1;
+        }
+        bounds.push_back(cut);
+    }
+    const size_t chunks = bounds.size() - 1;
+
+    struct chunk_result
+    {
+        size_t statements = 0;
+        size_t lines = 0;
+        split_state end_state = split_state::normal;
+        std::vector<audit_finding> findings;
+    };
+    std::vector<chunk_result> results(chunks);
+
+    // screens log[begin, end), which must start outside any literal or comment
+    auto screen = [&log](size_t begin, size_t end, chunk_result& result)
+    {
+        result.lines = split_sql_statements(log.substr(begin, end - begin),
+            [&](std::string_view statement, size_t offset, size_t line)
+        {
+            ++result.statements;
+            injection_verdict verdict = detect_injection(statement);
+            if (verdict.detected)
+            {
+                // line is chunk relative until the merge below
+                result.findings.push_back(audit_finding{ line, begin + offset, statement, verdict });
+            }
+        }, result.end_state);
+    };
+
+    pool.parallel_for(chunks, [&](size_t first, size_t last)
+    {
+        for (size_t c = first; c < last; ++c)
+        {
+            screen(bounds[c], bounds[c + 1], results[c]);
+        }
+    });
+
+    size_t line_base = 1;
+    for (size_t c = 0; c < chunks;)
+    {
+        // a chunk that ends inside a literal or comment runs on into the next ones, whose own
+        //  results started in the wrong state. Join them until the state is clear and split again.
+        size_t joined = c + 1;
+        split_state state = results[c].end_state;
+        while (state != split_state::normal && joined < chunks)
+        {
+            state = scan_split_state(log.substr(bounds[joined], bounds[joined + 1] - bounds[joined]), state);
+            ++joined;
+        }
+        if (joined > c + 1)
+        {
+            results[c] = chunk_result();
+            screen(bounds[c], bounds[joined], results[c]);
+        }
+
+        chunk_result& result = results[c];
+        report.statements += result.statements;
+        for (auto& finding : result.findings)
+        {
+            finding.line += line_base;
+            report.findings.push_back(finding);
+        }
+        line_base += result.lines;
+        c = joined;
+    }
+
+    report.bytes = log.size();
+    report.chunks = chunks;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return report;
+}
@@ -0,0 +1,209 @@
+// output_sink.h : Buffered writer for query results.
+//
+// Rows are formatted straight into one large reusable buffer (integers with std::to_chars) and the
+// buffer is handed to the underlying stream in a single write when it fills up, or earlier if the
+// flush policy asks for it. Nothing is flushed per line the way std::endl does.
+//
+// Encodings:
+//  text    the dump_results layout: "SQL: <sql> ==> <n> records found." then "User: <name> [UID=<id> PWD=<password>]"
+//  csv     ID,NAME,PASSWORD header per result, fields quoted when they contain , " or a line break
+//  binary  per result: uint32 row count, then per row: int64 id, uint32 name length, name bytes,
+//          uint32 password length, password bytes. All integers little endian.
+
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string_view>
+
+enum class sink_format
+{
+    text,
+    csv,
+    binary
+};
+
+enum class flush_policy
+{
+    when_full,   // only when the buffer fills up, on flush() and on destruction
+    per_result,  // also at the end of every result set
+    per_row      // also after every row, for interactive output
+};
+
+class output_sink
+{
+public:
+    explicit output_sink(std::ostream& target, sink_format format = sink_format::text,
+        flush_policy policy = flush_policy::when_full, size_t capacity = 64 * 1024)
+        : target(target), format(format), policy(policy),
+          buffer(new char[capacity < 64 ? 64 : capacity]), capacity(capacity < 64 ? 64 : capacity) {}
+
+    ~output_sink()
+    {
+        flush();
+    }
+
+    output_sink(const output_sink&) = delete;
+    output_sink& operator=(const output_sink&) = delete;
+
+    // starts a result set of rows rows for the statement sql
+    void begin_result(std::string_view sql, size_t rows)
+    {
+        switch (format)
+        {
+        case sink_format::text:
+            append("\nSQL: ");
+            append(sql);
+            append(" ==> ");
+            append_integer(static_cast<uint64_t>(rows));
+            append(" records found.\n");
+            break;
+        case sink_format::csv:
+            append("ID,NAME,PASSWORD\n");
+            break;
+        case sink_format::binary:
+            append_le(static_cast<uint32_t>(rows));
+            break;
+        }
+    }
+
+    void write_row(int64_t id, std::string_view name, std::string_view password)
+    {
+        switch (format)
+        {
+        case sink_format::text:
+            append("User: ");
+            append(name);
+            append(" [UID=");
+            append_integer(id);
+            append(" PWD=");
+            append(password);
+            append("]\n");
+            break;
+        case sink_format::csv:
+            append_integer(id);
+            append(',');
+            append_csv_field(name);
+            append(',');
+            append_csv_field(password);
+            append('\n');
+            break;
+        case sink_format::binary:
+            append_le(static_cast<uint64_t>(id));
+            append_le(static_cast<uint32_t>(name.size()));
+            append(name);
+            append_le(static_cast<uint32_t>(password.size()));
+            append(password);
+            break;
+        }
+        if (policy == flush_policy::per_row)
+        {
+            flush();
+        }
+    }
+
+    void end_result()
+    {
+        if (policy != flush_policy::when_full)
+        {
+            flush();
+        }
+    }
+
+    // hands everything buffered so far to the target stream
+    void flush()
+    {
+        if (used > 0)
+        {
+            target.write(buffer.get(), static_cast<std::streamsize>(used));
+            used = 0;
+        }
+        target.flush();
+    }
+
+    size_t buffered() const { return used; }
+
+private:
+    std::ostream& target;
+    sink_format format;
+    flush_policy policy;
+    std::unique_ptr<char[]> buffer;
+    size_t capacity;
+    size_t used = 0;
+
+    void append(char c)
+    {
+        if (used == capacity)
+        {
+            drain();
+        }
+        buffer[used++] = c;
+    }
+
+    void append(std::string_view text)
+    {
+        if (text.size() > capacity - used)
+        {
+            drain();
+            if (text.size() > capacity)
+            {
+                // larger than the whole buffer, write it straight through
+                target.write(text.data(), static_cast<std::streamsize>(text.size()));
+                return;
+            }
+        }
+        std::memcpy(buffer.get() + used, text.data(), text.size());
+        used += text.size();
+    }
+
+    template <typename Integer>
+    void append_integer(Integer value)
+    {
+        char digits[24];
+        auto end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+        append(std::string_view(digits, static_cast<size_t>(end - digits)));
+    }
+
+    template <typename Unsigned>
+    void append_le(Unsigned value)
+    {
+        char bytes[sizeof(Unsigned)];
+        for (size_t i = 0; i < sizeof(Unsigned); ++i)
+        {
+            bytes[i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+        }
+        append(std::string_view(bytes, sizeof(bytes)));
+    }
+
+    void append_csv_field(std::string_view field)
+    {
+        if (field.find_first_of(",\"\r\n") == std::string_view::npos)
+        {
+            append(field);
+            return;
+        }
+        append('"');
+        for (char c : field)
+        {
+            if (c == '"')
+            {
+                append('"');
+            }
+            append(c);
+        }
+        append('"');
+    }
+
+    // writes the buffer out without flushing the target stream
+    void drain()
+    {
+        if (used > 0)
+        {
+            target.write(buffer.get(), static_cast<std::streamsize>(used));
+            used = 0;
+        }
+    }
+};
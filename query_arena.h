@@ -0,0 +1,178 @@
+// query_arena.h : Per-thread monotonic arena for scratch memory that only lives for one query.
+//
+// Each thread owns a query_arena: a std::pmr::monotonic_buffer_resource over a block the arena
+// keeps for the life of the thread. Query-scoped strings and vectors take
+// query_arena_scope::resource() as their allocator, so an allocation is a pointer bump and a
+// deallocation does nothing. When the outermost query_arena_scope ends the arena is reset in
+// O(1): the bump pointer goes back to the start of the block. A query that outgrew the block got
+// the rest from the heap, that spill is freed on reset and the block is regrown to fit, so the
+// next query like it stays inside.
+//
+// Nothing allocated from the arena may outlive the scope it was allocated in. Results handed back
+// to the caller, like user_record rows, still come from the heap.
+//
+// statement_cache unescapes the string literals it binds into the arena, and the shadow
+// screener's legacy detector takes its lowercased copies from it.
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+
+struct query_arena_stats
+{
+    // allocations and bytes served by the arena
+    size_t allocations = 0;
+    size_t bytes = 0;
+    // blocks the arena had to get from the heap after outgrowing its own block
+    size_t upstream_allocations = 0;
+    size_t upstream_bytes = 0;
+    size_t resets = 0;
+    // the most bytes a single query has taken from the arena
+    size_t high_water = 0;
+    size_t block_size = 0;
+};
+
+namespace query_arena_detail
+{
+    // forwards to another resource, counting the allocations and bytes that pass through
+    class counting_resource : public std::pmr::memory_resource
+    {
+    public:
+        explicit counting_resource(std::pmr::memory_resource* next = nullptr) : next(next) {}
+
+        void forward_to(std::pmr::memory_resource* resource) { next = resource; }
+
+        size_t allocations = 0;
+        size_t bytes = 0;
+
+    private:
+        std::pmr::memory_resource* next;
+
+        void* do_allocate(size_t size, size_t alignment) override
+        {
+            ++allocations;
+            bytes += size;
+            return next->allocate(size, alignment);
+        }
+
+        void do_deallocate(void* pointer, size_t size, size_t alignment) override
+        {
+            next->deallocate(pointer, size, alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+}
+
+class query_arena
+{
+public:
+    explicit query_arena(size_t block_size = 16 * 1024)
+        : upstream(std::pmr::new_delete_resource())
+    {
+        rebuild(block_size);
+    }
+
+    query_arena(const query_arena&) = delete;
+    query_arena& operator=(const query_arena&) = delete;
+
+    std::pmr::memory_resource* resource() { return &arena; }
+
+    // drops everything allocated since the last reset
+    void reset()
+    {
+        const size_t used = arena.bytes - bytes_at_reset;
+        if (used > high_water)
+        {
+            high_water = used;
+        }
+        ++resets;
+
+        if (upstream.allocations != spills_at_reset)
+        {
+            // the query spilled onto the heap, regrow the block so the next one like it does not
+            rebuild(high_water + high_water / 4);
+        }
+        else
+        {
+            monotonic->release();
+        }
+        bytes_at_reset = arena.bytes;
+        spills_at_reset = upstream.allocations;
+    }
+
+    query_arena_stats stats() const
+    {
+        query_arena_stats current;
+        current.allocations = arena.allocations;
+        current.bytes = arena.bytes;
+        current.upstream_allocations = upstream.allocations;
+        current.upstream_bytes = upstream.bytes;
+        current.resets = resets;
+        current.high_water = high_water;
+        current.block_size = block_size;
+        return current;
+    }
+
+private:
+    query_arena_detail::counting_resource upstream;
+    query_arena_detail::counting_resource arena;
+    std::unique_ptr<std::byte[]> block;
+    size_t block_size = 0;
+    std::optional<std::pmr::monotonic_buffer_resource> monotonic;
+    size_t resets = 0;
+    size_t high_water = 0;
+    size_t bytes_at_reset = 0;
+    size_t spills_at_reset = 0;
+
+    void rebuild(size_t size)
+    {
+        // releases the spill before the block it grew from
+        monotonic.reset();
+        block_size = size < 256 ? 256 : size;
+        block.reset(new std::byte[block_size]);
+        monotonic.emplace(block.get(), block_size, &upstream);
+        arena.forward_to(&*monotonic);
+    }
+};
+
+// the calling thread's arena
+inline query_arena& thread_query_arena()
+{
+    static thread_local query_arena arena;
+    return arena;
+}
+
+// marks the lifetime of one query's scratch memory. Scopes nest, only the outermost one resets
+//  the arena, so a helper can open its own scope whether or not its caller already did.
+class query_arena_scope
+{
+public:
+    query_arena_scope() { ++depth(); }
+
+    ~query_arena_scope()
+    {
+        if (--depth() == 0)
+        {
+            thread_query_arena().reset();
+        }
+    }
+
+    query_arena_scope(const query_arena_scope&) = delete;
+    query_arena_scope& operator=(const query_arena_scope&) = delete;
+
+    static std::pmr::memory_resource* resource() { return thread_query_arena().resource(); }
+
+private:
+    static int& depth()
+    {
+        static thread_local int open_scopes = 0;
+        return open_scopes;
+    }
+};
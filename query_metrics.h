@@ -0,0 +1,541 @@
+// query_metrics.h : Per-stage latency instrumentation for run_query.
+//
+// Built only when SQL_QUERY_METRICS is defined, otherwise every timer and counter below is an
+// empty inline function and costs nothing. Each thread writes to its own shard of counters and
+// log-linear (HDR style) histograms with relaxed atomics, so recording never takes a lock and a
+// dump from another thread reads consistent, if slightly stale, numbers. Shards of threads that
+// have exited are kept, and handed to the next new thread, so their counts are never lost.
+//
+// Stages timed for each run_query call:
+//  fingerprint  normalizing and lowercasing the statement for the caches
+//  screen       the tautology scan, or the verdict cache lookup
+//  execute      sqlite3_exec or stepping the prepared statement, less the row copies
+//  materialize  copying the rows into user_record tuples, sampled every 16th row
+//  total        the whole run_query call
+//
+// write_query_metrics() renders everything in the Prometheus text exposition format, stage
+// latencies and rows per query as summaries with quantiles, and dump_query_metrics() writes that
+// to a file whenever it is called.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "injection_rules.h"
+#include "tautology_detector.h"
+
+enum class query_stage { fingerprint, screen, execute, materialize, total };
+
+// the histograms are built either way, shadow_screen.h keeps its latencies in them too
+namespace query_metrics_detail
+{
+    // only one thread writes each counter, so a relaxed load and store is enough to count
+    inline void bump(std::atomic<uint64_t>& counter, uint64_t amount = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    inline unsigned highest_bit(uint64_t value)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return static_cast<unsigned>(index);
+#else
+        return 63u - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+    }
+
+    // log-linear histogram: values below 16 get their own bucket, above that every power of two is
+    //  split into 16 equal buckets, so a recorded value is off by at most 1/16 (about 6%)
+    struct histogram
+    {
+        static constexpr unsigned sub_bits = 4;
+        static constexpr size_t sub_buckets = size_t(1) << sub_bits;
+        static constexpr size_t bucket_count = (64 - sub_bits + 1) * sub_buckets;
+
+        std::array<std::atomic<uint64_t>, bucket_count> counts{};
+        std::atomic<uint64_t> count{ 0 };
+        std::atomic<uint64_t> sum{ 0 };
+        std::atomic<uint64_t> max{ 0 };
+
+        static size_t bucket_of(uint64_t value)
+        {
+            if (value < sub_buckets)
+            {
+                return static_cast<size_t>(value);
+            }
+            const unsigned shift = highest_bit(value) - sub_bits;
+            return (shift + 1) * sub_buckets + static_cast<size_t>((value >> shift) & (sub_buckets - 1));
+        }
+
+        // the largest value that lands in bucket
+        static uint64_t bucket_limit(size_t bucket)
+        {
+            if (bucket < sub_buckets)
+            {
+                return bucket;
+            }
+            const unsigned shift = static_cast<unsigned>(bucket / sub_buckets - 1);
+            const uint64_t lowest = (sub_buckets + bucket % sub_buckets) << shift;
+            return lowest + ((uint64_t(1) << shift) - 1);
+        }
+
+        void record(uint64_t value)
+        {
+            bump(counts[bucket_of(value)]);
+            bump(count);
+            bump(sum, value);
+            if (value > max.load(std::memory_order_relaxed))
+            {
+                max.store(value, std::memory_order_relaxed);
+            }
+        }
+
+        void reset()
+        {
+            for (auto& bucket : counts)
+            {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+            count.store(0, std::memory_order_relaxed);
+            sum.store(0, std::memory_order_relaxed);
+            max.store(0, std::memory_order_relaxed);
+        }
+    };
+
+    // a plain copy of one or more histograms for reporting
+    struct histogram_snapshot
+    {
+        std::vector<uint64_t> counts = std::vector<uint64_t>(histogram::bucket_count, 0);
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+
+        void add(const histogram& source)
+        {
+            for (size_t i = 0; i < histogram::bucket_count; ++i)
+            {
+                counts[i] += source.counts[i].load(std::memory_order_relaxed);
+            }
+            count += source.count.load(std::memory_order_relaxed);
+            sum += source.sum.load(std::memory_order_relaxed);
+            const uint64_t source_max = source.max.load(std::memory_order_relaxed);
+            max = source_max > max ? source_max : max;
+        }
+
+        uint64_t quantile(double q) const
+        {
+            if (count == 0)
+            {
+                return 0;
+            }
+            const uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count - 1)) + 1;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < counts.size(); ++i)
+            {
+                seen += counts[i];
+                if (seen >= rank)
+                {
+                    const uint64_t limit = histogram::bucket_limit(i);
+                    return limit < max ? limit : max;
+                }
+            }
+            return max;
+        }
+    };
+}
+
+#if defined(SQL_QUERY_METRICS)
+
+const bool query_metrics_enabled = true;
+
+namespace query_metrics_detail
+{
+    const size_t stage_count = 5;
+    const char* const stage_names[stage_count] = { "fingerprint", "screen", "execute", "materialize", "total" };
+
+    // rejection patterns are counted by operand kinds and operator, e.g. N=N for OR 1=1 or S<>C
+    //  for OR 'a'<>name, which keeps the label set small whatever the literals were
+    const char* const operand_kinds = "NSC";
+    const char* const comparison_ops[] = { "=", "==", "!=", "<>", "<", "<=", ">", ">=" };
+    const size_t comparison_op_count = sizeof(comparison_ops) / sizeof(comparison_ops[0]);
+    const size_t pattern_count = 3 * comparison_op_count * 3;
+    // the other rules are counted under their own name after the tautology patterns
+    const size_t rejection_count = pattern_count + injection_rule_count - 1;
+
+    inline size_t operand_kind(std::string_view operand)
+    {
+        if (operand.empty()) return 2;
+        const char first = operand.front();
+        if (first == '\'') return 1;
+        if ((first >= '0' && first <= '9') || first == '.' || first == '-' || first == '+') return 0;
+        return 2;
+    }
+
+    // a bare OR TRUE has no operator and is counted as C=C, the same as OR x=x
+    inline size_t pattern_index(const tautology_verdict& verdict)
+    {
+        size_t op = 0;
+        while (!verdict.op.empty() && op + 1 < comparison_op_count && verdict.op != comparison_ops[op])
+        {
+            ++op;
+        }
+        return (operand_kind(verdict.lhs) * comparison_op_count + op) * 3 + operand_kind(verdict.rhs);
+    }
+
+    inline size_t rejection_index(const injection_verdict& verdict)
+    {
+        if (verdict.rule == injection_rule::tautology)
+        {
+            return pattern_index(verdict.comparison);
+        }
+        return pattern_count + static_cast<size_t>(verdict.rule) - 1;
+    }
+
+    inline std::string pattern_name(size_t index)
+    {
+        if (index >= pattern_count)
+        {
+            return injection_rule_name(static_cast<injection_rule>(index - pattern_count + 1));
+        }
+        const size_t rhs = index % 3;
+        const size_t op = index / 3 % comparison_op_count;
+        const size_t lhs = index / 3 / comparison_op_count;
+        return std::string(1, operand_kinds[lhs]) + comparison_ops[op] + operand_kinds[rhs];
+    }
+
+    struct shard
+    {
+        std::array<histogram, stage_count> stages;
+        histogram rows;
+        std::atomic<uint64_t> rows_returned{ 0 };
+        std::array<std::atomic<uint64_t>, rejection_count> rejections{};
+        // row copy time of the statement being executed, and rows copied by this thread, owner thread only
+        uint64_t pending_row_copy_ns = 0;
+        uint64_t row_copies = 0;
+    };
+
+    struct registry
+    {
+        std::mutex mutex;
+        std::vector< std::unique_ptr<shard> > shards;
+        std::vector<shard*> idle;
+    };
+
+    inline registry& shared_registry()
+    {
+        static registry instance;
+        return instance;
+    }
+
+    // claims a shard for the calling thread and hands it back when the thread exits
+    class shard_owner
+    {
+    public:
+        shard_owner()
+        {
+            registry& all = shared_registry();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            if (!all.idle.empty())
+            {
+                owned = all.idle.back();
+                all.idle.pop_back();
+            }
+            else
+            {
+                all.shards.push_back(std::make_unique<shard>());
+                owned = all.shards.back().get();
+            }
+        }
+
+        ~shard_owner()
+        {
+            registry& all = shared_registry();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            all.idle.push_back(owned);
+        }
+
+        shard_owner(const shard_owner&) = delete;
+        shard_owner& operator=(const shard_owner&) = delete;
+
+        shard* owned;
+    };
+
+    inline shard& local_shard()
+    {
+        static thread_local shard_owner owner;
+        return *owner.owned;
+    }
+
+    inline uint64_t now_ns()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    inline void write_summary(std::ostream& out, const char* name, const std::string& labels, const histogram_snapshot& values, double scale)
+    {
+        static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+        const std::string separator = labels.empty() ? "" : ",";
+        for (double q : quantiles)
+        {
+            out << name << "{" << labels << separator << "quantile=\"" << q << "\"} " << static_cast<double>(values.quantile(q)) * scale << "\n";
+        }
+        out << name << "{" << labels << separator << "quantile=\"1\"} " << static_cast<double>(values.max) * scale << "\n";
+        const std::string braces = labels.empty() ? "" : "{" + labels + "}";
+        out << name << "_sum" << braces << " " << static_cast<double>(values.sum) * scale << "\n";
+        out << name << "_count" << braces << " " << values.count << "\n";
+    }
+}
+
+// times one stage of the current query from construction until stop() or destruction
+class stage_timer
+{
+public:
+    explicit stage_timer(query_stage stage) : stage(stage), start(query_metrics_detail::now_ns()) {}
+    ~stage_timer() { stop(); }
+
+    stage_timer(const stage_timer&) = delete;
+    stage_timer& operator=(const stage_timer&) = delete;
+
+    void stop()
+    {
+        if (running)
+        {
+            running = false;
+            query_metrics_detail::local_shard().stages[static_cast<size_t>(stage)].record(query_metrics_detail::now_ns() - start);
+        }
+    }
+
+private:
+    query_stage stage;
+    uint64_t start;
+    bool running = true;
+};
+
+// times running a statement, splitting the row copies timed by row_copy_timer into the
+//  materialize stage and recording the rest as execute
+class execute_timer
+{
+public:
+    execute_timer() : start(query_metrics_detail::now_ns()) { query_metrics_detail::local_shard().pending_row_copy_ns = 0; }
+    ~execute_timer() { stop(); }
+
+    execute_timer(const execute_timer&) = delete;
+    execute_timer& operator=(const execute_timer&) = delete;
+
+    void stop()
+    {
+        if (running)
+        {
+            running = false;
+            query_metrics_detail::shard& local = query_metrics_detail::local_shard();
+            const uint64_t elapsed = query_metrics_detail::now_ns() - start;
+            const uint64_t copying = local.pending_row_copy_ns < elapsed ? local.pending_row_copy_ns : elapsed;
+            local.stages[static_cast<size_t>(query_stage::execute)].record(elapsed - copying);
+            local.stages[static_cast<size_t>(query_stage::materialize)].record(copying);
+            local.pending_row_copy_ns = 0;
+        }
+    }
+
+private:
+    uint64_t start;
+    bool running = true;
+};
+
+// times copying one row, adding to the enclosing execute_timer. A row copy costs about as much as
+//  reading the clock twice, so only every 16th row is timed and counted 16 times
+class row_copy_timer
+{
+public:
+    static constexpr uint64_t sample_every = 16;
+
+    row_copy_timer() : local(query_metrics_detail::local_shard())
+    {
+        sampled = ++local.row_copies % sample_every == 0;
+        start = sampled ? query_metrics_detail::now_ns() : 0;
+    }
+    ~row_copy_timer()
+    {
+        if (sampled)
+        {
+            local.pending_row_copy_ns += (query_metrics_detail::now_ns() - start) * sample_every;
+        }
+    }
+
+    row_copy_timer(const row_copy_timer&) = delete;
+    row_copy_timer& operator=(const row_copy_timer&) = delete;
+
+private:
+    query_metrics_detail::shard& local;
+    bool sampled;
+    uint64_t start;
+};
+
+// counts the rows an accepted query returned
+inline void record_query_rows(size_t rows)
+{
+    query_metrics_detail::shard& local = query_metrics_detail::local_shard();
+    query_metrics_detail::bump(local.rows_returned, rows);
+    local.rows.record(rows);
+}
+
+// counts a statement rejected as an injection, by the pattern of the comparison that gave a
+//  tautology away or by the name of any other rule
+inline void record_rejection(const injection_verdict& verdict)
+{
+    query_metrics_detail::bump(query_metrics_detail::local_shard().rejections[query_metrics_detail::rejection_index(verdict)]);
+}
+
+// zeroes every shard, only meaningful while no queries are running
+inline void reset_query_metrics()
+{
+    query_metrics_detail::registry& all = query_metrics_detail::shared_registry();
+    std::lock_guard<std::mutex> lock(all.mutex);
+    for (auto& owned : all.shards)
+    {
+        for (auto& stage : owned->stages)
+        {
+            stage.reset();
+        }
+        owned->rows.reset();
+        owned->rows_returned.store(0, std::memory_order_relaxed);
+        for (auto& rejected : owned->rejections)
+        {
+            rejected.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+// writes the totals over every thread in the Prometheus text exposition format
+inline void write_query_metrics(std::ostream& out)
+{
+    using namespace query_metrics_detail;
+
+    std::array<histogram_snapshot, stage_count> stages;
+    histogram_snapshot rows;
+    uint64_t rows_returned = 0;
+    std::array<uint64_t, rejection_count> rejections{};
+    size_t threads = 0;
+    {
+        registry& all = shared_registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        threads = all.shards.size();
+        for (auto& owned : all.shards)
+        {
+            for (size_t i = 0; i < stage_count; ++i)
+            {
+                stages[i].add(owned->stages[i]);
+            }
+            rows.add(owned->rows);
+            rows_returned += owned->rows_returned.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < rejection_count; ++i)
+            {
+                rejections[i] += owned->rejections[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    uint64_t rejected = 0;
+    for (uint64_t count : rejections)
+    {
+        rejected += count;
+    }
+
+    out << "# HELP sql_queries_total Statements passed to run_query.\n"
+        << "# TYPE sql_queries_total counter\n"
+        << "sql_queries_total " << stages[static_cast<size_t>(query_stage::total)].count << "\n"
+        << "# HELP sql_queries_rejected_total Statements rejected as injections: tautologies by operand kinds (N number, S string, C column) and operator, other rules by name (union, stacked, comment).\n"
+        << "# TYPE sql_queries_rejected_total counter\n";
+    for (size_t i = 0; i < rejection_count; ++i)
+    {
+        if (rejections[i] > 0)
+        {
+            out << "sql_queries_rejected_total{pattern=\"" << pattern_name(i) << "\"} " << rejections[i] << "\n";
+        }
+    }
+    if (rejected == 0)
+    {
+        out << "sql_queries_rejected_total{pattern=\"N=N\"} 0\n";
+    }
+
+    out << "# HELP sql_query_rows_returned_total Rows returned by accepted statements.\n"
+        << "# TYPE sql_query_rows_returned_total counter\n"
+        << "sql_query_rows_returned_total " << rows_returned << "\n"
+        << "# HELP sql_query_rows Rows returned per accepted statement.\n"
+        << "# TYPE sql_query_rows summary\n";
+    write_summary(out, "sql_query_rows", "", rows, 1.0);
+
+    out << "# HELP sql_query_stage_seconds Time spent in each run_query stage.\n"
+        << "# TYPE sql_query_stage_seconds summary\n";
+    for (size_t i = 0; i < stage_count; ++i)
+    {
+        write_summary(out, "sql_query_stage_seconds", std::string("stage=\"") + stage_names[i] + "\"", stages[i], 1e-9);
+    }
+
+    out << "# HELP sql_query_metric_shards Per-thread metric shards in use or kept from exited threads.\n"
+        << "# TYPE sql_query_metric_shards gauge\n"
+        << "sql_query_metric_shards " << threads << "\n";
+}
+
+#else
+
+const bool query_metrics_enabled = false;
+
+class stage_timer
+{
+public:
+    explicit stage_timer(query_stage) {}
+    void stop() {}
+};
+
+class execute_timer
+{
+public:
+    execute_timer() {}
+    void stop() {}
+};
+
+class row_copy_timer
+{
+public:
+    row_copy_timer() {}
+};
+
+inline void record_query_rows(size_t) {}
+inline void record_rejection(const injection_verdict&) {}
+inline void reset_query_metrics() {}
+
+inline void write_query_metrics(std::ostream& out)
+{
+    out << "# query metrics are compiled out, build with SQL_QUERY_METRICS defined\n";
+}
+
+#endif
+
+// writes write_query_metrics() to path, returns false if the file cannot be written
+inline bool dump_query_metrics(const std::string& path)
+{
+    std::ofstream out(path, std::ios::trunc);
+    if (!out)
+    {
+        return false;
+    }
+    write_query_metrics(out);
+    return static_cast<bool>(out.flush());
+}
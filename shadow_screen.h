@@ -0,0 +1,379 @@
+// shadow_screen.h : Runs a candidate injection detector in the shadow of the one in use.
+//
+// shadow_screener::screen runs the primary detector inline and returns its verdict, so callers
+// behave exactly as before. The statement, the primary verdict and its latency are then queued
+// for a background thread that runs the candidate detector on the same statement and compares
+// the two. The candidate never runs on the caller's thread and the caller never waits for it:
+// when the queue is full the statement is dropped from the comparison and counted. A replay,
+// where every statement has to be compared for the report to be repeatable, uses screen_waiting
+// instead, which waits for room in the queue rather than dropping.
+//
+// Both latencies are kept in log-linear histograms from query_metrics.h, so the two detectors are
+// timed over exactly the same statements. Statements the detectors disagree on are kept once each,
+// with how often they were seen. write_report renders everything as plain text in a fixed order,
+// with nothing that changes between runs over the same input except the latencies, so the reports
+// of two builds can be compared with diff. Leave the latencies out to compare verdicts alone.
+//
+// Detectors are looked up by name:
+//  rules   detect_injection, what run_query uses
+//  lexer   detect_tautology
+//  simd    detect_tautology_simd
+//  legacy  detect_tautology_legacy, the original run_query scan, which reports no comparison.
+//          Its lowercased copies come from the background thread's query arena.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include "injection_rules.h"
+#include "query_arena.h"
+#include "query_metrics.h"
+#include "simd_scanner.h"
+#include "tautology_detector.h"
+
+struct shadow_detector
+{
+    const char* name;
+    injection_verdict (*screen)(std::string_view sql);
+};
+
+namespace shadow_screen_detail
+{
+    inline injection_verdict from_tautology(const tautology_verdict& comparison)
+    {
+        injection_verdict verdict;
+        verdict.detected = comparison.detected;
+        verdict.comparison = comparison;
+        return verdict;
+    }
+
+    inline injection_verdict screen_rules(std::string_view sql) { return detect_injection(sql); }
+    inline injection_verdict screen_lexer(std::string_view sql) { return from_tautology(detect_tautology(sql)); }
+    inline injection_verdict screen_simd(std::string_view sql) { return from_tautology(detect_tautology_simd(sql)); }
+
+    inline injection_verdict screen_legacy(std::string_view sql)
+    {
+        injection_verdict verdict;
+        query_arena_scope scratch;
+        verdict.detected = detect_tautology_legacy(sql, query_arena_scope::resource());
+        return verdict;
+    }
+
+    const shadow_detector detectors[] =
+    {
+        { "rules", screen_rules },
+        { "lexer", screen_lexer },
+        { "simd", screen_simd },
+        { "legacy", screen_legacy },
+    };
+
+    inline uint64_t now_ns()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    // "clean", or the rule that fired
+    inline const char* verdict_label(bool detected, injection_rule rule)
+    {
+        return detected ? injection_rule_name(rule) : "clean";
+    }
+
+    inline void write_latency(std::ostream& out, const char* role, const char* name, const query_metrics_detail::histogram_snapshot& values)
+    {
+        const double mean = values.count == 0 ? 0.0 : static_cast<double>(values.sum) / static_cast<double>(values.count);
+        out << std::left << std::setw(10) << role << std::setw(8) << name << std::right
+            << std::setw(9) << values.quantile(0.5) << std::setw(9) << values.quantile(0.9)
+            << std::setw(9) << values.quantile(0.99) << std::setw(9) << values.quantile(0.999)
+            << std::setw(10) << values.max << std::setw(10) << std::fixed << std::setprecision(1) << mean << "\n";
+    }
+}
+
+// NULL if there is no detector called name
+inline const shadow_detector* find_shadow_detector(std::string_view name)
+{
+    for (const shadow_detector& detector : shadow_screen_detail::detectors)
+    {
+        if (name == detector.name)
+        {
+            return &detector;
+        }
+    }
+    return NULL;
+}
+
+// the detector names separated by |, for usage messages
+inline std::string shadow_detector_names()
+{
+    std::string names;
+    for (const shadow_detector& detector : shadow_screen_detail::detectors)
+    {
+        names += names.empty() ? "" : "|";
+        names += detector.name;
+    }
+    return names;
+}
+
+// a statement the detectors disagreed on
+struct shadow_disagreement
+{
+    const char* primary = "clean";
+    const char* candidate = "clean";
+    uint64_t count = 0;
+};
+
+class shadow_screener
+{
+public:
+    // statements waiting for the candidate beyond queue_limit are dropped, and at most
+    //  disagreement_limit distinct statements are kept, the rest are only counted
+    shadow_screener(const shadow_detector& primary, const shadow_detector& candidate,
+        size_t queue_limit = 64 * 1024, size_t disagreement_limit = 1000)
+        : primary(primary), candidate(candidate), queue_limit(std::max<size_t>(1, queue_limit)), disagreement_limit(disagreement_limit),
+          worker([this] { work(); })
+    {
+    }
+
+    // compares every statement still queued, then stops the background thread
+    ~shadow_screener()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    shadow_screener(const shadow_screener&) = delete;
+    shadow_screener& operator=(const shadow_screener&) = delete;
+
+    // the primary verdict, pointing into sql. Safe to call from any number of threads.
+    injection_verdict screen(std::string_view sql)
+    {
+        return screen(sql, false);
+    }
+
+    // screen, but when the queue is full this waits for the background thread to take it rather
+    //  than dropping the statement, so every statement is compared
+    injection_verdict screen_waiting(std::string_view sql)
+    {
+        return screen(sql, true);
+    }
+
+    // waits until the candidate has seen every statement queued so far
+    void drain()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return outstanding == 0; });
+    }
+
+    const shadow_detector& primary_detector() const { return primary; }
+    const shadow_detector& candidate_detector() const { return candidate; }
+
+    // statements both detectors have screened
+    uint64_t compared() const { return compared_statements.load(std::memory_order_relaxed); }
+    uint64_t disagreements() const { return disagreeing_statements.load(std::memory_order_relaxed); }
+
+    uint64_t dropped() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return dropped_statements;
+    }
+
+    // the disagreements kept so far, by statement
+    std::map<std::string, shadow_disagreement> disagreement_list() const
+    {
+        std::lock_guard<std::mutex> lock(results_mutex);
+        return disagreed;
+    }
+
+    // drains the queue, then writes the report. Without latencies two runs over the same input
+    //  give the same report unless a verdict changed.
+    void write_report(std::ostream& out, bool include_latency = true)
+    {
+        drain();
+        using shadow_screen_detail::verdict_label;
+
+        out << "shadow screening report\n";
+        out << "primary " << primary.name << "\n";
+        out << "candidate " << candidate.name << "\n";
+        out << "statements compared " << compared() << "\n";
+        out << "statements dropped " << dropped() << "\n";
+        out << "primary detected " << primary_detected.load(std::memory_order_relaxed) << "\n";
+        out << "candidate detected " << candidate_detected.load(std::memory_order_relaxed) << "\n";
+        out << "disagreements " << disagreements() << "\n";
+
+        std::lock_guard<std::mutex> lock(results_mutex);
+        out << "distinct disagreements " << disagreed.size() << "\n";
+        out << "disagreements not listed " << unlisted << "\n";
+        for (const auto& entry : disagreed)
+        {
+            out << "  " << entry.second.primary << " -> " << entry.second.candidate << " x" << entry.second.count << ": " << entry.first << "\n";
+        }
+
+        if (include_latency)
+        {
+            query_metrics_detail::histogram_snapshot primary_ns, candidate_ns;
+            primary_ns.add(primary_latency);
+            candidate_ns.add(candidate_latency);
+            const std::ios_base::fmtflags flags = out.flags();
+            const std::streamsize precision = out.precision();
+            out << "latency ns          p50      p90      p99    p99.9       max      mean\n";
+            shadow_screen_detail::write_latency(out, "primary", primary.name, primary_ns);
+            shadow_screen_detail::write_latency(out, "candidate", candidate.name, candidate_ns);
+            out.flags(flags);
+            out.precision(precision);
+        }
+    }
+
+private:
+    struct pending
+    {
+        std::string sql;
+        bool detected;
+        injection_rule rule;
+        uint64_t primary_ns;
+    };
+
+    const shadow_detector primary;
+    const shadow_detector candidate;
+    const size_t queue_limit;
+    const size_t disagreement_limit;
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    // signalled when the background thread empties the queue, for screen_waiting
+    std::condition_variable room;
+    std::deque<pending> queued;
+    // queued plus being compared
+    size_t outstanding = 0;
+    uint64_t dropped_statements = 0;
+    bool stopping = false;
+
+    // written by the background thread only
+    query_metrics_detail::histogram primary_latency;
+    query_metrics_detail::histogram candidate_latency;
+    std::atomic<uint64_t> compared_statements{ 0 };
+    std::atomic<uint64_t> disagreeing_statements{ 0 };
+    std::atomic<uint64_t> primary_detected{ 0 };
+    std::atomic<uint64_t> candidate_detected{ 0 };
+
+    mutable std::mutex results_mutex;
+    std::map<std::string, shadow_disagreement> disagreed;
+    // disagreements on statements that did not fit in disagreed
+    uint64_t unlisted = 0;
+
+    // declared last, so everything it uses is constructed before it starts
+    std::thread worker;
+
+    injection_verdict screen(std::string_view sql, bool wait_for_room)
+    {
+        const uint64_t start = shadow_screen_detail::now_ns();
+        const injection_verdict verdict = primary.screen(sql);
+        const uint64_t elapsed = shadow_screen_detail::now_ns() - start;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        if (wait_for_room)
+        {
+            room.wait(lock, [this] { return queued.size() < queue_limit; });
+        }
+        else if (queued.size() >= queue_limit)
+        {
+            ++dropped_statements;
+            return verdict;
+        }
+        const bool was_empty = queued.empty();
+        queued.push_back(pending{ std::string(sql), verdict.detected, verdict.rule, elapsed });
+        ++outstanding;
+        lock.unlock();
+        if (was_empty)
+        {
+            wake.notify_one();
+        }
+        return verdict;
+    }
+
+    void work()
+    {
+        std::deque<pending> batch;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !queued.empty(); });
+                if (queued.empty())
+                {
+                    return;
+                }
+                // take everything queued at once, so callers contend for the lock once per batch
+                batch.swap(queued);
+            }
+            room.notify_all();
+
+            for (pending& statement : batch)
+            {
+                compare(statement);
+            }
+            const size_t done = batch.size();
+            batch.clear();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            outstanding -= done;
+            if (outstanding == 0)
+            {
+                idle.notify_all();
+            }
+        }
+    }
+
+    void compare(pending& statement)
+    {
+        const uint64_t start = shadow_screen_detail::now_ns();
+        const injection_verdict verdict = candidate.screen(statement.sql);
+        const uint64_t elapsed = shadow_screen_detail::now_ns() - start;
+
+        using query_metrics_detail::bump;
+        primary_latency.record(statement.primary_ns);
+        candidate_latency.record(elapsed);
+        bump(compared_statements);
+        bump(primary_detected, statement.detected ? 1 : 0);
+        bump(candidate_detected, verdict.detected ? 1 : 0);
+
+        // a different rule firing is a disagreement too, the statement would be reported differently
+        if (verdict.detected == statement.detected && (!verdict.detected || verdict.rule == statement.rule))
+        {
+            return;
+        }
+        bump(disagreeing_statements);
+
+        std::lock_guard<std::mutex> lock(results_mutex);
+        auto found = disagreed.find(statement.sql);
+        if (found == disagreed.end())
+        {
+            if (disagreed.size() >= disagreement_limit)
+            {
+                ++unlisted;
+                return;
+            }
+            found = disagreed.emplace(std::move(statement.sql), shadow_disagreement()).first;
+            found->second.primary = shadow_screen_detail::verdict_label(statement.detected, statement.rule);
+            found->second.candidate = shadow_screen_detail::verdict_label(verdict.detected, verdict.rule);
+        }
+        ++found->second.count;
+    }
+};
@@ -0,0 +1,297 @@
+// simd_scanner.h : Vectorized prefilter for the tautology detector.
+//
+// One pass over the statement in 16 (SSE2) or 32 (AVX2) byte blocks marks every byte that can
+// change how the rest of the statement is read: quote and bracket characters, comment starts and
+// ends, newlines, and o/O (folded to lower case in the same compare) as the possible start of OR.
+// The positions of those bytes are written to a compact list and the tautology check walks only
+// that list, running the lexer just at the OR keywords that are outside literals and comments.
+//
+// The widest instruction set the CPU supports is picked at runtime, with a scalar fallback on
+// other CPUs and architectures.
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "tautology_detector.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SQL_SCAN_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SQL_SCAN_TARGET_AVX2
+#else
+#define SQL_SCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace sql_scan_detail
+{
+    inline bool is_marker(char c) noexcept
+    {
+        switch (c)
+        {
+        case '\'': case '"': case '`': case '[': case ']':
+        case '-': case '/': case '*': case '\n': case 'o': case 'O':
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    inline void scan_scalar(const char* data, size_t begin, size_t end, std::vector<uint32_t>& positions)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            if (is_marker(data[i]))
+            {
+                positions.push_back(static_cast<uint32_t>(i));
+            }
+        }
+    }
+
+#if defined(SQL_SCAN_X86)
+    inline unsigned lowest_bit(uint32_t mask) noexcept
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<unsigned>(index);
+#else
+        return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+    }
+
+    inline void push_mask(uint32_t mask, size_t base, std::vector<uint32_t>& positions)
+    {
+        while (mask != 0)
+        {
+            positions.push_back(static_cast<uint32_t>(base + lowest_bit(mask)));
+            mask &= mask - 1;
+        }
+    }
+
+    inline void scan_sse2(const char* data, size_t size, std::vector<uint32_t>& positions)
+    {
+        const __m128i single_quote = _mm_set1_epi8('\'');
+        const __m128i double_quote = _mm_set1_epi8('"');
+        const __m128i backtick = _mm_set1_epi8('`');
+        const __m128i open_bracket = _mm_set1_epi8('[');
+        const __m128i close_bracket = _mm_set1_epi8(']');
+        const __m128i dash = _mm_set1_epi8('-');
+        const __m128i slash = _mm_set1_epi8('/');
+        const __m128i star = _mm_set1_epi8('*');
+        const __m128i newline = _mm_set1_epi8('\n');
+        const __m128i lower_o = _mm_set1_epi8('o');
+        const __m128i case_bit = _mm_set1_epi8(0x20);
+
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16)
+        {
+            const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            __m128i hits = _mm_cmpeq_epi8(_mm_or_si128(block, case_bit), lower_o);
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, single_quote));
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, double_quote));
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, backtick));
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, open_bracket));
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, close_bracket));
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, dash));
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, slash));
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, star));
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, newline));
+            push_mask(static_cast<uint32_t>(_mm_movemask_epi8(hits)), i, positions);
+        }
+        scan_scalar(data, i, size, positions);
+    }
+
+    SQL_SCAN_TARGET_AVX2 inline void scan_avx2(const char* data, size_t size, std::vector<uint32_t>& positions)
+    {
+        const __m256i single_quote = _mm256_set1_epi8('\'');
+        const __m256i double_quote = _mm256_set1_epi8('"');
+        const __m256i backtick = _mm256_set1_epi8('`');
+        const __m256i open_bracket = _mm256_set1_epi8('[');
+        const __m256i close_bracket = _mm256_set1_epi8(']');
+        const __m256i dash = _mm256_set1_epi8('-');
+        const __m256i slash = _mm256_set1_epi8('/');
+        const __m256i star = _mm256_set1_epi8('*');
+        const __m256i newline = _mm256_set1_epi8('\n');
+        const __m256i lower_o = _mm256_set1_epi8('o');
+        const __m256i case_bit = _mm256_set1_epi8(0x20);
+
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32)
+        {
+            const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            __m256i hits = _mm256_cmpeq_epi8(_mm256_or_si256(block, case_bit), lower_o);
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, single_quote));
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, double_quote));
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, backtick));
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, open_bracket));
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, close_bracket));
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, dash));
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, slash));
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, star));
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, newline));
+            push_mask(static_cast<uint32_t>(_mm256_movemask_epi8(hits)), i, positions);
+        }
+        const size_t tail_start = positions.size();
+        scan_sse2(data + i, size - i, positions);
+        // scan_sse2 numbered the tail from zero, shift it back to statement offsets
+        for (size_t p = tail_start; p < positions.size(); ++p)
+        {
+            positions[p] += static_cast<uint32_t>(i);
+        }
+    }
+
+    inline bool cpu_has_avx2() noexcept
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+        __cpuid(info, 1);
+        // the OS must save the YMM registers (OSXSAVE and XCR0 bits 1 and 2)
+        if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 0x6) != 0x6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }
+#endif
+
+    typedef void (*scan_function)(const char*, size_t, std::vector<uint32_t>&);
+
+    inline void scan_portable(const char* data, size_t size, std::vector<uint32_t>& positions)
+    {
+        scan_scalar(data, 0, size, positions);
+    }
+
+    inline scan_function select_scan() noexcept
+    {
+#if defined(SQL_SCAN_X86)
+        return cpu_has_avx2() ? scan_avx2 : scan_sse2;
+#else
+        return scan_portable;
+#endif
+    }
+
+    inline bool is_word_char(char c) noexcept
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+            c == '_' || c == '$' || static_cast<unsigned char>(c) >= 0x80;
+    }
+}
+
+// name of the scanner picked for this CPU: "avx2", "sse2" or "scalar"
+inline const char* sql_scan_isa() noexcept
+{
+#if defined(SQL_SCAN_X86)
+    return sql_scan_detail::cpu_has_avx2() ? "avx2" : "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+// fills positions with the offset of every byte that may start or end a literal, identifier
+//  quote or comment, or start an OR keyword
+inline void scan_sql_markers(std::string_view sql, std::vector<uint32_t>& positions)
+{
+    static const sql_scan_detail::scan_function scan = sql_scan_detail::select_scan();
+    positions.clear();
+    scan(sql.data(), sql.size(), positions);
+}
+
+// the same verdicts as detect_tautology, found by walking the marker positions instead of every byte.
+//  positions is scratch space, pass the same vector in to avoid allocating.
+inline tautology_verdict detect_tautology_simd(std::string_view sql, std::vector<uint32_t>& positions)
+{
+    using sql_scan_detail::is_word_char;
+
+    tautology_verdict verdict;
+    scan_sql_markers(sql, positions);
+
+    enum { normal, single_quoted, double_quoted, backtick_quoted, bracketed, line_comment, block_comment } state = normal;
+    const size_t size = sql.size();
+
+    for (size_t k = 0; k < positions.size(); ++k)
+    {
+        const size_t p = positions[k];
+        const char c = sql[p];
+        const char next = p + 1 < size ? sql[p + 1] : '\0';
+
+        switch (state)
+        {
+        case single_quoted:
+            if (c == '\'') state = normal;
+            continue;
+        case double_quoted:
+            if (c == '"') state = normal;
+            continue;
+        case backtick_quoted:
+            if (c == '`') state = normal;
+            continue;
+        case bracketed:
+            if (c == ']') state = normal;
+            continue;
+        case line_comment:
+            if (c == '\n') state = normal;
+            continue;
+        case block_comment:
+            if (c == '*' && next == '/')
+            {
+                state = normal;
+                // the closing slash is also a marker, step over it
+                ++k;
+            }
+            continue;
+        case normal:
+            break;
+        }
+
+        switch (c)
+        {
+        case '\'': state = single_quoted; break;
+        case '"': state = double_quoted; break;
+        case '`': state = backtick_quoted; break;
+        case '[': state = bracketed; break;
+        case '-':
+            if (next == '-') { state = line_comment; ++k; }
+            break;
+        case '/':
+            if (next == '*') { state = block_comment; ++k; }
+            break;
+        case 'o': case 'O':
+            if ((next == 'r' || next == 'R') && (p == 0 || !is_word_char(sql[p - 1])) &&
+                (p + 2 >= size || !is_word_char(sql[p + 2])))
+            {
+                // an OR keyword in open text, parse the comparison that follows it
+                sql_lexer lexer(sql.substr(p + 2));
+                sql_token lhs, op, rhs;
+                if (tautology_detail::read_or_operand(lexer, lhs, op, rhs) && tautology_detail::is_always_true(lhs, op, rhs))
+                {
+                    verdict.detected = true;
+                    verdict.lhs = lhs.text;
+                    verdict.op = op.text;
+                    verdict.rhs = rhs.text;
+                    return verdict;
+                }
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    return verdict;
+}
+
+// detect_tautology_simd with a per-thread scratch list
+inline tautology_verdict detect_tautology_simd(std::string_view sql)
+{
+    static thread_local std::vector<uint32_t> positions;
+    return detect_tautology_simd(sql, positions);
+}
@@ -0,0 +1,292 @@
+// sql_lexer.h : Single-pass SQL tokenizer used by the injection detector.
+//
+// The lexer walks a std::string_view once and hands out tokens that point back into the
+// original statement, so screening a query never copies or allocates.
+
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+enum class sql_token_kind
+{
+    end,                // no more input
+    identifier,         // bare word (keywords are identifiers too, see sql_token::is_keyword)
+    quoted_identifier,  // "name", `name` or [name]
+    number,             // 42, 3.14, .5, 1e10, 0x1F
+    string_literal,     // 'text' with '' as the escape for a quote
+    blob_literal,       // X'4142', a blob written in hex
+    op,                 // = == != <> < <= > >= and the arithmetic/bitwise operators
+    punctuation,        // ( ) , ; .
+    comment,            // -- line comment or /* block comment */
+    unknown             // anything else, one character at a time
+};
+
+struct sql_token
+{
+    sql_token_kind kind = sql_token_kind::end;
+    std::string_view text;
+    size_t offset = 0;
+
+    // case-insensitive keyword match, keyword must be given in lower case
+    bool is_keyword(std::string_view keyword) const noexcept
+    {
+        if (kind != sql_token_kind::identifier || text.size() != keyword.size())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            char c = text[i];
+            if (c >= 'A' && c <= 'Z')
+            {
+                c = static_cast<char>(c - 'A' + 'a');
+            }
+            if (c != keyword[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool is_op(std::string_view symbol) const noexcept
+    {
+        return kind == sql_token_kind::op && text == symbol;
+    }
+};
+
+class sql_lexer
+{
+public:
+    explicit sql_lexer(std::string_view sql) noexcept : sql(sql) {}
+
+    // returns the next token, including comments
+    sql_token next() noexcept
+    {
+        skip_whitespace();
+
+        sql_token token;
+        token.offset = pos;
+        if (pos >= sql.size())
+        {
+            token.text = sql.substr(sql.size());
+            return token;
+        }
+
+        const size_t start = pos;
+        const char c = sql[pos];
+        const char n = peek(1);
+
+        if (c == '-' && n == '-')
+        {
+            while (pos < sql.size() && sql[pos] != '\n')
+            {
+                ++pos;
+            }
+            token.kind = sql_token_kind::comment;
+        }
+        else if (c == '/' && n == '*')
+        {
+            pos += 2;
+            while (pos < sql.size() && !(sql[pos] == '*' && peek(1) == '/'))
+            {
+                ++pos;
+            }
+            // an unterminated block comment runs to the end of the statement
+            pos = pos < sql.size() ? pos + 2 : sql.size();
+            token.kind = sql_token_kind::comment;
+        }
+        else if (c == '\'')
+        {
+            skip_quoted('\'');
+            token.kind = sql_token_kind::string_literal;
+        }
+        else if ((c == 'x' || c == 'X') && n == '\'')
+        {
+            ++pos;
+            skip_quoted('\'');
+            token.kind = sql_token_kind::blob_literal;
+        }
+        else if (c == '"' || c == '`')
+        {
+            skip_quoted(c);
+            token.kind = sql_token_kind::quoted_identifier;
+        }
+        else if (c == '[')
+        {
+            while (pos < sql.size() && sql[pos] != ']')
+            {
+                ++pos;
+            }
+            pos = pos < sql.size() ? pos + 1 : sql.size();
+            token.kind = sql_token_kind::quoted_identifier;
+        }
+        else if (is_digit(c) || (c == '.' && is_digit(n)))
+        {
+            scan_number();
+            token.kind = sql_token_kind::number;
+        }
+        else if (is_identifier_start(c))
+        {
+            while (pos < sql.size() && is_identifier_char(sql[pos]))
+            {
+                ++pos;
+            }
+            token.kind = sql_token_kind::identifier;
+        }
+        else if (c == '(' || c == ')' || c == ',' || c == ';' || c == '.')
+        {
+            ++pos;
+            token.kind = sql_token_kind::punctuation;
+        }
+        else if (is_operator_char(c))
+        {
+            // two character operators first: == != <> <= >= || << >>
+            if ((n == '=' && (c == '=' || c == '!' || c == '<' || c == '>')) ||
+                (c == '<' && n == '>') || (c == '|' && n == '|') ||
+                (c == '<' && n == '<') || (c == '>' && n == '>'))
+            {
+                pos += 2;
+            }
+            else
+            {
+                ++pos;
+            }
+            token.kind = sql_token_kind::op;
+        }
+        else
+        {
+            ++pos;
+            token.kind = sql_token_kind::unknown;
+        }
+
+        token.text = sql.substr(start, pos - start);
+        return token;
+    }
+
+    // returns the next token that is not a comment
+    sql_token next_significant() noexcept
+    {
+        sql_token token = next();
+        while (token.kind == sql_token_kind::comment)
+        {
+            token = next();
+        }
+        return token;
+    }
+
+private:
+    std::string_view sql;
+    size_t pos = 0;
+
+    static bool is_digit(char c) noexcept { return c >= '0' && c <= '9'; }
+
+    static bool is_identifier_start(char c) noexcept
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
+            static_cast<unsigned char>(c) >= 0x80;
+    }
+
+    static bool is_identifier_char(char c) noexcept
+    {
+        return is_identifier_start(c) || is_digit(c) || c == '$';
+    }
+
+    static bool is_operator_char(char c) noexcept
+    {
+        switch (c)
+        {
+        case '=': case '!': case '<': case '>': case '+': case '-':
+        case '*': case '/': case '%': case '&': case '|': case '~':
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    char peek(size_t ahead) const noexcept
+    {
+        return pos + ahead < sql.size() ? sql[pos + ahead] : '\0';
+    }
+
+    void skip_whitespace() noexcept
+    {
+        while (pos < sql.size())
+        {
+            const char c = sql[pos];
+            if (c != ' ' && c != '\t' && c != '\n' && c != '\r' && c != '\f' && c != '\v')
+            {
+                break;
+            }
+            ++pos;
+        }
+    }
+
+    // skips a quoted run where a doubled quote character is an escaped quote
+    void skip_quoted(char quote) noexcept
+    {
+        ++pos;
+        while (pos < sql.size())
+        {
+            if (sql[pos] == quote)
+            {
+                if (peek(1) == quote)
+                {
+                    pos += 2;
+                    continue;
+                }
+                ++pos;
+                return;
+            }
+            ++pos;
+        }
+    }
+
+    void scan_number() noexcept
+    {
+        if (sql[pos] == '0' && (peek(1) == 'x' || peek(1) == 'X'))
+        {
+            pos += 2;
+            while (pos < sql.size() && (is_digit(sql[pos]) ||
+                (sql[pos] >= 'a' && sql[pos] <= 'f') || (sql[pos] >= 'A' && sql[pos] <= 'F')))
+            {
+                ++pos;
+            }
+            skip_malformed_suffix();
+            return;
+        }
+
+        while (pos < sql.size() && (is_digit(sql[pos]) || sql[pos] == '.'))
+        {
+            ++pos;
+        }
+        if (pos < sql.size() && (sql[pos] == 'e' || sql[pos] == 'E'))
+        {
+            size_t exponent = pos + 1;
+            if (exponent < sql.size() && (sql[exponent] == '+' || sql[exponent] == '-'))
+            {
+                ++exponent;
+            }
+            if (exponent < sql.size() && is_digit(sql[exponent]))
+            {
+                pos = exponent;
+                while (pos < sql.size() && is_digit(sql[pos]))
+                {
+                    ++pos;
+                }
+            }
+        }
+        skip_malformed_suffix();
+    }
+
+    // SQLite rejects a number run straight into a word (1or, 2abc), keep it as one token so the
+    //  word is not mistaken for a keyword
+    void skip_malformed_suffix() noexcept
+    {
+        while (pos < sql.size() && is_identifier_char(sql[pos]))
+        {
+            ++pos;
+        }
+    }
+};
@@ -0,0 +1,149 @@
+// sql_shape.h : Reduces a SQL statement to its "shape", the statement with every literal
+//  replaced by a ? placeholder, every comment replaced by /**/, whitespace collapsed and bare words
+//  in lower case.
+//
+//  SELECT ID FROM USERS WHERE NAME='Fred'   and   select id from users where name = 'Wilma'
+//  both have the shape   select id from users where name = ?
+//
+// A comment keeps its marker so a statement cut short by one never shares the shape, and so the
+// cached verdict, of the statement without it: NAME='Fred' --' AND ... has the shape
+// ... name = ? /**/. The text of the comment is dropped, all comments look the same.
+//
+// The literals that were taken out are returned in order so they can be bound to the placeholders.
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "sql_lexer.h"
+
+// shape and literals are cleared and refilled, pass the same objects in to reuse their storage
+inline void normalize_sql_shape(std::string_view sql, std::string& shape, std::vector<sql_token>& literals)
+{
+    shape.clear();
+    literals.clear();
+
+    sql_lexer lexer(sql);
+    sql_token previous;
+    // numbers after ORDER BY / GROUP BY are column positions, not values, so they stay in the shape
+    bool in_ordering = false;
+
+    for (sql_token token = lexer.next(); token.kind != sql_token_kind::end; token = lexer.next())
+    {
+        if (token.kind == sql_token_kind::comment)
+        {
+            // a line comment would swallow the rest of the shape, /**/ ends where it starts
+            shape.append(shape.empty() ? "/**/" : " /**/");
+            continue;
+        }
+
+        if (token.is_keyword("by") && (previous.is_keyword("order") || previous.is_keyword("group")))
+        {
+            in_ordering = true;
+        }
+        else if (token.kind == sql_token_kind::identifier && in_ordering &&
+            (token.is_keyword("limit") || token.is_keyword("having") || token.is_keyword("union") ||
+             token.is_keyword("window") || token.is_keyword("offset")))
+        {
+            in_ordering = false;
+        }
+        else if (token.kind == sql_token_kind::punctuation && token.text == ";")
+        {
+            in_ordering = false;
+        }
+
+        if (!shape.empty())
+        {
+            shape.push_back(' ');
+        }
+
+        const bool is_value = token.kind == sql_token_kind::string_literal || token.kind == sql_token_kind::blob_literal ||
+            (token.kind == sql_token_kind::number && !in_ordering);
+        if (is_value)
+        {
+            shape.push_back('?');
+            literals.push_back(token);
+        }
+        else if (token.kind == sql_token_kind::identifier)
+        {
+            for (char c : token.text)
+            {
+                shape.push_back((c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c);
+            }
+        }
+        else
+        {
+            shape.append(token.text.data(), token.text.size());
+        }
+
+        previous = token;
+    }
+}
+
+// the value of a string literal token: the quotes dropped and every '' collapsed into '.
+//  value is a std::string or a std::pmr::string.
+template <class String>
+inline void string_literal_value(std::string_view literal, String& value)
+{
+    value.clear();
+    literal.remove_prefix(1);
+    if (!literal.empty() && literal.back() == '\'')
+    {
+        literal.remove_suffix(1);
+    }
+    for (size_t c = 0; c < literal.size(); ++c)
+    {
+        value.push_back(literal[c]);
+        if (literal[c] == '\'' && c + 1 < literal.size() && literal[c + 1] == '\'')
+        {
+            ++c;
+        }
+    }
+}
+
+// the bytes of a blob literal token, false if it is not an even number of hex digits in closed quotes
+template <class String>
+inline bool blob_literal_value(std::string_view literal, String& bytes)
+{
+    bytes.clear();
+    if (literal.size() < 3 || literal.back() != '\'' || (literal.size() - 3) % 2 != 0)
+    {
+        return false;
+    }
+    auto digit = [](char c) -> int
+    {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    for (size_t c = 2; c + 1 < literal.size(); c += 2)
+    {
+        const int high = digit(literal[c]);
+        const int low = digit(literal[c + 1]);
+        if (high < 0 || low < 0)
+        {
+            return false;
+        }
+        bytes.push_back(static_cast<char>(high * 16 + low));
+    }
+    return true;
+}
+
+// a statement reduced to its shape, with the hash of the shape and the literals taken out of it.
+//  Compute it once and hand it to every stage keyed by shape.
+struct sql_fingerprint
+{
+    std::string shape;
+    std::vector<sql_token> literals;
+    size_t hash = 0;
+
+    void compute(std::string_view sql)
+    {
+        normalize_sql_shape(sql, shape, literals);
+        hash = std::hash<std::string>()(shape);
+    }
+};
@@ -0,0 +1,237 @@
+// statement_cache.h : LRU cache of prepared sqlite3_stmt handles keyed by statement shape.
+//
+// A statement is normalized with normalize_sql_shape, the shape is prepared once, and the literals
+// from the original text are bound with sqlite3_bind_* on every use. Repeat shapes skip
+// sqlite3_prepare entirely, and the literal text is never spliced back into the SQL. The unescaped
+// literal values only live until sqlite3_bind_* has copied them, so they come from the query arena.
+//
+// Only DML goes through the cache (is_cacheable), other statements take no parameters. SQLite also
+// refuses a parameter in a few places a DML literal can be, so prepare returns NULL for those and
+// the caller runs the statement text with sqlite3_exec instead, as it would without the cache.
+
+#pragma once
+
+#include <charconv>
+#include <cstdlib>
+#include <list>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "query_arena.h"
+#include "sqlite3.h"
+#include "sql_shape.h"
+
+class statement_cache
+{
+public:
+    explicit statement_cache(sqlite3* db, size_t capacity = 64) : db(db), max_entries(capacity == 0 ? 1 : capacity) {}
+
+    ~statement_cache()
+    {
+        clear();
+    }
+
+    statement_cache(const statement_cache&) = delete;
+    statement_cache& operator=(const statement_cache&) = delete;
+
+    // returns a statement with the literals of sql bound and ready for sqlite3_step, or NULL if
+    //  the statement could not be prepared (last_error has the reason). The handle stays owned
+    //  by the cache and is only valid until the next call to prepare.
+    sqlite3_stmt* prepare(std::string_view sql)
+    {
+        fingerprint.compute(sql);
+        return prepare(fingerprint);
+    }
+
+    // true if statement is DML, a SELECT, INSERT, UPDATE, DELETE, REPLACE, WITH or VALUES. Anything
+    //  else, like CREATE TABLE T(A TEXT DEFAULT 'x') or PRAGMA journal_mode='memory', should be run
+    //  with sqlite3_exec.
+    static bool is_cacheable(const sql_fingerprint& statement) noexcept
+    {
+        sql_lexer lexer(statement.shape);
+        const sql_token first = lexer.next_significant();
+        return first.is_keyword("select") || first.is_keyword("insert") || first.is_keyword("update") ||
+            first.is_keyword("delete") || first.is_keyword("replace") || first.is_keyword("with") || first.is_keyword("values");
+    }
+
+    // prepare for a statement that has already been fingerprinted
+    sqlite3_stmt* prepare(const sql_fingerprint& statement)
+    {
+        error = NULL;
+        const std::string& shape = statement.shape;
+
+        sqlite3_stmt* stmt = NULL;
+        auto found = index.find(shape);
+        if (found != index.end())
+        {
+            ++hit_count;
+            // move to the front of the LRU list
+            entries.splice(entries.begin(), entries, found->second);
+            stmt = found->second->second;
+            sqlite3_reset(stmt);
+            sqlite3_clear_bindings(stmt);
+        }
+        else
+        {
+            ++miss_count;
+            const char* tail = NULL;
+            if (sqlite3_prepare_v2(db, shape.c_str(), static_cast<int>(shape.size() + 1), &stmt, &tail) != SQLITE_OK)
+            {
+                error = sqlite3_errmsg(db);
+                return NULL;
+            }
+            if (stmt == NULL || !is_blank(tail))
+            {
+                // empty statements and stacked statements are never cached or run
+                sqlite3_finalize(stmt);
+                error = stmt == NULL ? "empty statement" : "multiple statements are not allowed";
+                return NULL;
+            }
+
+            if (entries.size() >= max_entries)
+            {
+                evict_oldest();
+            }
+            entries.emplace_front(shape, stmt);
+            index.emplace(entries.front().first, entries.begin());
+        }
+
+        if (!bind_literals(stmt, statement.literals))
+        {
+            sqlite3_reset(stmt);
+            error = "failed to bind statement literals";
+            return NULL;
+        }
+        return stmt;
+    }
+
+    // resets a statement returned by prepare so it releases its read locks before the next use
+    void finish(sqlite3_stmt* stmt)
+    {
+        if (stmt != NULL)
+        {
+            sqlite3_reset(stmt);
+        }
+    }
+
+    // finalizes every cached statement, must be called (or the cache destroyed) before sqlite3_close
+    void clear()
+    {
+        for (auto& entry : entries)
+        {
+            sqlite3_finalize(entry.second);
+        }
+        entries.clear();
+        index.clear();
+    }
+
+    // reason the last call to prepare returned NULL
+    const char* last_error() const { return error != NULL ? error : sqlite3_errmsg(db); }
+
+    size_t hits() const { return hit_count; }
+    size_t misses() const { return miss_count; }
+    size_t evictions() const { return eviction_count; }
+    size_t size() const { return entries.size(); }
+    size_t capacity() const { return max_entries; }
+
+private:
+    typedef std::list< std::pair<std::string, sqlite3_stmt*> > entry_list;
+
+    sqlite3* db;
+    size_t max_entries;
+    entry_list entries; // most recently used first
+    std::unordered_map<std::string, entry_list::iterator> index;
+
+    size_t hit_count = 0;
+    size_t miss_count = 0;
+    size_t eviction_count = 0;
+    const char* error = NULL;
+
+    // scratch space reused across calls
+    sql_fingerprint fingerprint;
+
+    static bool is_blank(const char* text)
+    {
+        for (; text != NULL && *text != '\0'; ++text)
+        {
+            if (*text != ' ' && *text != '\t' && *text != '\n' && *text != '\r' && *text != '\f' && *text != '\v')
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void evict_oldest()
+    {
+        auto& oldest = entries.back();
+        index.erase(oldest.first);
+        sqlite3_finalize(oldest.second);
+        entries.pop_back();
+        ++eviction_count;
+    }
+
+    bool bind_literals(sqlite3_stmt* stmt, const std::vector<sql_token>& literals)
+    {
+        if (sqlite3_bind_parameter_count(stmt) != static_cast<int>(literals.size()))
+        {
+            return false;
+        }
+
+        query_arena_scope scratch;
+        std::pmr::string unescaped(query_arena_scope::resource());
+        for (size_t i = 0; i < literals.size(); ++i)
+        {
+            const int slot = static_cast<int>(i + 1);
+            std::string_view text = literals[i].text;
+            int result = SQLITE_OK;
+
+            if (literals[i].kind == sql_token_kind::string_literal)
+            {
+                string_literal_value(text, unescaped);
+                result = sqlite3_bind_text(stmt, slot, unescaped.data(), static_cast<int>(unescaped.size()), SQLITE_TRANSIENT);
+            }
+            else if (literals[i].kind == sql_token_kind::blob_literal)
+            {
+                if (!blob_literal_value(text, unescaped))
+                {
+                    return false;
+                }
+                result = sqlite3_bind_blob(stmt, slot, unescaped.data(), static_cast<int>(unescaped.size()), SQLITE_TRANSIENT);
+            }
+            else
+            {
+                long long integer = 0;
+                const char* first = text.data();
+                const char* last = text.data() + text.size();
+                int base = 10;
+                if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X'))
+                {
+                    first += 2;
+                    base = 16;
+                }
+                auto parsed = std::from_chars(first, last, integer, base);
+                if (parsed.ec == std::errc() && parsed.ptr == last)
+                {
+                    result = sqlite3_bind_int64(stmt, slot, integer);
+                }
+                else
+                {
+                    // reals and integers too large for 64 bits
+                    unescaped.assign(text.data(), text.size());
+                    result = sqlite3_bind_double(stmt, slot, std::strtod(unescaped.c_str(), NULL));
+                }
+            }
+
+            if (result != SQLITE_OK)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,278 @@
+// tautology_detector.h : Detects always-true OR clauses (OR 1=1, OR 'a'='a', OR x=x, OR 1<2,
+//  OR (1=1), OR TRUE) in a SQL statement before it is handed to SQLite.
+//
+// detect_tautology makes one pass over the statement with sql_lexer and never allocates.
+// detect_tautology_legacy is the original copy/lowercase/find scan from run_query, kept so
+// the two can be compared side by side.
+
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+#include "sql_lexer.h"
+
+struct tautology_verdict
+{
+    bool detected = false;
+    // the offending comparison, pointing into the screened statement
+    std::string_view lhs;
+    std::string_view op;
+    std::string_view rhs;
+};
+
+namespace tautology_detail
+{
+    inline bool is_comparison(const sql_token& token) noexcept
+    {
+        return token.is_op("=") || token.is_op("==") || token.is_op("!=") || token.is_op("<>") ||
+            token.is_op("<") || token.is_op("<=") || token.is_op(">") || token.is_op(">=");
+    }
+
+    // applies a comparison operator to the result of a three way compare
+    inline bool holds(std::string_view op, int order) noexcept
+    {
+        if (op == "=" || op == "==") return order == 0;
+        if (op == "!=" || op == "<>") return order != 0;
+        if (op == "<") return order < 0;
+        if (op == "<=") return order <= 0;
+        if (op == ">") return order > 0;
+        if (op == ">=") return order >= 0;
+        return false;
+    }
+
+    inline bool parse_number(std::string_view text, double& value) noexcept
+    {
+        if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X'))
+        {
+            long long hex = 0;
+            auto result = std::from_chars(text.data() + 2, text.data() + text.size(), hex, 16);
+            value = static_cast<double>(hex);
+            return result.ec == std::errc() && result.ptr == text.data() + text.size();
+        }
+        // plain integers are by far the common case and avoid the slower floating point parse
+        long long integer = 0;
+        auto result = std::from_chars(text.data(), text.data() + text.size(), integer);
+        if (result.ec == std::errc() && result.ptr == text.data() + text.size())
+        {
+            value = static_cast<double>(integer);
+            return true;
+        }
+        result = std::from_chars(text.data(), text.data() + text.size(), value);
+        return result.ec == std::errc() && result.ptr == text.data() + text.size();
+    }
+
+    // strips the surrounding quotes from a literal, tolerating an unterminated literal
+    inline std::string_view unquote(std::string_view text) noexcept
+    {
+        text.remove_prefix(1);
+        if (!text.empty() && text.back() == '\'')
+        {
+            text.remove_suffix(1);
+        }
+        return text;
+    }
+
+    // byte-wise three way compare of two string literal bodies, treating '' as a single quote
+    inline int compare_literals(std::string_view a, std::string_view b) noexcept
+    {
+        a = unquote(a);
+        b = unquote(b);
+        size_t i = 0;
+        size_t j = 0;
+        while (i < a.size() && j < b.size())
+        {
+            const unsigned char ca = static_cast<unsigned char>(a[i]);
+            const unsigned char cb = static_cast<unsigned char>(b[j]);
+            if (ca != cb)
+            {
+                return ca < cb ? -1 : 1;
+            }
+            i += (a[i] == '\'' && i + 1 < a.size()) ? 2 : 1;
+            j += (b[j] == '\'' && j + 1 < b.size()) ? 2 : 1;
+        }
+        if (i < a.size()) return 1;
+        if (j < b.size()) return -1;
+        return 0;
+    }
+
+    inline bool same_identifier(std::string_view a, std::string_view b) noexcept
+    {
+        if (a.size() != b.size())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            char ca = a[i];
+            char cb = b[i];
+            if (ca >= 'A' && ca <= 'Z') ca = static_cast<char>(ca - 'A' + 'a');
+            if (cb >= 'A' && cb <= 'Z') cb = static_cast<char>(cb - 'A' + 'a');
+            if (ca != cb)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    inline bool is_punctuation(const sql_token& token, char symbol) noexcept
+    {
+        return token.kind == sql_token_kind::punctuation && token.text.size() == 1 && token.text[0] == symbol;
+    }
+
+    // reads the condition after an OR keyword: a comparison, inside any number of balanced
+    //  parentheses as in OR (1=1), or a bare TRUE, which leaves op and rhs as end tokens. Returns
+    //  false for anything else.
+    inline bool read_or_operand(sql_lexer& lexer, sql_token& lhs, sql_token& op, sql_token& rhs) noexcept
+    {
+        size_t depth = 0;
+        lhs = lexer.next_significant();
+        while (is_punctuation(lhs, '('))
+        {
+            ++depth;
+            lhs = lexer.next_significant();
+        }
+        op = lexer.next_significant();
+        rhs = sql_token();
+        if (is_comparison(op))
+        {
+            rhs = lexer.next_significant();
+        }
+        else if (lhs.is_keyword("true"))
+        {
+            if (depth > 0 && !is_punctuation(op, ')'))
+            {
+                return false;
+            }
+            depth -= depth > 0 ? 1 : 0;
+            op = sql_token();
+        }
+        else
+        {
+            return false;
+        }
+
+        for (; depth > 0; --depth)
+        {
+            if (!is_punctuation(lexer.next_significant(), ')'))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // decides whether "lhs op rhs" is true regardless of the row being looked at, a bare TRUE
+    //  comes with op and rhs as end tokens
+    inline bool is_always_true(const sql_token& lhs, const sql_token& op, const sql_token& rhs) noexcept
+    {
+        if (op.kind == sql_token_kind::end)
+        {
+            return lhs.is_keyword("true");
+        }
+
+        if (lhs.kind == sql_token_kind::number && rhs.kind == sql_token_kind::number)
+        {
+            double left = 0;
+            double right = 0;
+            if (!parse_number(lhs.text, left) || !parse_number(rhs.text, right))
+            {
+                return false;
+            }
+            return holds(op.text, left < right ? -1 : (left > right ? 1 : 0));
+        }
+
+        if (lhs.kind == sql_token_kind::string_literal && rhs.kind == sql_token_kind::string_literal)
+        {
+            return holds(op.text, compare_literals(lhs.text, rhs.text));
+        }
+
+        const bool lhs_column = lhs.kind == sql_token_kind::identifier || lhs.kind == sql_token_kind::quoted_identifier;
+        const bool rhs_column = rhs.kind == sql_token_kind::identifier || rhs.kind == sql_token_kind::quoted_identifier;
+        if (lhs_column && rhs_column && same_identifier(lhs.text, rhs.text))
+        {
+            // a column compared with itself
+            return holds(op.text, 0);
+        }
+
+        return false;
+    }
+}
+
+// single pass, allocation free screening of a statement
+inline tautology_verdict detect_tautology(std::string_view sql) noexcept
+{
+    tautology_verdict verdict;
+    sql_lexer lexer(sql);
+
+    for (sql_token token = lexer.next_significant(); token.kind != sql_token_kind::end; token = lexer.next_significant())
+    {
+        if (!token.is_keyword("or"))
+        {
+            continue;
+        }
+
+        // read the comparison on a copy so scanning resumes right after the OR if it is not one
+        sql_lexer lookahead = lexer;
+        sql_token lhs, op, rhs;
+        if (!tautology_detail::read_or_operand(lookahead, lhs, op, rhs))
+        {
+            continue;
+        }
+
+        if (tautology_detail::is_always_true(lhs, op, rhs))
+        {
+            verdict.detected = true;
+            verdict.lhs = lhs.text;
+            verdict.op = op.text;
+            verdict.rhs = rhs.text;
+            return verdict;
+        }
+    }
+
+    return verdict;
+}
+
+// the original run_query detector: lowercase a copy, find " where ", " or ", "=" and ";",
+//  then compare the trimmed text on either side of the "=". The copies come from scratch, pass
+//  query_arena_scope::resource() to keep them off the heap.
+inline bool detect_tautology_legacy(std::string_view sql, std::pmr::memory_resource* scratch = std::pmr::get_default_resource())
+{
+    const std::string_view str_where = " where ";
+
+    std::pmr::string sql_lower(sql.begin(), sql.end(), scratch);
+    std::transform(sql_lower.begin(), sql_lower.end(), sql_lower.begin(), ::tolower);
+
+    size_t where_pos = sql_lower.find(str_where);
+
+    if (where_pos != std::string::npos) {
+        size_t or_pos = sql_lower.find(" or ", where_pos);
+
+        if (or_pos != std::string::npos) {
+            size_t eq_pos = sql_lower.find("=", or_pos);
+
+            if (eq_pos != std::string::npos) {
+                std::pmr::string left_part(sql_lower, or_pos + 4, eq_pos - (or_pos + 4), scratch);
+
+                size_t end_pos = sql_lower.find(";", eq_pos);
+                if (end_pos == std::string::npos) {
+                    end_pos = sql_lower.length();
+                }
+                std::pmr::string right_part(sql_lower, eq_pos + 1, end_pos - (eq_pos + 1), scratch);
+
+                left_part.erase(0, left_part.find_first_not_of(" \t\n\r\f\v"));
+                left_part.erase(left_part.find_last_not_of(" \t\n\r\f\v") + 1);
+                right_part.erase(0, right_part.find_first_not_of(" \t\n\r\f\v"));
+                right_part.erase(right_part.find_last_not_of(" \t\n\r\f\v") + 1);
+
+                return left_part == right_part;
+            }
+        }
+    }
+
+    return false;
+}
@@ -2,9 +2,71 @@
 #include "pch.h"
 // uncomment the next line if you do not use precompiled headers
 //#include "gtest/gtest.h"
-//
-// the global test environment setup and tear down
-// you should not need to change anything here
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <limits>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "async_query.h"
+#include "batch_divide.h"
+#include "bulk_loader.h"
+#include "error_paths.h"
+#include "fast_random.h"
+#include "fixed_string.h"
+#include "index_manager.h"
+#include "injection_rules.h"
+#include "line_reader.h"
+#include "load_test.h"
+#include "log_ingest.h"
+#include "output_sink.h"
+#include "query_arena.h"
+#include "shadow_screen.h"
+#include "simd_scanner.h"
+#include "statement_cache.h"
+#include "tautology_detector.h"
+#include "user_cache.h"
+#include "verdict_cache.h"
+
+// this file replaces operator new and delete with the counting versions
+#define ALLOCATION_TRACKER_REPLACE_NEW
+#include "allocation_tracker.h"
+
+// counts the heap allocations each test makes on its thread and records them with the test
+//  results as heap_allocations
+class AllocationListener : public ::testing::EmptyTestEventListener
+{
+public:
+    void OnTestStart(const ::testing::TestInfo&) override
+    {
+        test_scope().reset();
+    }
+
+    void OnTestEnd(const ::testing::TestInfo&) override
+    {
+        ::testing::Test::RecordProperty("heap_allocations", std::to_string(test_scope().allocations()));
+    }
+
+    // allocations since the current test started, including its fixture's SetUp
+    static allocation_scope& test_scope()
+    {
+        static allocation_scope scope;
+        return scope;
+    }
+};
+
+// the global test environment setup and tear down: seeds rand() and adds the AllocationListener
 class Environment : public ::testing::Environment
 {
 public:
@@ -15,12 +77,25 @@ public:
     {
         //  initialize random seed
         srand(time(nullptr));
+
+        // scope the allocation counts to each test. SetUp runs again for every --gtest_repeat,
+        //  the listener is only added the first time.
+        if (!listening)
+        {
+            ::testing::UnitTest::GetInstance()->listeners().Append(new AllocationListener);
+            listening = true;
+        }
     }
 
     // Override this to define how to tear down the environment.
     void TearDown() override {}
+
+private:
+    bool listening = false;
 };
 
+::testing::Environment* const environment = ::testing::AddGlobalTestEnvironment(new Environment);
+
 // create our test class to house shared data between tests
 // you should not need to change anything here
 class CollectionTest : public ::testing::Test
@@ -29,13 +104,25 @@ protected:
     // create a smart point to hold our collection
     std::unique_ptr<std::vector<int>> collection;
 
+    // each test draws from its own stream of the run's seed, so a failing test can be replayed alone
+    //  with RANDOM_SEED set to the seed it reports
+    xoshiro256 random;
+
     void SetUp() override
     { // create a new collection to be used in the test
         collection.reset(new std::vector<int>);
+        const ::testing::TestInfo* test = ::testing::UnitTest::GetInstance()->current_test_info();
+        random.reseed(random_seed(), random_stream(std::string(test->test_suite_name()) + "." + test->name()));
+        RecordProperty("random_seed", std::to_string(random_seed()));
     }
 
     void TearDown() override
-    { //  erase all elements in the collection, if any remain
+    {
+        if (HasFailure())
+        {
+            std::cout << "Replay with RANDOM_SEED=" << random_seed() << std::endl;
+        }
+        //  erase all elements in the collection, if any remain
         collection->clear();
         // free the pointer
         collection.reset(nullptr);
@@ -46,7 +133,7 @@ protected:
     {
         assert(count > 0);
         for (auto i = 0; i < count; ++i)
-            collection->push_back(rand() % 100);
+            collection->push_back(static_cast<int>(random.below(100)));
     }
 };
 
@@ -304,4 +391,1788 @@ TEST_F(CollectionTest, PopBackOnEmptyCollectionDoesntCrash)
     size_t sizeBefore = collection->size();
     collection->pop_back();
     ASSERT_EQ(collection->size(), sizeBefore - 1);
-}
\ No newline at end of file
+}
+
+// scaling and concurrency tests over collections from 1 to 10^8 elements
+
+typedef std::vector<int, counting_allocator<int>> counted_collection;
+
+// the tests run from 1 element up to 10^6 by default. The 10^7 and 10^8 sizes need a few hundred MB
+//  and several seconds each, set COLLECTION_MAX_SIZE to 100000000 to run them, or lower to skip more.
+//  The timings are always recorded, but only checked against their budgets when COLLECTION_TIME_SCALE
+//  is set. The budgets are for an optimized build on a loaded machine, 1 checks them as they are and
+//  larger values multiply every budget, e.g. 20 for a debug or sanitizer build.
+class CollectionScalingTest : public CollectionTest, public ::testing::WithParamInterface<size_t>
+{
+protected:
+    typedef std::chrono::steady_clock clock;
+
+    void SetUp() override
+    {
+        CollectionTest::SetUp();
+        if (GetParam() > max_size())
+        {
+            GTEST_SKIP() << "larger than COLLECTION_MAX_SIZE, which is 1000000 unless set";
+        }
+    }
+
+    static size_t max_size()
+    {
+        const char* text = std::getenv("COLLECTION_MAX_SIZE");
+        return text != nullptr && *text != '\0' ? std::strtoull(text, nullptr, 10) : 1000000;
+    }
+
+    // the multiplier for the timing budgets, 0 when COLLECTION_TIME_SCALE is not set and they are not checked
+    static double time_scale()
+    {
+        const char* text = std::getenv("COLLECTION_TIME_SCALE");
+        return text != nullptr && *text != '\0' ? std::strtod(text, nullptr) : 0.0;
+    }
+
+    static double seconds_since(clock::time_point start)
+    {
+        return std::chrono::duration<double>(clock::now() - start).count();
+    }
+
+    // records how long an operation over count elements took and, when the budgets are checked,
+    //  fails the test if it was longer than a fixed 20 ms allowance plus ns_per_element for each element
+    void expect_within_budget(const char* operation, double seconds, size_t count, double ns_per_element)
+    {
+        RecordProperty(std::string(operation) + "_ms", std::to_string(seconds * 1e3));
+        const double scale = time_scale();
+        if (scale > 0.0)
+        {
+            const double budget = (0.020 + static_cast<double>(count) * ns_per_element * 1e-9) * scale;
+            EXPECT_LE(seconds, budget) << operation << " on " << count << " elements took " << seconds * 1e3
+                << " ms, the budget is " << budget * 1e3 << " ms";
+        }
+    }
+
+    // the most reallocations growing one element at a time to count can take when each one
+    //  multiplies the capacity by about 1.5, with a few to spare for the small capacities where
+    //  rounding down makes the step smaller
+    static size_t growth_steps(size_t count)
+    {
+        return static_cast<size_t>(std::ceil(std::log(static_cast<double>(count)) / std::log(1.5))) + 3;
+    }
+};
+
+// push_back grows the capacity geometrically, so filling costs a logarithmic number of reallocations
+TEST_P(CollectionScalingTest, PushBackGrowsCapacityGeometrically)
+{
+    const size_t count = GetParam();
+    allocation_counts counts;
+    counted_collection grown{ counting_allocator<int>(&counts) };
+
+    size_t capacity = grown.capacity();
+    double smallest_growth = std::numeric_limits<double>::max();
+    const auto start = clock::now();
+    for (size_t i = 0; i < count; ++i)
+    {
+        grown.push_back(static_cast<int>(random.below(100)));
+        if (grown.capacity() != capacity)
+        {
+            if (capacity >= 16)
+            {
+                smallest_growth = std::min(smallest_growth, static_cast<double>(grown.capacity()) / static_cast<double>(capacity));
+            }
+            capacity = grown.capacity();
+        }
+    }
+    const double seconds = seconds_since(start);
+
+    ASSERT_EQ(grown.size(), count);
+    EXPECT_GE(grown.capacity(), count);
+    // libstdc++ and libc++ double the capacity. MSVC adds half of it, rounded down, so 2 grows to 3
+    //  and 3 to 4, and the ratio is only measured from 16 up where the rounding costs less than 0.05
+    if (smallest_growth != std::numeric_limits<double>::max())
+    {
+        EXPECT_GE(smallest_growth, 1.45);
+    }
+    EXPECT_LE(counts.allocations, growth_steps(count));
+    // every buffer but the live one has been released
+    EXPECT_EQ(counts.deallocations, counts.allocations - 1);
+    EXPECT_EQ(counts.bytes, grown.capacity() * sizeof(int));
+    expect_within_budget("push_back", seconds, count, 40.0);
+}
+
+// reserve allocates once up front and filling up to the reserved capacity never reallocates
+TEST_P(CollectionScalingTest, ReserveAllocatesOnce)
+{
+    const size_t count = GetParam();
+    allocation_counts counts;
+    counted_collection reserved{ counting_allocator<int>(&counts) };
+
+    const auto start = clock::now();
+    reserved.reserve(count);
+    const size_t capacity = reserved.capacity();
+    for (size_t i = 0; i < count; ++i)
+    {
+        reserved.push_back(static_cast<int>(random.below(100)));
+    }
+    const double seconds = seconds_since(start);
+
+    ASSERT_EQ(reserved.size(), count);
+    EXPECT_GE(capacity, count);
+    EXPECT_EQ(reserved.capacity(), capacity);
+    EXPECT_EQ(counts.allocations, 1u);
+    EXPECT_EQ(counts.deallocations, 0u);
+
+    // reserving less than the capacity changes nothing
+    reserved.reserve(count / 2);
+    EXPECT_EQ(reserved.capacity(), capacity);
+    EXPECT_EQ(counts.allocations, 1u);
+
+    // clear keeps the buffer for reuse
+    reserved.clear();
+    EXPECT_EQ(reserved.capacity(), capacity);
+    EXPECT_EQ(counts.deallocations, 0u);
+    expect_within_budget("reserve_fill", seconds, count, 25.0);
+}
+
+// resize, erase and clear cost no more than one pass over the elements they touch
+TEST_P(CollectionScalingTest, ResizeEraseAndClearStayWithinBudget)
+{
+    const size_t count = GetParam();
+
+    auto start = clock::now();
+    collection->resize(count);
+    expect_within_budget("resize", seconds_since(start), count, 10.0);
+    ASSERT_EQ(collection->size(), count);
+    EXPECT_EQ(collection->front(), 0);
+    EXPECT_EQ(collection->back(), 0);
+
+    random.fill(collection->data(), collection->size(), 0, 99);
+    const size_t half = count / 2;
+    const int middle = (*collection)[half];
+    const size_t capacity = collection->capacity();
+
+    // erasing the front half moves the back half down
+    start = clock::now();
+    collection->erase(collection->begin(), collection->begin() + half);
+    expect_within_budget("erase", seconds_since(start), count, 5.0);
+    ASSERT_EQ(collection->size(), count - half);
+    EXPECT_EQ(collection->front(), middle);
+    EXPECT_EQ(collection->capacity(), capacity);
+
+    // ints need no destruction, clearing costs the same whatever the size
+    start = clock::now();
+    collection->clear();
+    expect_within_budget("clear", seconds_since(start), 0, 0.0);
+    EXPECT_TRUE(collection->empty());
+    EXPECT_EQ(collection->capacity(), capacity);
+}
+
+// readers on several threads over a collection no one writes to all see the same elements
+TEST_P(CollectionScalingTest, ConcurrentReadersSeeFrozenCollection)
+{
+    const size_t count = GetParam();
+    const size_t readers = 4;
+
+    collection->resize(count);
+    random.fill(collection->data(), collection->size(), 0, 99);
+    long long expected_sum = 0;
+    for (int value : *collection)
+    {
+        expected_sum += value;
+    }
+    const size_t expected_small = static_cast<size_t>(std::count_if(collection->begin(), collection->end(), [](int value) { return value < 50; }));
+
+    const std::vector<int>& frozen = *collection;
+    std::vector<long long> sums(readers, 0);
+    std::vector<size_t> smalls(readers, 0);
+    std::vector<std::thread> threads;
+    const auto start = clock::now();
+    for (size_t reader = 0; reader < readers; ++reader)
+    {
+        threads.emplace_back([&frozen, &sums, &smalls, reader, readers]
+        {
+            // each reader starts at a different offset and wraps around, so they read different parts at the same time
+            const size_t size = frozen.size();
+            const size_t offset = size * reader / readers;
+            long long sum = 0;
+            size_t small = 0;
+            for (size_t i = offset; i < size + offset; ++i)
+            {
+                const int value = frozen[i < size ? i : i - size];
+                sum += value;
+                small += value < 50 ? 1 : 0;
+            }
+            sums[reader] = sum;
+            smalls[reader] = small;
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    const double seconds = seconds_since(start);
+
+    for (size_t reader = 0; reader < readers; ++reader)
+    {
+        EXPECT_EQ(sums[reader], expected_sum) << "reader " << reader;
+        EXPECT_EQ(smalls[reader], expected_small) << "reader " << reader;
+    }
+    EXPECT_EQ(frozen.size(), count);
+    expect_within_budget("concurrent_read", seconds, count * readers, 5.0);
+}
+
+INSTANTIATE_TEST_SUITE_P(Sizes, CollectionScalingTest,
+    ::testing::Values(1, 10, 1000, 100000, 1000000, 10000000, 100000000),
+    [](const ::testing::TestParamInfo<size_t>& info) { return std::to_string(info.param); });
+
+// allocation budgets, counted by the operator new hooks from allocation_tracker.h
+
+TEST_F(CollectionTest, AllocationHooksCountNewAndDelete)
+{
+    ASSERT_TRUE(allocation_tracking_enabled());
+
+    allocation_scope scope;
+    std::unique_ptr<int> value(new int(42));
+    EXPECT_EQ(scope.allocations(), 1u);
+    EXPECT_EQ(scope.bytes(), sizeof(int));
+
+    value.reset();
+    EXPECT_EQ(scope.deallocations(), 1u);
+}
+
+TEST_F(CollectionTest, AddEntriesWithReserveAllocatesOnce)
+{
+    allocation_scope scope;
+    collection->reserve(1000);
+    add_entries(1000);
+
+    ASSERT_EQ(collection->size(), 1000u);
+    EXPECT_EQ(scope.allocations(), 1u);
+    EXPECT_EQ(scope.deallocations(), 0u);
+}
+
+TEST_F(CollectionTest, AddEntriesWithoutReserveReallocates)
+{
+    allocation_scope scope;
+    add_entries(1000);
+
+    // one buffer per capacity step, and geometric growth keeps the steps to log1.5(1000) + 2
+    ASSERT_EQ(collection->size(), 1000u);
+    EXPECT_GT(scope.allocations(), 1u);
+    EXPECT_LE(scope.allocations(), 20u);
+    EXPECT_EQ(scope.deallocations(), scope.allocations() - 1);
+}
+
+// shadow screening, the candidate detector runs on the shadow_screener's own thread
+
+TEST(ShadowScreen, ReturnsPrimaryVerdictAndRecordsDisagreements)
+{
+    shadow_screener shadow(*find_shadow_detector("rules"), *find_shadow_detector("lexer"));
+    const std::string clean = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'";
+    const std::string tautology = clean + " or 1=1;";
+    const std::string union_select = clean + " UNION SELECT * FROM USERS";
+
+    EXPECT_FALSE(shadow.screen(clean).detected);
+    EXPECT_TRUE(shadow.screen(tautology).detected);
+    // the lexer only looks for tautologies, so the rules verdict stands and the two disagree
+    for (int i = 0; i < 2; ++i)
+    {
+        const injection_verdict verdict = shadow.screen(union_select);
+        EXPECT_TRUE(verdict.detected);
+        EXPECT_EQ(verdict.rule, injection_rule::union_select);
+    }
+    shadow.drain();
+
+    EXPECT_EQ(shadow.compared(), 4u);
+    EXPECT_EQ(shadow.dropped(), 0u);
+    EXPECT_EQ(shadow.disagreements(), 2u);
+    const auto disagreed = shadow.disagreement_list();
+    ASSERT_EQ(disagreed.size(), 1u);
+    EXPECT_EQ(disagreed.begin()->first, union_select);
+    EXPECT_STREQ(disagreed.begin()->second.primary, "union");
+    EXPECT_STREQ(disagreed.begin()->second.candidate, "clean");
+    EXPECT_EQ(disagreed.begin()->second.count, 2u);
+}
+
+// without latencies, two runs over the same statements must give byte for byte the same report
+TEST(ShadowScreen, ReportWithoutLatencyIsRepeatable)
+{
+    xoshiro256 random(random_seed(), random_stream("ShadowScreen.ReportWithoutLatencyIsRepeatable"));
+    std::vector<std::string> statements;
+    for (int i = 0; i < 1000; ++i)
+    {
+        statements.push_back("SELECT * FROM USERS WHERE NAME='user" + std::to_string(random.below(100)) + "'" +
+            (i % 3 == 0 ? " or 2=2" : i % 3 == 1 ? "; DROP TABLE USERS" : ""));
+    }
+
+    std::string reports[2];
+    for (std::string& report : reports)
+    {
+        shadow_screener shadow(*find_shadow_detector("rules"), *find_shadow_detector("simd"));
+        for (const std::string& sql : statements)
+        {
+            shadow.screen(sql);
+        }
+        std::ostringstream out;
+        shadow.write_report(out, false);
+        report = out.str();
+    }
+    EXPECT_EQ(reports[0], reports[1]);
+    EXPECT_NE(reports[0].find("statements compared 1000\n"), std::string::npos) << reports[0];
+    EXPECT_EQ(reports[0].find("latency"), std::string::npos);
+}
+
+// a full queue drops statements from the comparison, it never holds up the caller
+TEST(ShadowScreen, DropsWhenQueueIsFull)
+{
+    shadow_screener shadow(*find_shadow_detector("rules"), *find_shadow_detector("legacy"), 1);
+    const std::string sql = "SELECT * FROM USERS WHERE NAME='Fred' or 'a'='a'";
+    for (int i = 0; i < 10000; ++i)
+    {
+        EXPECT_TRUE(shadow.screen(sql).detected);
+    }
+    shadow.drain();
+    EXPECT_EQ(shadow.compared() + shadow.dropped(), 10000u);
+    EXPECT_EQ(shadow.disagreements(), 0u);
+}
+
+// a replay waits for room in the queue, so every statement is compared however small it is
+TEST(ShadowScreen, WaitingScreenComparesEveryStatement)
+{
+    shadow_screener shadow(*find_shadow_detector("rules"), *find_shadow_detector("legacy"), 1);
+    const std::string sql = "SELECT * FROM USERS WHERE NAME='Fred' or 'a'='a'";
+    for (int i = 0; i < 10000; ++i)
+    {
+        EXPECT_TRUE(shadow.screen_waiting(sql).detected);
+    }
+    shadow.drain();
+    EXPECT_EQ(shadow.compared(), 10000u);
+    EXPECT_EQ(shadow.dropped(), 0u);
+}
+
+// bulk loading into an in-memory USERS table
+
+namespace
+{
+    // an in-memory database with an empty USERS table, closed when the test ends
+    struct users_database
+    {
+        sqlite3* db = NULL;
+
+        users_database()
+        {
+            sqlite3_open(":memory:", &db);
+            sqlite3_exec(db, "CREATE TABLE USERS(ID INT PRIMARY KEY NOT NULL, NAME TEXT NOT NULL, PASSWORD TEXT NOT NULL);", NULL, NULL, NULL);
+        }
+
+        ~users_database() { sqlite3_close(db); }
+
+        long long count()
+        {
+            sqlite3_stmt* stmt = NULL;
+            sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM USERS", -1, &stmt, NULL);
+            long long rows = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : -1;
+            sqlite3_finalize(stmt);
+            return rows;
+        }
+    };
+}
+
+// the first insert of a batch failing leaves no rows in it, the transaction must be rolled back anyway
+TEST(BulkLoad, FailedFirstRowOfBatchRollsBack)
+{
+    users_database users;
+    ASSERT_EQ(sqlite3_exec(users.db, "INSERT INTO USERS VALUES (5, 'taken', 'x');", NULL, NULL, NULL), SQLITE_OK);
+
+    bulk_load_options options;
+    options.batch_rows = 4;
+    bulk_load_stats stats;
+    // the fifth row, the first of the second batch, collides with ID 5
+    EXPECT_FALSE(bulk_load_users(users.db, synthetic_users(8), options, stats));
+
+    EXPECT_NE(sqlite3_get_autocommit(users.db), 0) << "a transaction was left open";
+    EXPECT_EQ(stats.rows, 4u);
+    EXPECT_EQ(users.count(), 5);
+}
+
+// the relaxed PRAGMAs only last for the load, a pooled connection gets its old settings back after
+//  a load that worked and after one that failed
+TEST(BulkLoad, PragmasAreRestoredAfterTheLoad)
+{
+    const std::string path = ::testing::TempDir() + "bulk_load_pragmas.db";
+    std::remove(path.c_str());
+    sqlite3* db = NULL;
+    ASSERT_EQ(sqlite3_open(path.c_str(), &db), SQLITE_OK);
+    ASSERT_EQ(sqlite3_exec(db, "CREATE TABLE USERS(ID INT PRIMARY KEY NOT NULL, NAME TEXT NOT NULL, PASSWORD TEXT NOT NULL);"
+        "PRAGMA synchronous=FULL; PRAGMA journal_mode=TRUNCATE;", NULL, NULL, NULL), SQLITE_OK);
+    auto pragma = [db](const char* name)
+    {
+        std::string value;
+        EXPECT_TRUE(bulk_load_detail::read_pragma(db, name, value));
+        return value;
+    };
+
+    bulk_load_stats stats;
+    EXPECT_TRUE(bulk_load_users(db, synthetic_users(10), bulk_load_options(), stats));
+    EXPECT_EQ(pragma("synchronous"), "2");
+    EXPECT_EQ(pragma("journal_mode"), "truncate");
+
+    // the IDs are taken now, so this load fails
+    EXPECT_FALSE(bulk_load_users(db, synthetic_users(10), bulk_load_options(), stats));
+    EXPECT_EQ(pragma("synchronous"), "2");
+    EXPECT_EQ(pragma("journal_mode"), "truncate");
+
+    bulk_load_options invalid;
+    invalid.journal_mode = "SIDEWAYS";
+    EXPECT_FALSE(bulk_load_users(db, synthetic_users(10, 100), invalid, stats));
+    EXPECT_EQ(pragma("synchronous"), "2");
+
+    sqlite3_close(db);
+    std::remove(path.c_str());
+}
+
+// stream_users hands the rows over batch_rows at a time, with a short last batch
+TEST(BulkLoad, StreamUsersVisitsEveryRowInBatches)
+{
+    users_database users;
+    bulk_load_stats stats;
+    ASSERT_TRUE(bulk_load_users(users.db, synthetic_users(10), bulk_load_options(), stats));
+
+    sqlite3_stmt* select = NULL;
+    ASSERT_EQ(sqlite3_prepare_v2(users.db, "SELECT ID, NAME, PASSWORD FROM USERS ORDER BY ID", -1, &select, NULL), SQLITE_OK);
+    user_batch batch;
+    std::vector<size_t> sizes;
+    int64_t next_id = 1;
+    const int result = stream_users(select, batch, 4, [&](const user_batch& rows)
+    {
+        sizes.push_back(rows.size());
+        for (const user_row& row : rows)
+        {
+            EXPECT_EQ(row.id, next_id++);
+        }
+    });
+    sqlite3_finalize(select);
+
+    EXPECT_EQ(result, SQLITE_DONE);
+    EXPECT_EQ(sizes, std::vector<size_t>({ 4, 4, 2 }));
+    EXPECT_EQ(next_id, 11);
+}
+
+// a field with a line break in it is quoted by the csv sink and read back whole by csv_users,
+//  along with the rows after it
+TEST(BulkLoad, CsvExportWithLineBreaksReloads)
+{
+    const std::string path = ::testing::TempDir() + "bulk_load_round_trip.csv";
+    {
+        std::ofstream file(path, std::ios::binary);
+        output_sink sink(file, sink_format::csv);
+        sink.begin_result("", 3);
+        sink.write_row(1, "two\nlines", "pass,\"word\"");
+        sink.write_row(2, "crlf\r\nname", "\"\n\"");
+        sink.write_row(3, "plain", "pw");
+        sink.end_result();
+    }
+
+    csv_users users(path);
+    ASSERT_TRUE(users.is_open());
+    std::vector<std::tuple<int64_t, std::string, std::string>> rows;
+    user_row row;
+    while (users(row))
+    {
+        rows.emplace_back(row.id, std::string(row.name), std::string(row.password));
+    }
+    std::remove(path.c_str());
+
+    ASSERT_EQ(rows.size(), 3u);
+    EXPECT_EQ(rows[0], std::make_tuple(int64_t(1), std::string("two\nlines"), std::string("pass,\"word\"")));
+    EXPECT_EQ(rows[1], std::make_tuple(int64_t(2), std::string("crlf\r\nname"), std::string("\"\n\"")));
+    EXPECT_EQ(rows[2], std::make_tuple(int64_t(3), std::string("plain"), std::string("pw")));
+    EXPECT_EQ(users.skipped(), 0u);
+    EXPECT_EQ(users.line_number(), 7u);
+}
+
+// the output sink encodings, byte for byte, and when each flush policy hands rows to the stream
+
+namespace
+{
+    void write_two_rows(output_sink& sink)
+    {
+        sink.begin_result("SELECT * FROM USERS", 2);
+        sink.write_row(1, "fred", "pw1");
+        sink.write_row(-2, "a,b", "say \"hi\"");
+        sink.end_result();
+    }
+}
+
+TEST(OutputSink, TextEncoding)
+{
+    std::ostringstream out;
+    {
+        output_sink sink(out, sink_format::text);
+        write_two_rows(sink);
+    }
+    EXPECT_EQ(out.str(), "\nSQL: SELECT * FROM USERS ==> 2 records found.\n"
+        "User: fred [UID=1 PWD=pw1]\n"
+        "User: a,b [UID=-2 PWD=say \"hi\"]\n");
+}
+
+TEST(OutputSink, CsvEncoding)
+{
+    std::ostringstream out;
+    {
+        output_sink sink(out, sink_format::csv);
+        write_two_rows(sink);
+    }
+    EXPECT_EQ(out.str(), "ID,NAME,PASSWORD\n"
+        "1,fred,pw1\n"
+        "-2,\"a,b\",\"say \"\"hi\"\"\"\n");
+}
+
+TEST(OutputSink, BinaryEncoding)
+{
+    std::ostringstream out;
+    {
+        output_sink sink(out, sink_format::binary);
+        write_two_rows(sink);
+    }
+    const std::string expected(
+        "\x02\0\0\0"
+        "\x01\0\0\0\0\0\0\0" "\x04\0\0\0" "fred" "\x03\0\0\0" "pw1"
+        "\xfe\xff\xff\xff\xff\xff\xff\xff" "\x03\0\0\0" "a,b" "\x08\0\0\0" "say \"hi\"",
+        4 + 8 + 4 + 4 + 4 + 3 + 8 + 4 + 3 + 4 + 8);
+    EXPECT_EQ(out.str(), expected);
+}
+
+TEST(OutputSink, FlushPolicies)
+{
+    std::ostringstream when_full_out;
+    std::ostringstream per_result_out;
+    std::ostringstream per_row_out;
+    output_sink when_full(when_full_out, sink_format::csv, flush_policy::when_full);
+    output_sink per_result(per_result_out, sink_format::csv, flush_policy::per_result);
+    output_sink per_row(per_row_out, sink_format::csv, flush_policy::per_row);
+    for (output_sink* sink : { &when_full, &per_result, &per_row })
+    {
+        sink->begin_result("", 1);
+        sink->write_row(7, "n", "p");
+    }
+    EXPECT_EQ(when_full_out.str(), "");
+    EXPECT_EQ(per_result_out.str(), "");
+    EXPECT_EQ(per_row_out.str(), "ID,NAME,PASSWORD\n7,n,p\n");
+
+    for (output_sink* sink : { &when_full, &per_result, &per_row })
+    {
+        sink->end_result();
+    }
+    EXPECT_EQ(when_full_out.str(), "");
+    EXPECT_EQ(per_result_out.str(), "ID,NAME,PASSWORD\n7,n,p\n");
+    EXPECT_EQ(when_full.buffered(), per_result_out.str().size());
+
+    when_full.flush();
+    EXPECT_EQ(when_full_out.str(), "ID,NAME,PASSWORD\n7,n,p\n");
+    EXPECT_EQ(when_full.buffered(), 0u);
+}
+
+// when_full hands the buffer over once it fills, and a value larger than the buffer goes straight through
+TEST(OutputSink, FullBufferIsWrittenOut)
+{
+    std::ostringstream out;
+    output_sink sink(out, sink_format::text, flush_policy::when_full, 64);
+    sink.begin_result("SELECT 1", 0);
+    EXPECT_EQ(out.str(), "");
+    const std::string name(40, 'n');
+    sink.write_row(1, name, "pw");
+    EXPECT_FALSE(out.str().empty());
+    EXPECT_LE(sink.buffered(), 64u);
+
+    const std::string password(200, 'p');
+    sink.write_row(2, "n", password);
+    sink.flush();
+    EXPECT_EQ(out.str(), "\nSQL: SELECT 1 ==> 0 records found.\n"
+        "User: " + name + " [UID=1 PWD=pw]\n"
+        "User: n [UID=2 PWD=" + password + "]\n");
+}
+
+// the lexer, SIMD and rule automaton detectors give the same answer for a tautology, and the
+//  rules alone also catch UNION, stacked queries and comments
+TEST(Detectors, AgreeOnEveryStatement)
+{
+    struct detector_case
+    {
+        const char* sql;
+        bool injected;
+        injection_rule rule;
+    };
+    const detector_case cases[] = {
+        // what run_query_injection appends
+        { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' or 2=2;", true, injection_rule::tautology },
+        { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' or 'hi'='hi';", true, injection_rule::tautology },
+        { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' or 'hack'='hack';", true, injection_rule::tautology },
+        { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' or 1=1;", true, injection_rule::tautology },
+        { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'", false, injection_rule::tautology },
+        { "SELECT * FROM USERS WHERE NAME='a' OR NAME=NAME", true, injection_rule::tautology },
+        { "SELECT * FROM USERS WHERE ID=1 OR 1<2", true, injection_rule::tautology },
+        { "SELECT * FROM USERS WHERE ID=1 OR 2<1", false, injection_rule::tautology },
+        { "SELECT * FROM USERS WHERE NAME='a' OR NAME='b'", false, injection_rule::tautology },
+        // parenthesised and bare TRUE
+        { "SELECT * FROM USERS WHERE NAME='a' OR (1=1)", true, injection_rule::tautology },
+        { "SELECT * FROM USERS WHERE NAME='a' OR (( 'x' = 'x' ))", true, injection_rule::tautology },
+        { "SELECT * FROM USERS WHERE NAME='a' OR (1=2)", false, injection_rule::tautology },
+        { "SELECT * FROM USERS WHERE NAME='a' OR (1=1 AND ID=2)", false, injection_rule::tautology },
+        { "SELECT * FROM USERS WHERE NAME='a' OR TRUE", true, injection_rule::tautology },
+        { "SELECT * FROM USERS WHERE NAME='a' or (true)", true, injection_rule::tautology },
+        { "SELECT * FROM USERS WHERE NAME='a' OR TRUE_NAME='b'", false, injection_rule::tautology },
+        // the other rules
+        { "SELECT NAME FROM USERS WHERE ID=1 UNION SELECT PASSWORD FROM USERS", true, injection_rule::union_select },
+        { "SELECT NAME FROM USERS WHERE ID=1 UNION ALL SELECT PASSWORD FROM USERS", true, injection_rule::union_select },
+        { "SELECT NAME FROM USERS WHERE ID=1; DROP TABLE USERS", true, injection_rule::stacked_query },
+        { "SELECT NAME FROM USERS WHERE NAME='a'-- AND PASSWORD='b'", true, injection_rule::comment },
+        { "SELECT NAME FROM USERS WHERE NAME='a' /* AND PASSWORD='b' */", true, injection_rule::comment },
+        // the markers inside literals and quoted names
+        { "SELECT * FROM USERS WHERE NAME='a OR 1=1'", false, injection_rule::tautology },
+        { "SELECT * FROM USERS WHERE NAME='x; DROP TABLE USERS'", false, injection_rule::tautology },
+        { "SELECT * FROM USERS WHERE NAME='-- not a comment /* either'", false, injection_rule::tautology },
+        { "SELECT * FROM USERS WHERE NAME='it''s OR 1=1' AND \"or\"=1", false, injection_rule::tautology },
+        { "SELECT * FROM USERS WHERE NAME='union select'", false, injection_rule::tautology },
+    };
+
+    std::vector<uint32_t> positions;
+    for (const detector_case& c : cases)
+    {
+        const bool tautology = c.injected && c.rule == injection_rule::tautology;
+        EXPECT_EQ(detect_tautology(c.sql).detected, tautology) << c.sql;
+        EXPECT_EQ(detect_tautology_simd(c.sql, positions).detected, tautology) << c.sql;
+        const injection_verdict rules = detect_injection(c.sql);
+        EXPECT_EQ(rules.detected, c.injected) << c.sql;
+        if (rules.detected && c.injected)
+        {
+            EXPECT_EQ(rules.rule, c.rule) << c.sql;
+        }
+    }
+}
+
+// a parenthesised or bare TRUE tautology is not cached as a clean shape
+TEST(VerdictCache, ParenthesisedTautologyIsNotClean)
+{
+    verdict_cache cache;
+    for (const std::string sql : { "SELECT * FROM USERS WHERE NAME='a' OR (1=1)", "SELECT * FROM USERS WHERE NAME='a' OR TRUE" })
+    {
+        sql_fingerprint fingerprint;
+        fingerprint.compute(sql);
+        EXPECT_TRUE(cache.screen(sql, fingerprint).detected) << sql;
+        EXPECT_TRUE(cache.screen(sql, fingerprint).detected) << sql;
+    }
+    EXPECT_EQ(injection_evidence(detect_injection("SELECT * FROM USERS WHERE NAME='a' OR TRUE")), "OR TRUE");
+}
+
+// warm-up shapes are classified with ? standing for a literal, so a shape with a literal OR
+//  comparison in it cannot make the cache wave through OR 1=1
+TEST(VerdictCache, WarmUpShapeWithPlaceholderComparisonIsNotClean)
+{
+    EXPECT_EQ(classify_statement_shape("select id , name , password from users where name = ? or ? = ?"), shape_verdict::literal_dependent);
+    EXPECT_EQ(classify_statement_shape("select id , name , password from users where name = ?"), shape_verdict::clean);
+
+    const std::string path = ::testing::TempDir() + "verdict_cache_warm_up.sql";
+    {
+        std::ofstream shapes(path);
+        shapes << "select id , name , password from users where name = ? or ? = ?\n";
+    }
+    verdict_cache cache;
+    ASSERT_EQ(cache.warm_up(path), 1);
+    std::remove(path.c_str());
+
+    const std::string injected = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='x' OR 1=1";
+    sql_fingerprint fingerprint;
+    fingerprint.compute(injected);
+    EXPECT_TRUE(cache.screen(injected, fingerprint).detected);
+    EXPECT_EQ(cache.hits(), 1u);
+}
+
+// a comment that cuts the statement short keeps a marker in the shape, so it cannot ride on the
+//  clean verdict cached for the statement without it
+TEST(VerdictCache, CommentedStatementDoesNotHitCleanShape)
+{
+    verdict_cache cache;
+    sql_fingerprint fingerprint;
+    const std::string clean = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'";
+    fingerprint.compute(clean);
+    ASSERT_FALSE(cache.screen(clean, fingerprint).detected);
+    const std::string clean_shape = fingerprint.shape;
+
+    const std::string commented[] = {
+        "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' --' AND PASSWORD='x'",
+        "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' /*' AND PASSWORD='x'*/"
+    };
+    for (const std::string& sql : commented)
+    {
+        fingerprint.compute(sql);
+        EXPECT_NE(fingerprint.shape, clean_shape) << sql;
+        const injection_verdict verdict = cache.screen(sql, fingerprint);
+        EXPECT_TRUE(verdict.detected) << sql;
+        EXPECT_EQ(verdict.rule, injection_rule::comment) << sql;
+    }
+}
+
+// once a shape is cached, screening another statement of that shape reuses the fingerprint's
+//  buffers and skips the detector, so it never touches the heap
+TEST(VerdictCache, ScreeningCachedShapeDoesNotAllocate)
+{
+    verdict_cache cache;
+    sql_fingerprint fingerprint;
+    const std::string first = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'";
+    fingerprint.compute(first);
+    ASSERT_FALSE(cache.screen(first, fingerprint).detected);
+
+    const std::string later[] = {
+        "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Barney'",
+        "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Wilma'",
+        "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Betty'"
+    };
+    allocation_scope scope;
+    for (const std::string& sql : later)
+    {
+        fingerprint.compute(sql);
+        EXPECT_FALSE(cache.screen(sql, fingerprint).detected) << sql;
+    }
+    EXPECT_EQ(scope.allocations(), 0u);
+}
+
+// literals and block comments that run over line breaks must not let the chunk size change what
+//  the audit finds, and every rule run_query applies is reported
+TEST(AuditLog, FindingsDoNotDependOnChunkSize)
+{
+    const std::string log =
+        "SELECT * FROM USERS WHERE NAME='Fred'\n"
+        "SELECT * FROM USERS WHERE NAME='multi\nline' OR 1=1;\n"
+        "/* a comment\nover 'three\nlines */ SELECT * FROM USERS WHERE NAME='x' OR 'a'='a'\n"
+        "SELECT * FROM USERS WHERE NAME='it''s\n' -- OR 2=2\n"
+        "SELECT * FROM USERS WHERE NAME=\"quoted\n\" OR 3=3; SELECT 1\n"
+        "SELECT * FROM USERS WHERE NAME='a;b'; DROP TABLE USERS\n"
+        "SELECT * FROM USERS WHERE NAME='unterminated\nOR 4=4\n";
+
+    thread_pool pool(2);
+    const audit_report whole = audit_sql_log(pool, log, log.size());
+    ASSERT_EQ(whole.chunks, 1u);
+    const injection_rule rules[] = { injection_rule::tautology, injection_rule::comment, injection_rule::comment,
+        injection_rule::tautology, injection_rule::stacked_query };
+    ASSERT_EQ(whole.findings.size(), std::size(rules));
+    for (size_t f = 0; f < whole.findings.size(); ++f)
+    {
+        EXPECT_EQ(whole.findings[f].verdict.rule, rules[f]) << whole.findings[f].statement;
+    }
+
+    for (size_t chunk_size = 1; chunk_size <= log.size(); ++chunk_size)
+    {
+        const audit_report chunked = audit_sql_log(pool, log, chunk_size);
+        EXPECT_EQ(chunked.statements, whole.statements) << "chunk size " << chunk_size;
+        ASSERT_EQ(chunked.findings.size(), whole.findings.size()) << "chunk size " << chunk_size;
+        for (size_t f = 0; f < whole.findings.size(); ++f)
+        {
+            EXPECT_EQ(chunked.findings[f].line, whole.findings[f].line) << "chunk size " << chunk_size;
+            EXPECT_EQ(chunked.findings[f].offset, whole.findings[f].offset) << "chunk size " << chunk_size;
+            EXPECT_EQ(chunked.findings[f].statement, whole.findings[f].statement) << "chunk size " << chunk_size;
+            EXPECT_EQ(chunked.findings[f].verdict.rule, whole.findings[f].verdict.rule) << "chunk size " << chunk_size;
+        }
+    }
+}
+
+// the USERS row cache
+
+// a row read while any of several overlapping writes was open must not be cached
+TEST(UserCache, OverlappingWriteScopesKeepFillsOut)
+{
+    user_cache cache;
+    cached_user found;
+    {
+        std::optional<user_cache::write_scope> first(std::in_place, cache);
+        {
+            user_cache::write_scope second(cache);
+            first.reset();
+            const uint64_t during = cache.write_epoch();
+            EXPECT_FALSE(cache.fill(1, "Fred", "Flinstone", during));
+            EXPECT_FALSE(cache.find_name("Fred", found));
+        }
+    }
+    EXPECT_EQ(cache.open_writes(), 0u);
+    EXPECT_TRUE(cache.fill(1, "Fred", "Flinstone", cache.write_epoch()));
+    EXPECT_TRUE(cache.find_name("Fred", found));
+
+    // a read that started inside a scope that has since closed is stale too
+    uint64_t read_epoch;
+    {
+        user_cache::write_scope writing(cache);
+        read_epoch = cache.write_epoch();
+    }
+    EXPECT_FALSE(cache.fill(2, "Barney", "Rubble", read_epoch));
+}
+
+// refilling a key must replace its slot even when an earlier slot of the window has been freed,
+//  checked against a model over a cache small enough for the windows to collide
+TEST(UserCache, RefillNeverLeavesStaleDuplicates)
+{
+    user_cache cache(0);
+    xoshiro256 random(2024);
+    const int64_t users = 40;
+    std::vector<std::string> passwords(users);
+    cached_user found;
+
+    for (int step = 0; step < 20000; ++step)
+    {
+        const int64_t id = random.below(static_cast<uint32_t>(users));
+        const std::string name = "user" + std::to_string(id);
+        if (random.below(3) == 0)
+        {
+            cache.invalidate_name(name);
+            passwords[id].clear();
+        }
+        else
+        {
+            passwords[id] = "pw" + std::to_string(step);
+            cache.fill(id, name, passwords[id], cache.write_epoch());
+        }
+
+        // a lookup may miss after an eviction, but must never return an older password
+        const int64_t probe = random.below(static_cast<uint32_t>(users));
+        const std::string probe_name = "user" + std::to_string(probe);
+        if (cache.find_name(probe_name, found))
+        {
+            ASSERT_EQ(found.password, passwords[probe]) << probe_name << " at step " << step;
+        }
+        if (cache.find_id(probe, found))
+        {
+            ASSERT_EQ(found.password, passwords[probe]) << "id " << probe << " at step " << step;
+        }
+    }
+}
+
+// a bulk load through the cache drops the keys it touches: here a second Fred makes the name ambiguous
+TEST(UserCache, BulkLoadInvalidatesCachedRows)
+{
+    users_database users;
+    bulk_load_stats stats;
+    ASSERT_TRUE(bulk_load_users(users.db, synthetic_users(10), bulk_load_options(), stats));
+
+    user_cache cache;
+    user_reader reader(users.db, cache);
+    cached_user found;
+    ASSERT_EQ(reader.by_name("user3", found), user_lookup::found);
+    ASSERT_TRUE(cache.find_name("user3", found));
+
+    bool loaded = false;
+    auto another_user3 = [&loaded](user_row& row)
+    {
+        if (loaded) return false;
+        row.id = 100;
+        row.name = "user3";
+        row.password = "second";
+        loaded = true;
+        return true;
+    };
+    ASSERT_TRUE(bulk_load_users(users.db, cache, another_user3, bulk_load_options(), stats));
+
+    EXPECT_FALSE(cache.find_name("user3", found));
+    EXPECT_EQ(reader.by_name("user3", found), user_lookup::ambiguous);
+}
+
+// any statement that is not a read empties the cache once it has run
+TEST(UserCache, WriteStatementClearsCachedRows)
+{
+    EXPECT_FALSE(may_change_users("SELECT * FROM USERS"));
+    EXPECT_FALSE(may_change_users("  /* lookup */ select ID from USERS"));
+    EXPECT_TRUE(may_change_users("UPDATE USERS SET PASSWORD='new' WHERE ID=3"));
+    EXPECT_TRUE(may_change_users("INSERT INTO USERS VALUES (11, 'x', 'y')"));
+
+    users_database users;
+    bulk_load_stats stats;
+    ASSERT_TRUE(bulk_load_users(users.db, synthetic_users(10), bulk_load_options(), stats));
+    user_cache cache;
+    user_reader reader(users.db, cache);
+    cached_user found;
+    ASSERT_EQ(reader.by_name("user3", found), user_lookup::found);
+
+    {
+        user_cache_statement writing(cache);
+        ASSERT_EQ(sqlite3_exec(users.db, "UPDATE USERS SET PASSWORD='new' WHERE ID=3", NULL, NULL, NULL), SQLITE_OK);
+        // a read during the write is not cached
+        ASSERT_EQ(reader.by_id(4, found), user_lookup::found);
+        EXPECT_FALSE(cache.find_id(4, found));
+    }
+
+    EXPECT_FALSE(cache.find_name("user3", found));
+    ASSERT_EQ(reader.by_name("user3", found), user_lookup::found);
+    EXPECT_EQ(found.password, "new");
+}
+
+// per-query scratch memory in the thread's query arena
+
+// reset hands the whole block back, so the next query is served from the same bytes
+TEST(QueryArena, ResetReusesTheBlock)
+{
+    query_arena arena(1024);
+    void* first = arena.resource()->allocate(512, 8);
+    arena.reset();
+    void* second = arena.resource()->allocate(512, 8);
+    arena.reset();
+
+    EXPECT_EQ(first, second);
+    const query_arena_stats stats = arena.stats();
+    EXPECT_EQ(stats.allocations, 2u);
+    EXPECT_EQ(stats.resets, 2u);
+    EXPECT_EQ(stats.high_water, 512u);
+    EXPECT_EQ(stats.upstream_allocations, 0u);
+    EXPECT_EQ(stats.block_size, 1024u);
+}
+
+// a query that spills onto the heap regrows the block, and the next query like it stays inside
+TEST(QueryArena, SpillRegrowsTheBlock)
+{
+    query_arena arena(256);
+    for (int i = 0; i < 8; ++i)
+    {
+        EXPECT_NE(arena.resource()->allocate(200, 8), nullptr);
+    }
+    arena.reset();
+    const query_arena_stats spilled = arena.stats();
+    EXPECT_GT(spilled.upstream_allocations, 0u);
+    EXPECT_EQ(spilled.high_water, 1600u);
+    EXPECT_GE(spilled.block_size, spilled.high_water);
+
+    for (int i = 0; i < 8; ++i)
+    {
+        EXPECT_NE(arena.resource()->allocate(200, 8), nullptr);
+    }
+    arena.reset();
+    EXPECT_EQ(arena.stats().upstream_allocations, spilled.upstream_allocations);
+    EXPECT_EQ(arena.stats().block_size, spilled.block_size);
+}
+
+// only the outermost scope resets, so a helper's scope cannot free its caller's scratch
+TEST(QueryArena, NestedScopesResetOnce)
+{
+    const size_t resets = thread_query_arena().stats().resets;
+    {
+        query_arena_scope outer;
+        {
+            query_arena_scope inner;
+        }
+        EXPECT_EQ(thread_query_arena().stats().resets, resets);
+    }
+    EXPECT_EQ(thread_query_arena().stats().resets, resets + 1);
+}
+
+// the unescaped value of a bound string literal comes from the arena, not the heap
+TEST(QueryArena, StatementCacheBindsFromTheArena)
+{
+    users_database users;
+    statement_cache cache(users.db);
+    const std::string name(100, 'x');
+    const std::string sql = "SELECT ID FROM USERS WHERE NAME='" + name + "'";
+    ASSERT_NE(cache.prepare(sql), (sqlite3_stmt*)NULL);
+
+    const query_arena_stats before = thread_query_arena().stats();
+    ASSERT_NE(cache.prepare(sql), (sqlite3_stmt*)NULL);
+    const query_arena_stats after = thread_query_arena().stats();
+    EXPECT_GT(after.bytes - before.bytes, name.size());
+    EXPECT_EQ(after.resets, before.resets + 1);
+}
+
+// the statement cache on its own
+
+// the least recently used statement is the one evicted, and a hit makes a statement the most recent
+TEST(StatementCache, EvictsTheLeastRecentlyUsedShape)
+{
+    users_database users;
+    statement_cache cache(users.db, 2);
+    sqlite3_stmt* by_id = cache.prepare("SELECT NAME FROM USERS WHERE ID=1");
+    sqlite3_stmt* by_name = cache.prepare("SELECT ID FROM USERS WHERE NAME='a'");
+    ASSERT_NE(by_id, (sqlite3_stmt*)NULL);
+    ASSERT_NE(by_name, (sqlite3_stmt*)NULL);
+
+    EXPECT_EQ(cache.prepare("SELECT NAME FROM USERS WHERE ID=2"), by_id);
+    ASSERT_NE(cache.prepare("SELECT PASSWORD FROM USERS WHERE ID=3"), (sqlite3_stmt*)NULL);
+    EXPECT_EQ(cache.size(), 2u);
+    EXPECT_EQ(cache.evictions(), 1u);
+
+    EXPECT_EQ(cache.prepare("SELECT NAME FROM USERS WHERE ID=4"), by_id);
+    const size_t misses = cache.misses();
+    cache.prepare("SELECT ID FROM USERS WHERE NAME='b'");
+    EXPECT_EQ(cache.misses(), misses + 1) << "the NAME= shape should have been evicted";
+}
+
+// a repeat shape is a hit whatever its literals, a new shape a miss
+TEST(StatementCache, CountsHitsMissesAndEvictions)
+{
+    users_database users;
+    statement_cache cache(users.db, 1);
+    ASSERT_NE(cache.prepare("SELECT NAME FROM USERS WHERE ID=1"), (sqlite3_stmt*)NULL);
+    ASSERT_NE(cache.prepare("SELECT NAME FROM USERS WHERE ID=2"), (sqlite3_stmt*)NULL);
+    ASSERT_NE(cache.prepare("select name from users where id = 3"), (sqlite3_stmt*)NULL);
+    ASSERT_NE(cache.prepare("SELECT ID FROM USERS WHERE NAME='a'"), (sqlite3_stmt*)NULL);
+    EXPECT_EQ(cache.hits(), 2u);
+    EXPECT_EQ(cache.misses(), 2u);
+    EXPECT_EQ(cache.evictions(), 1u);
+    EXPECT_EQ(cache.size(), 1u);
+    EXPECT_EQ(cache.capacity(), 1u);
+}
+
+// a shape that does not prepare gives NULL and an error, and takes no slot in the cache
+TEST(StatementCache, FailedPrepareIsNotCached)
+{
+    users_database users;
+    statement_cache cache(users.db);
+    EXPECT_EQ(cache.prepare("SELECT ID FROM MISSING WHERE ID=1"), (sqlite3_stmt*)NULL);
+    EXPECT_STRNE(cache.last_error(), "");
+    EXPECT_EQ(cache.size(), 0u);
+    EXPECT_EQ(cache.prepare("SELECT ID FROM MISSING WHERE ID=1"), (sqlite3_stmt*)NULL);
+    EXPECT_EQ(cache.hits(), 0u);
+}
+
+// statements that are not DML cannot take their literals as parameters, so they are left to sqlite3_exec
+TEST(StatementCache, OnlyDmlIsCacheable)
+{
+    users_database users;
+    statement_cache cache(users.db);
+    for (const char* sql : { "CREATE TABLE T(A TEXT DEFAULT 'x')", "PRAGMA journal_mode='memory'" })
+    {
+        sql_fingerprint fingerprint;
+        fingerprint.compute(sql);
+        EXPECT_FALSE(statement_cache::is_cacheable(fingerprint)) << sql;
+        EXPECT_EQ(cache.prepare(fingerprint), (sqlite3_stmt*)NULL) << sql;
+        EXPECT_EQ(sqlite3_exec(users.db, sql, NULL, NULL, NULL), SQLITE_OK) << sql;
+    }
+    for (const char* sql : { "SELECT ID FROM USERS WHERE ID=1", "insert into T values ('y')", "WITH n AS (SELECT 1) SELECT * FROM n",
+        "UPDATE T SET A='z'", "DELETE FROM T WHERE A='z'", "REPLACE INTO T VALUES ('w')", "VALUES (1)" })
+    {
+        sql_fingerprint fingerprint;
+        fingerprint.compute(sql);
+        EXPECT_TRUE(statement_cache::is_cacheable(fingerprint)) << sql;
+        EXPECT_NE(cache.prepare(sql), (sqlite3_stmt*)NULL) << sql;
+    }
+}
+
+// X'41' is one blob literal, bound as the bytes it spells out
+TEST(StatementCache, BlobLiteralIsBoundAsBytes)
+{
+    users_database users;
+    statement_cache cache(users.db);
+    sql_fingerprint fingerprint;
+    fingerprint.compute("SELECT X'41', x'00ff' FROM USERS");
+    ASSERT_EQ(fingerprint.literals.size(), 2u);
+    EXPECT_EQ(fingerprint.literals[0].kind, sql_token_kind::blob_literal);
+
+    ASSERT_EQ(sqlite3_exec(users.db, "INSERT INTO USERS VALUES (1, 'a', 'b');", NULL, NULL, NULL), SQLITE_OK);
+    sqlite3_stmt* stmt = cache.prepare(fingerprint);
+    ASSERT_NE(stmt, (sqlite3_stmt*)NULL) << cache.last_error();
+    ASSERT_EQ(sqlite3_step(stmt), SQLITE_ROW);
+    EXPECT_EQ(sqlite3_column_type(stmt, 0), SQLITE_BLOB);
+    EXPECT_EQ(std::string(static_cast<const char*>(sqlite3_column_blob(stmt, 0)), sqlite3_column_bytes(stmt, 0)), "A");
+    EXPECT_EQ(std::string(static_cast<const char*>(sqlite3_column_blob(stmt, 1)), sqlite3_column_bytes(stmt, 1)), std::string("\0\xff", 2));
+    cache.finish(stmt);
+
+    EXPECT_EQ(cache.prepare("SELECT X'4' FROM USERS"), (sqlite3_stmt*)NULL);
+}
+
+// the async executor, over a pool of in-memory connections
+
+namespace
+{
+    // never finishes on its own, only sqlite3_interrupt ends it
+    const char* const endless_sql = "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c) SELECT count(*) FROM c";
+
+    // runs a statement on the worker's connection and keeps the first column of each row. The
+    //  first statement to get under way sets started, so a test knows when it can interrupt it.
+    struct sql_runner
+    {
+        sqlite3* db;
+        std::promise<void>* started;
+
+        bool operator()(const std::string& sql, std::vector<std::string>& records)
+        {
+            sqlite3_progress_handler(db, 1000, [](void* context) -> int
+            {
+                sql_runner& runner = *static_cast<sql_runner*>(context);
+                if (runner.started != NULL)
+                {
+                    runner.started->set_value();
+                    runner.started = NULL;
+                }
+                return 0;
+            }, this);
+            const int rc = sqlite3_exec(db, sql.c_str(), [](void* rows, int, char** values, char**) -> int
+            {
+                static_cast<std::vector<std::string>*>(rows)->push_back(values[0] != NULL ? values[0] : "");
+                return 0;
+            }, &records, NULL);
+            sqlite3_progress_handler(db, 0, NULL, NULL);
+            return rc == SQLITE_OK;
+        }
+    };
+
+    auto sql_runners(std::promise<void>* started = NULL)
+    {
+        return [started](sqlite3* db) { return sql_runner{ db, started }; };
+    }
+}
+
+TEST(AsyncQuery, FutureResultsCarryTheirIdsAndStatus)
+{
+    connection_pool pool(":memory:", 2);
+    async_query_executor<std::string> executor(pool, 2, sql_runners());
+
+    auto good = executor.submit("SELECT 42", 7);
+    auto bad = executor.submit("SELECT * FROM NO_SUCH_TABLE");
+    const async_query_result<std::string> good_result = good.result.get();
+    const async_query_result<std::string> bad_result = bad.result.get();
+
+    EXPECT_NE(good.id, bad.id);
+    EXPECT_EQ(good_result.id, good.id);
+    EXPECT_EQ(good_result.tag, 7u);
+    EXPECT_EQ(good_result.status, async_query_status::completed);
+    EXPECT_EQ(good_result.records, std::vector<std::string>({ "42" }));
+    EXPECT_EQ(bad_result.id, bad.id);
+    EXPECT_EQ(bad_result.status, async_query_status::failed);
+    EXPECT_EQ(executor.outstanding(), 0u);
+}
+
+// cancel drops a queued statement before it runs and interrupts a running one
+TEST(AsyncQuery, CancelStopsQueuedAndRunningStatements)
+{
+    connection_pool pool(":memory:", 1);
+    std::promise<void> started;
+    std::future<void> under_way = started.get_future();
+    async_query_executor<std::string> executor(pool, 1, sql_runners(&started));
+
+    auto running = executor.submit(endless_sql);
+    auto queued = executor.submit("SELECT 1");
+    under_way.wait();
+    EXPECT_TRUE(executor.cancel(queued.id));
+    EXPECT_TRUE(executor.cancel(running.id));
+
+    const async_query_result<std::string> running_result = running.result.get();
+    const async_query_result<std::string> queued_result = queued.result.get();
+    EXPECT_EQ(running_result.id, running.id);
+    EXPECT_EQ(running_result.status, async_query_status::cancelled);
+    EXPECT_TRUE(running_result.records.empty());
+    EXPECT_EQ(queued_result.id, queued.id);
+    EXPECT_EQ(queued_result.status, async_query_status::cancelled);
+    EXPECT_TRUE(queued_result.records.empty());
+
+    // finished statements cannot be cancelled, and the interrupt does not leak into the next one
+    EXPECT_FALSE(executor.cancel(running.id));
+    EXPECT_FALSE(executor.cancel(queued.id + 100));
+    EXPECT_EQ(executor.submit("SELECT 2").result.get().status, async_query_status::completed);
+}
+
+TEST(AsyncQuery, CancelAllStopsEveryUnfinishedStatement)
+{
+    connection_pool pool(":memory:", 1);
+    std::promise<void> started;
+    std::future<void> under_way = started.get_future();
+    async_query_executor<std::string> executor(pool, 1, sql_runners(&started));
+    completion_queue<std::string> done;
+
+    auto running = executor.submit(endless_sql);
+    const uint64_t first = executor.submit_batch({ "SELECT 1", "SELECT 2", "SELECT 3" }, done, 9);
+    under_way.wait();
+    EXPECT_EQ(executor.cancel_all(), 4u);
+
+    EXPECT_EQ(running.result.get().status, async_query_status::cancelled);
+    for (uint64_t k = 0; k < 3; ++k)
+    {
+        async_query_result<std::string> result;
+        ASSERT_TRUE(done.next(result));
+        EXPECT_EQ(result.id, first + k);
+        EXPECT_EQ(result.tag, 9u);
+        EXPECT_EQ(result.status, async_query_status::cancelled);
+    }
+    EXPECT_EQ(executor.outstanding(), 0u);
+    EXPECT_EQ(executor.cancel_all(), 0u);
+}
+
+// a batch runs on one worker and its results come back together, in submission order
+TEST(AsyncQuery, BatchResultsComeBackInSubmissionOrder)
+{
+    connection_pool pool(":memory:", 2);
+    async_query_executor<std::string> executor(pool, 2, sql_runners());
+
+    auto batch = executor.submit_batch({ "SELECT 1", "SELECT * FROM NO_SUCH_TABLE", "SELECT 3" }, 5);
+    const std::vector< async_query_result<std::string> > results = batch.results.get();
+
+    ASSERT_EQ(results.size(), 3u);
+    const async_query_status statuses[] = { async_query_status::completed, async_query_status::failed, async_query_status::completed };
+    for (size_t k = 0; k < results.size(); ++k)
+    {
+        EXPECT_EQ(results[k].id, batch.first_id + k);
+        EXPECT_EQ(results[k].tag, 5u);
+        EXPECT_EQ(results[k].status, statuses[k]);
+    }
+    EXPECT_EQ(results[0].records, std::vector<std::string>({ "1" }));
+    EXPECT_EQ(results[2].records, std::vector<std::string>({ "3" }));
+}
+
+// every statement sent to a completion queue arrives there once, with the id submit returned
+TEST(AsyncQuery, CompletionQueueDeliversEveryResult)
+{
+    connection_pool pool(":memory:", 4);
+    async_query_executor<std::string> executor(pool, 4, sql_runners());
+    completion_queue<std::string> done;
+
+    std::map<uint64_t, uint64_t> tags;
+    for (uint64_t k = 0; k < 100; ++k)
+    {
+        tags[executor.submit("SELECT " + std::to_string(k), done, k)] = k;
+    }
+
+    for (size_t k = 0; k < 100; ++k)
+    {
+        async_query_result<std::string> result;
+        ASSERT_TRUE(done.next(result));
+        auto found = tags.find(result.id);
+        ASSERT_NE(found, tags.end()) << result.id;
+        EXPECT_EQ(result.tag, found->second);
+        EXPECT_EQ(result.status, async_query_status::completed);
+        EXPECT_EQ(result.records, std::vector<std::string>({ std::to_string(found->second) }));
+        tags.erase(found);
+    }
+    EXPECT_TRUE(tags.empty());
+    EXPECT_EQ(done.size(), 0u);
+    done.close();
+    async_query_result<std::string> result;
+    EXPECT_FALSE(done.next(result));
+}
+
+// a runner factory that throws on a worker thread is reported to the constructor, and every
+//  connection goes back to the pool
+TEST(AsyncQuery, RunnerFactoryFailureIsRethrownByTheConstructor)
+{
+    connection_pool pool(":memory:", 3);
+    std::atomic<int> made(0);
+    auto failing = [&made](sqlite3* db)
+    {
+        if (made.fetch_add(1) == 1)
+        {
+            throw std::runtime_error("no runner");
+        }
+        return sql_runner{ db, NULL };
+    };
+    EXPECT_THROW((async_query_executor<std::string>(pool, 3, failing)), std::runtime_error);
+    EXPECT_EQ(made.load(), 3);
+
+    async_query_executor<std::string> executor(pool, 3, sql_runners());
+    EXPECT_EQ(executor.size(), 3u);
+    EXPECT_EQ(executor.submit("SELECT 1").result.get().status, async_query_status::completed);
+}
+
+// the threaded load test driver
+
+// every query of the mix runs once, split over the workers
+TEST(LoadTest, RunsEveryQueryOfTheMix)
+{
+    connection_pool pool(":memory:", 3);
+    load_test_options options;
+    options.threads = 3;
+    options.queries = 1000;
+    std::atomic<size_t> scans(0);
+    const load_test_report report = run_load_test(pool, options, [&scans](sqlite3*)
+    {
+        return [&scans](load_query_kind kind)
+        {
+            scans += kind == load_query_kind::scan ? 1 : 0;
+            return kind != load_query_kind::injected;
+        };
+    });
+    EXPECT_EQ(report.queries, 1000u);
+    EXPECT_EQ(report.accepted + report.rejected, 1000u);
+    EXPECT_GT(report.rejected, 0u);
+    EXPECT_GT(scans.load(), 0u);
+}
+
+// a mix of more than 100% is an error rather than quietly running fewer lookups
+TEST(LoadTest, MixOverOneHundredPercentIsRejected)
+{
+    connection_pool pool(":memory:", 1);
+    load_test_options options;
+    options.injected_percent = 60;
+    options.scan_percent = 50;
+    EXPECT_FALSE(options.valid());
+    EXPECT_THROW(run_load_test(pool, options, [](sqlite3*) { return [](load_query_kind) { return true; }; }), std::invalid_argument);
+
+    options.scan_percent = 40;
+    EXPECT_TRUE(options.valid());
+    options.injected_percent = std::numeric_limits<unsigned>::max();
+    EXPECT_FALSE(options.valid());
+}
+
+// a runner factory that throws on one worker fails the run instead of leaving the others waiting
+TEST(LoadTest, RunnerFactoryFailureIsRethrown)
+{
+    connection_pool pool(":memory:", 3);
+    load_test_options options;
+    options.threads = 3;
+    options.queries = 300;
+    std::atomic<int> made(0);
+    auto failing = [&made](sqlite3*)
+    {
+        if (made.fetch_add(1) == 1)
+        {
+            throw std::runtime_error("no runner");
+        }
+        return [](load_query_kind) { return true; };
+    };
+    EXPECT_THROW(run_load_test(pool, options, failing), std::runtime_error);
+    EXPECT_EQ(made.load(), 3);
+
+    // the connections all went back to the pool
+    EXPECT_EQ(run_load_test(pool, options, [](sqlite3*) { return [](load_query_kind) { return true; }; }).queries, 300u);
+}
+
+// the bounded line reader, fed from a temporary file a few bytes per read
+
+namespace
+{
+    struct read_line
+    {
+        std::string text;
+        bool truncated;
+        size_t length;
+    };
+
+    // every line of input read with a line_reader, and the reader's overflow count
+    std::vector<read_line> read_lines(const std::string& input, size_t max_record_length, size_t block_size, uint64_t* overflows = NULL)
+    {
+        std::vector<read_line> lines;
+        std::FILE* file = std::tmpfile();
+        if (file == NULL)
+        {
+            ADD_FAILURE() << "tmpfile failed";
+            return lines;
+        }
+        std::fwrite(input.data(), 1, input.size(), file);
+        std::fflush(file);
+        std::fseek(file, 0, SEEK_SET);
+
+        line_reader reader(file, max_record_length, block_size);
+        line_record record;
+        while (reader.next(record))
+        {
+            EXPECT_EQ(record.number, lines.size() + 1);
+            lines.push_back(read_line{ std::string(record.text), record.truncated, record.length });
+        }
+        EXPECT_EQ(reader.error(), "");
+        EXPECT_EQ(reader.bytes_read(), input.size());
+        if (overflows != NULL)
+        {
+            *overflows = reader.overflows();
+        }
+        std::fclose(file);
+        return lines;
+    }
+}
+
+// a line longer than the limit arrives over many reads, only its start is kept
+TEST(LineReader, LongLineSpanningReadsIsTruncated)
+{
+    uint64_t overflows = 0;
+    const auto lines = read_lines("short\n" + std::string(50, 'x') + "\nafter\n", 8, 4, &overflows);
+
+    ASSERT_EQ(lines.size(), 3u);
+    EXPECT_EQ(lines[0].text, "short");
+    EXPECT_FALSE(lines[0].truncated);
+    EXPECT_EQ(lines[1].text, "xxxxxxxx");
+    EXPECT_TRUE(lines[1].truncated);
+    EXPECT_EQ(lines[1].length, 50u);
+    EXPECT_EQ(lines[2].text, "after");
+    EXPECT_FALSE(lines[2].truncated);
+    EXPECT_EQ(overflows, 1u);
+}
+
+// the CR of a CRLF is not part of the line, even when it was one of the bytes dropped past the limit
+TEST(LineReader, CarriageReturnAmongDroppedBytes)
+{
+    // the first read fills the 12 byte buffer up to the CR, which is dropped before the LF arrives
+    const auto lines = read_lines("0123456789A\r\n0123456789ABC\r\n01234567\r\n0123456\r\nnext\r\n", 8, 4);
+
+    ASSERT_EQ(lines.size(), 5u);
+    EXPECT_EQ(lines[0].text, "01234567");
+    EXPECT_TRUE(lines[0].truncated);
+    EXPECT_EQ(lines[0].length, 11u);
+    EXPECT_EQ(lines[1].text, "01234567");
+    EXPECT_TRUE(lines[1].truncated);
+    EXPECT_EQ(lines[1].length, 13u);
+    // exactly the limit once the CR is left out
+    EXPECT_EQ(lines[2].text, "01234567");
+    EXPECT_FALSE(lines[2].truncated);
+    EXPECT_EQ(lines[2].length, 8u);
+    EXPECT_EQ(lines[3].text, "0123456");
+    EXPECT_EQ(lines[3].length, 7u);
+    EXPECT_EQ(lines[4].text, "next");
+    EXPECT_EQ(lines[4].length, 4u);
+}
+
+TEST(LineReader, LastLineWithoutLineBreak)
+{
+    auto lines = read_lines("one\ntwo", 8, 4);
+    ASSERT_EQ(lines.size(), 2u);
+    EXPECT_EQ(lines[1].text, "two");
+    EXPECT_EQ(lines[1].length, 3u);
+
+    lines = read_lines("one\n" + std::string(20, 'y'), 8, 4);
+    ASSERT_EQ(lines.size(), 2u);
+    EXPECT_EQ(lines[1].text, "yyyyyyyy");
+    EXPECT_TRUE(lines[1].truncated);
+    EXPECT_EQ(lines[1].length, 20u);
+
+    EXPECT_TRUE(read_lines("", 8, 4).empty());
+}
+
+// input many times the buffer, so fill keeps moving unfinished lines back to the front
+TEST(LineReader, CompactionKeepsUnfinishedLines)
+{
+    std::string input;
+    std::vector<std::string> expected;
+    for (int i = 0; i < 1000; ++i)
+    {
+        std::string line;
+        for (int c = 0; c < i % 17; ++c)
+        {
+            line.push_back(static_cast<char>('a' + (i + c) % 26));
+        }
+        expected.push_back(line);
+        input += line + (i % 5 == 0 ? "\r\n" : "\n");
+    }
+
+    const auto lines = read_lines(input, 16, 8);
+    ASSERT_EQ(lines.size(), expected.size());
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        EXPECT_EQ(lines[i].text, expected[i]) << "line " << i + 1;
+        EXPECT_FALSE(lines[i].truncated) << "line " << i + 1;
+        EXPECT_EQ(lines[i].length, expected[i].size()) << "line " << i + 1;
+    }
+}
+
+// fixed_string, the inline string for short fixed-width fields
+
+TEST(FixedString, AssignOverflowLeavesTheValueUnchanged)
+{
+    fixed_string<5> value;
+    EXPECT_EQ(value.assign("abcde"), fixed_string_status::ok);
+    EXPECT_TRUE(value.full());
+    EXPECT_EQ(value.assign("abcdef"), fixed_string_status::overflow);
+    EXPECT_EQ(value.view(), "abcde");
+    EXPECT_EQ(value.size(), 5u);
+    EXPECT_STREQ(value.c_str(), "abcde");
+}
+
+TEST(FixedString, AssignTruncatedKeepsTheFirstCharacters)
+{
+    fixed_string<5> value;
+    EXPECT_EQ(value.assign_truncated("abcdefgh"), fixed_string_status::truncated);
+    EXPECT_EQ(value.view(), "abcde");
+    EXPECT_STREQ(value.c_str(), "abcde");
+    EXPECT_EQ(value.assign_truncated("xy"), fixed_string_status::ok);
+    EXPECT_EQ(value.view(), "xy");
+}
+
+// append is all or nothing, like assign
+TEST(FixedString, AppendFitsOrChangesNothing)
+{
+    fixed_string<6> value("ab");
+    EXPECT_EQ(value.append("cd"), fixed_string_status::ok);
+    EXPECT_EQ(value.append(""), fixed_string_status::ok);
+    EXPECT_EQ(value.view(), "abcd");
+    EXPECT_EQ(value.append("efg"), fixed_string_status::overflow);
+    EXPECT_EQ(value.view(), "abcd");
+    EXPECT_EQ(value.append("ef"), fixed_string_status::ok);
+    EXPECT_TRUE(value.full());
+    EXPECT_STREQ(value.c_str(), "abcdef");
+    EXPECT_EQ(value, fixed_string<6>("abcdef"));
+}
+
+// equality compares whole blocks, so the bytes past the text must be zero however the value was made
+TEST(FixedString, EqualityIgnoresWhatWasStoredBefore)
+{
+    fixed_string<30> reused;
+    ASSERT_EQ(reused.assign("a much longer name than fred"), fixed_string_status::ok);
+    ASSERT_EQ(reused.assign("fred"), fixed_string_status::ok);
+    fixed_string<30> fresh;
+    ASSERT_EQ(fresh.assign("fred"), fixed_string_status::ok);
+    EXPECT_EQ(reused, fresh);
+    EXPECT_EQ(reused, fixed_string<30>("fred"));
+    EXPECT_EQ(std::hash< fixed_string<30> >()(reused), std::hash< fixed_string<30> >()(fresh));
+
+    ASSERT_EQ(reused.assign_truncated("abcdefghijklmnopqrstuvwxyz0123456789"), fixed_string_status::truncated);
+    ASSERT_EQ(reused.assign("fred"), fixed_string_status::ok);
+    EXPECT_EQ(reused, fresh);
+
+    fixed_string<30> appended("fr");
+    ASSERT_EQ(appended.append("ed"), fixed_string_status::ok);
+    EXPECT_EQ(appended, fresh);
+
+    // the same text with a different length byte, or one character apart in the second lane
+    EXPECT_NE(fixed_string<30>("fre"), fresh);
+    EXPECT_NE(fixed_string<30>("abcdefghijklmnopqrst"), fixed_string<30>("abcdefghijklmnopqrsu"));
+
+    reused.clear();
+    EXPECT_TRUE(reused.empty());
+    EXPECT_EQ(reused, fixed_string<30>());
+}
+
+// the error paths of the Exceptions program, returned through expected
+
+TEST(ErrorPaths, ExpectedHoldsAValueOrAnError)
+{
+    expected<int, app_error> value(42);
+    ASSERT_TRUE(value.has_value());
+    EXPECT_TRUE(static_cast<bool>(value));
+    EXPECT_EQ(*value, 42);
+    EXPECT_EQ(value.value_or(7), 42);
+
+    expected<int, app_error> failure = unexpected(make_app_error(app_error_code::custom_logic_failed));
+    ASSERT_FALSE(failure.has_value());
+    EXPECT_EQ(failure.error().code, app_error_code::custom_logic_failed);
+    EXPECT_STREQ(failure.error().message, "Custom logic failed with a specific error!");
+    EXPECT_EQ(failure.value_or(7), 7);
+
+    expected<void, app_error> done;
+    EXPECT_TRUE(done.has_value());
+    expected<void, app_error> failed = unexpected(make_app_error(app_error_code::even_more_logic_failed));
+    ASSERT_FALSE(failed.has_value());
+    EXPECT_STREQ(failed.error().message, "Something went wrong in even more custom logic!");
+}
+
+// try_divide fails where divide throws, for a zero denominator of either sign
+TEST(ErrorPaths, TryDivide)
+{
+    const expected<float, app_error> quotient = try_divide(7.0f, 2.0f);
+    ASSERT_TRUE(quotient.has_value());
+    EXPECT_EQ(*quotient, divide(7.0f, 2.0f));
+    EXPECT_EQ(*try_divide(-1.0f, 4.0f), -0.25f);
+
+    for (float zero : { 0.0f, -0.0f })
+    {
+        const expected<float, app_error> failure = try_divide(1.0f, zero);
+        ASSERT_FALSE(failure.has_value());
+        EXPECT_EQ(failure.error().code, app_error_code::division_by_zero);
+        EXPECT_STREQ(failure.error().message, "Division by zero is not allowed!");
+        EXPECT_THROW(divide(1.0f, zero), std::invalid_argument);
+    }
+}
+
+// the returned custom logic errors print what the throwing versions print and fail the same way
+TEST(ErrorPaths, TryCustomApplicationLogic)
+{
+    std::ostringstream printed;
+    std::streambuf* const console = std::cout.rdbuf(printed.rdbuf());
+    const expected<void, app_error> result = try_do_custom_application_logic();
+    std::cout.rdbuf(console);
+
+    ASSERT_FALSE(result.has_value());
+    EXPECT_EQ(result.error().code, app_error_code::custom_logic_failed);
+    EXPECT_EQ(printed.str(), "Running Custom Application Logic.\n"
+        "Running Even More Custom Application Logic.\n"
+        "Caught an exception in custom application logic: Something went wrong in even more custom logic!\n");
+}
+
+// the seeded generator and the parallel fill
+
+// the fill only depends on the seed, one thread and many give the same values
+TEST(FastRandom, ParallelFillIsTheSameForAnyPoolSize)
+{
+    const size_t count = fast_random_detail::shard_size * 5 + 17;
+    std::vector<int32_t> single(count);
+    std::vector<int32_t> several(count);
+    std::vector<int32_t> reseeded(count);
+    {
+        thread_pool one(1);
+        parallel_fill(one, 405, single, -1000, 1000);
+    }
+    {
+        thread_pool four(4);
+        parallel_fill(four, 405, several, -1000, 1000);
+        parallel_fill(four, 406, reseeded, -1000, 1000);
+    }
+    EXPECT_EQ(single, several);
+    EXPECT_NE(single, reseeded);
+    EXPECT_TRUE(std::all_of(single.begin(), single.end(), [](int32_t value) { return value >= -1000 && value <= 1000; }));
+}
+
+// below stays under its bound and between within its closed range, reaching both ends
+TEST(FastRandom, BelowAndBetweenStayInBounds)
+{
+    xoshiro256 random(405, 1);
+    for (uint32_t bound : { 1u, 2u, 3u, 7u, 1000u, 0x80000001u, std::numeric_limits<uint32_t>::max() })
+    {
+        for (int i = 0; i < 10000; ++i)
+        {
+            ASSERT_LT(random.below(bound), bound) << bound;
+        }
+    }
+
+    const std::pair<int32_t, int32_t> ranges[] = { { 0, 0 }, { -3, 3 }, { 5, 6 },
+        { std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::min() + 1 },
+        { std::numeric_limits<int32_t>::max() - 1, std::numeric_limits<int32_t>::max() } };
+    for (const auto& range : ranges)
+    {
+        bool saw_low = false;
+        bool saw_high = false;
+        for (int i = 0; i < 10000; ++i)
+        {
+            const int32_t value = random.between(range.first, range.second);
+            ASSERT_GE(value, range.first);
+            ASSERT_LE(value, range.second);
+            saw_low = saw_low || value == range.first;
+            saw_high = saw_high || value == range.second;
+        }
+        EXPECT_TRUE(saw_low && saw_high) << range.first << ".." << range.second;
+    }
+}
+
+// the batch divide kernels, each checked lane by lane against divide()
+
+namespace
+{
+    // numerators and denominators for count lanes, every seventh denominator 0 and every eleventh -0
+    void divide_operands(size_t count, std::vector<float>& numerators, std::vector<float>& denominators)
+    {
+        xoshiro256 random(405, count);
+        numerators.resize(count);
+        denominators.resize(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            numerators[i] = static_cast<float>(random.between(-100000, 100000)) / 8.0f;
+            denominators[i] = i % 7 == 3 ? 0.0f : i % 11 == 5 ? -0.0f : static_cast<float>(random.between(-1000, 1000)) / 4.0f;
+        }
+    }
+
+    // results and zero_lanes are what divide() gives, with 0 and a set bit where it throws
+    void expect_divided(const std::vector<float>& numerators, const std::vector<float>& denominators,
+        const std::vector<float>& results, const std::vector<uint64_t>& zero_lanes, size_t zeros, const char* kernel)
+    {
+        size_t expected_zeros = 0;
+        for (size_t i = 0; i < numerators.size(); ++i)
+        {
+            const bool zero_bit = (zero_lanes[i / 64] >> (i % 64)) & 1;
+            try
+            {
+                const float quotient = divide(numerators[i], denominators[i]);
+                ASSERT_EQ(results[i], quotient) << kernel << " lane " << i;
+                ASSERT_FALSE(zero_bit) << kernel << " lane " << i;
+            }
+            catch (const std::invalid_argument&)
+            {
+                ++expected_zeros;
+                ASSERT_EQ(results[i], 0.0f) << kernel << " lane " << i;
+                ASSERT_FALSE(std::signbit(results[i])) << kernel << " lane " << i;
+                ASSERT_TRUE(zero_bit) << kernel << " lane " << i;
+            }
+        }
+        // the bits past the last lane stay clear
+        const size_t tail = numerators.size() % 64;
+        if (tail != 0)
+        {
+            EXPECT_EQ(zero_lanes.back() >> tail, 0u) << kernel;
+        }
+        EXPECT_EQ(zeros, expected_zeros) << kernel;
+    }
+}
+
+TEST(BatchDivide, EveryKernelMatchesDivide)
+{
+    using namespace batch_divide_detail;
+    const size_t count = 64 * 37 + 29;
+    std::vector<float> numerators, denominators;
+    divide_operands(count, numerators, denominators);
+
+    std::vector<std::pair<const char*, word_function>> kernels = { { "scalar", divide_word_scalar } };
+#if defined(BATCH_DIVIDE_X86)
+    kernels.push_back({ "sse", divide_word_sse });
+    if (cpu_has_avx2())
+    {
+        kernels.push_back({ "avx2", divide_word_avx2 });
+    }
+#endif
+    for (const auto& kernel : kernels)
+    {
+        std::vector<float> results(count, -1.0f);
+        std::vector<uint64_t> zero_lanes(divide_mask_words(count), ~0ull);
+        const size_t zeros = divide_words(kernel.second, numerators.data(), denominators.data(), results.data(),
+            count, zero_lanes.data(), 0, zero_lanes.size());
+        expect_divided(numerators, denominators, results, zero_lanes, zeros, kernel.first);
+    }
+
+    std::vector<float> results;
+    std::vector<uint64_t> zero_lanes;
+    const size_t zeros = divide_batch(numerators, denominators, results, zero_lanes);
+    expect_divided(numerators, denominators, results, zero_lanes, zeros, batch_divide_isa());
+}
+
+// the pool overload splits the mask words between threads and gives the same answer
+TEST(BatchDivide, PoolOverloadMatchesDivide)
+{
+    // more than one 1024 word chunk, and a partial last word
+    const size_t count = 64 * 1024 * 3 + 29;
+    std::vector<float> numerators, denominators;
+    divide_operands(count, numerators, denominators);
+
+    thread_pool pool(4);
+    std::vector<float> results;
+    std::vector<uint64_t> zero_lanes;
+    const size_t zeros = divide_batch(pool, numerators, denominators, results, zero_lanes);
+    ASSERT_EQ(results.size(), count);
+    ASSERT_EQ(zero_lanes.size(), divide_mask_words(count));
+    expect_divided(numerators, denominators, results, zero_lanes, zeros, "pool");
+
+    std::vector<float> single_results;
+    std::vector<uint64_t> single_zero_lanes;
+    EXPECT_EQ(divide_batch(numerators, denominators, single_results, single_zero_lanes), zeros);
+    EXPECT_EQ(single_results, results);
+    EXPECT_EQ(single_zero_lanes, zero_lanes);
+}
+
+// the USERS secondary indexes and the query plan checks
+
+TEST(IndexManager, NameLookupUsesTheCoveringIndexOnceEnsured)
+{
+    users_database users;
+    bulk_load_stats stats;
+    ASSERT_TRUE(bulk_load_users(users.db, synthetic_users(100), bulk_load_options(), stats));
+    index_manager indexes(users.db);
+    const std::string lookup = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='user7'";
+    std::vector<query_plan_step> plan;
+
+    ASSERT_TRUE(indexes.query_plan(lookup, plan)) << indexes.last_error();
+    EXPECT_TRUE(indexes.scans_for_lookup(lookup, plan));
+    std::ostringstream warnings;
+    EXPECT_EQ(indexes.check_plans({ lookup, "SELECT * FROM USERS" }, warnings), 1u);
+    EXPECT_NE(warnings.str().find("is a full scan"), std::string::npos) << warnings.str();
+
+    EXPECT_EQ(indexes.ensure(), 1);
+    EXPECT_EQ(indexes.ensure(), 0);
+    EXPECT_TRUE(indexes.exists("IDX_USERS_LOOKUP"));
+    ASSERT_TRUE(indexes.analyze()) << indexes.last_error();
+    ASSERT_TRUE(indexes.query_plan(lookup, plan));
+    EXPECT_FALSE(indexes.scans_for_lookup(lookup, plan));
+    ASSERT_FALSE(plan.empty());
+    EXPECT_NE(plan[0].detail.find("IDX_USERS_LOOKUP"), std::string::npos) << plan[0].detail;
+    warnings.str("");
+    EXPECT_EQ(indexes.check_plans({ lookup, "SELECT * FROM USERS" }, warnings), 0u);
+    EXPECT_EQ(warnings.str(), "");
+
+    EXPECT_TRUE(indexes.drop());
+    EXPECT_FALSE(indexes.exists("IDX_USERS_LOOKUP"));
+    ASSERT_TRUE(indexes.query_plan(lookup, plan));
+    EXPECT_TRUE(indexes.scans_for_lookup(lookup, plan));
+}
+
+// a statement that cannot be planned is flagged, and a name that is not an identifier is never spliced into DDL
+TEST(IndexManager, RejectsWhatItCannotPlanOrName)
+{
+    users_database users;
+    index_manager indexes(users.db);
+    std::ostringstream warnings;
+    EXPECT_EQ(indexes.check_plans({ "SELECT * FROM MISSING WHERE ID=1", "SELECT 1; SELECT 2" }, warnings), 2u);
+    EXPECT_NE(warnings.str().find("cannot plan"), std::string::npos);
+
+    index_manager injected(users.db, "USERS", { { "IDX; DROP TABLE USERS", "NAME" } });
+    EXPECT_EQ(injected.ensure(), -1);
+    EXPECT_TRUE(injected.create_statements().empty());
+    EXPECT_FALSE(injected.drop());
+    EXPECT_EQ(users.count(), 0);
+}
@@ -0,0 +1,131 @@
+// thread_pool.h : Fixed size pool of worker threads with a shared task queue.
+//
+// submit() queues one task and returns a std::future for its result. parallel_for() splits an index
+// range into chunks, runs them on the pool and waits for all of them, rethrowing the first
+// exception a chunk threw.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class thread_pool
+{
+public:
+    explicit thread_pool(size_t threads = default_size())
+    {
+        if (threads == 0)
+        {
+            threads = 1;
+        }
+        workers.reserve(threads);
+        for (size_t i = 0; i < threads; ++i)
+        {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    // finishes every queued task, then stops the workers
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    static size_t default_size()
+    {
+        size_t cores = std::thread::hardware_concurrency();
+        return cores == 0 ? 1 : cores;
+    }
+
+    size_t size() const { return workers.size(); }
+
+    template <typename Task>
+    std::future<typename std::invoke_result<Task>::type> submit(Task task)
+    {
+        typedef typename std::invoke_result<Task>::type result_type;
+        auto packaged = std::make_shared< std::packaged_task<result_type()> >(std::move(task));
+        std::future<result_type> result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.emplace_back([packaged] { (*packaged)(); });
+        }
+        wake.notify_one();
+        return result;
+    }
+
+    // calls body(begin, end) over [0, count) in chunks of at least min_chunk indexes and waits for all of them
+    template <typename Body>
+    void parallel_for(size_t count, Body body, size_t min_chunk = 1)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        // a few chunks per worker keeps the threads busy when chunks take uneven time
+        size_t chunk = count / (size() * 4) + 1;
+        if (chunk < min_chunk)
+        {
+            chunk = min_chunk;
+        }
+
+        std::vector< std::future<void> > pending;
+        pending.reserve(count / chunk + 1);
+        for (size_t begin = 0; begin < count; begin += chunk)
+        {
+            size_t end = begin + chunk < count ? begin + chunk : count;
+            pending.push_back(submit([&body, begin, end] { body(begin, end); }));
+        }
+        for (auto& done : pending)
+        {
+            done.wait();
+        }
+        for (auto& done : pending)
+        {
+            done.get();
+        }
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque< std::function<void()> > queue;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void work()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty())
+                {
+                    return;
+                }
+                task = std::move(queue.front());
+                queue.pop_front();
+            }
+            task();
+        }
+    }
+};
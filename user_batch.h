@@ -0,0 +1,206 @@
+// user_batch.h : Typed USERS rows read straight from sqlite3_step into a struct-of-arrays batch.
+//
+// ID is decoded as an integer and NAME / PASSWORD are copied into an arena owned by the batch and
+// handed out as std::string_view. Clearing the batch keeps both the column vectors and the arena
+// memory, so once a batch has seen its largest result set, later queries do not allocate at all.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "sqlite3.h"
+
+// bump allocator for row text, all memory is released together when the owner resets it
+class string_arena
+{
+public:
+    explicit string_arena(size_t block_size = 64 * 1024) : block_size(block_size) {}
+
+    string_arena(const string_arena&) = delete;
+    string_arena& operator=(const string_arena&) = delete;
+    // the blocks move with the arena, so views into them stay valid
+    string_arena(string_arena&&) = default;
+    string_arena& operator=(string_arena&&) = default;
+
+    // copies text into the arena, the view stays valid until reset
+    std::string_view store(const char* text, size_t length)
+    {
+        if (length == 0)
+        {
+            return std::string_view();
+        }
+        if (current == blocks.size() || used + length > blocks[current].size)
+        {
+            next_block(length);
+        }
+        char* destination = blocks[current].data.get() + used;
+        std::memcpy(destination, text, length);
+        used += length;
+        return std::string_view(destination, length);
+    }
+
+    // forgets every stored string, keeping the blocks for reuse
+    void reset() noexcept
+    {
+        current = 0;
+        used = 0;
+    }
+
+    size_t block_count() const noexcept { return blocks.size(); }
+
+private:
+    struct block
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    size_t block_size;
+    std::vector<block> blocks;
+    size_t current = 0;
+    size_t used = 0;
+
+    void next_block(size_t length)
+    {
+        // move to the next retained block that is large enough, or add one
+        size_t next = current == blocks.size() ? current : current + 1;
+        while (next < blocks.size() && blocks[next].size < length)
+        {
+            ++next;
+        }
+        if (next == blocks.size())
+        {
+            size_t size = length > block_size ? length : block_size;
+            blocks.push_back(block{ std::unique_ptr<char[]>(new char[size]), size });
+        }
+        current = next;
+        used = 0;
+    }
+};
+
+struct user_row
+{
+    int64_t id;
+    std::string_view name;
+    std::string_view password;
+};
+
+// one column per vector, row i is ids[i], names[i], passwords[i]
+class user_batch
+{
+public:
+    std::vector<int64_t> ids;
+    std::vector<std::string_view> names;
+    std::vector<std::string_view> passwords;
+
+    size_t size() const noexcept { return ids.size(); }
+    bool empty() const noexcept { return ids.empty(); }
+
+    user_row operator[](size_t row) const noexcept
+    {
+        return user_row{ ids[row], names[row], passwords[row] };
+    }
+
+    void reserve(size_t rows)
+    {
+        ids.reserve(rows);
+        names.reserve(rows);
+        passwords.reserve(rows);
+    }
+
+    // drops all rows, keeping the column capacity and arena blocks
+    void clear() noexcept
+    {
+        ids.clear();
+        names.clear();
+        passwords.clear();
+        text.reset();
+    }
+
+    // appends a row, copying the text into the batch
+    void append(int64_t id, std::string_view name, std::string_view password)
+    {
+        ids.push_back(id);
+        names.push_back(text.store(name.data(), name.size()));
+        passwords.push_back(text.store(password.data(), password.size()));
+    }
+
+    // appends the current row of a statement selecting ID, NAME, PASSWORD
+    void append(sqlite3_stmt* stmt)
+    {
+        ids.push_back(sqlite3_column_int64(stmt, 0));
+        names.push_back(column_text(stmt, 1));
+        passwords.push_back(column_text(stmt, 2));
+    }
+
+    class iterator
+    {
+    public:
+        iterator(const user_batch* batch, size_t row) : batch(batch), row(row) {}
+        user_row operator*() const { return (*batch)[row]; }
+        iterator& operator++() { ++row; return *this; }
+        bool operator!=(const iterator& other) const { return row != other.row; }
+    private:
+        const user_batch* batch;
+        size_t row;
+    };
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, size()); }
+
+private:
+    string_arena text;
+
+    std::string_view column_text(sqlite3_stmt* stmt, int column)
+    {
+        const unsigned char* value = sqlite3_column_text(stmt, column);
+        if (value == NULL)
+        {
+            return std::string_view();
+        }
+        // sqlite3_column_bytes must come after sqlite3_column_text so it reports the text length
+        return text.store(reinterpret_cast<const char*>(value), static_cast<size_t>(sqlite3_column_bytes(stmt, column)));
+    }
+};
+
+// steps stmt to completion, appending every row to batch. Returns SQLITE_DONE on success.
+inline int fetch_users(sqlite3_stmt* stmt, user_batch& batch)
+{
+    int result;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        batch.append(stmt);
+    }
+    return result;
+}
+
+// steps stmt to completion, handing the rows to visit(const user_batch&) every batch_rows rows.
+//  The batch is cleared between calls, so views from one call are not valid in the next.
+//  Returns SQLITE_DONE on success.
+template <typename Visitor>
+int stream_users(sqlite3_stmt* stmt, user_batch& batch, size_t batch_rows, Visitor visit)
+{
+    batch.clear();
+    batch.reserve(batch_rows);
+
+    int result;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        batch.append(stmt);
+        if (batch.size() >= batch_rows)
+        {
+            visit(static_cast<const user_batch&>(batch));
+            batch.clear();
+        }
+    }
+    if (result == SQLITE_DONE && !batch.empty())
+    {
+        visit(static_cast<const user_batch&>(batch));
+        batch.clear();
+    }
+    return result;
+}
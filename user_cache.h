@@ -0,0 +1,594 @@
+// user_cache.h : Read-through cache of USERS rows keyed by NAME and by ID.
+//
+// user_cache is a fixed size open-addressing table sized from a memory cap. Every slot holds one
+// key, either a NAME or an ID, plus the whole row inline: the id and up to 62 bytes of name and
+// password. Rows that do not fit are never cached. Each slot is guarded by a sequence counter
+// (a seqlock), so readers on any number of threads take no locks and write nothing shared. They
+// copy the slot and retry the probe if a writer touched it meanwhile. Writers are rare and take
+// a mutex. A key probes a window of eight slots, and when the window is full the CLOCK hand evicts
+// the first slot that has not been read since the hand last passed it.
+//
+// user_reader is the read-through side, one per connection. On a miss it runs a bound SELECT.
+// The row is cached only if no write was open, or began or ended, while the SELECT ran. Writes go
+// through one of two paths, so cached rows never disagree with the table:
+//
+//  bulk_load_users(db, cache, ...)  drops every loaded row's keys before the load commits
+//  user_cache_statement             for any other statement that can change USERS, keeps fills
+//                                   out while it runs and empties the cache once it has
+//
+// Writes that bypass both must call clear().
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "sqlite3.h"
+#include "bulk_loader.h"
+#include "sql_lexer.h"
+#include "user_batch.h"
+
+struct cached_user
+{
+    int64_t id = 0;
+    std::string name;
+    std::string password;
+};
+
+enum class user_lookup { found, not_found, ambiguous, failed };
+
+class user_cache
+{
+public:
+    static constexpr size_t probe_window = 8;
+    static constexpr size_t inline_bytes = 62;
+
+    explicit user_cache(size_t memory_cap = 16 * 1024 * 1024)
+    {
+        size_t count = 64;
+        while (count * 2 * sizeof(slot) <= memory_cap)
+        {
+            count *= 2;
+        }
+        slot_count = count;
+        slots.reset(new slot[count]);
+    }
+
+    user_cache(const user_cache&) = delete;
+    user_cache& operator=(const user_cache&) = delete;
+
+    size_t capacity() const { return slot_count; }
+    size_t memory_bytes() const { return slot_count * sizeof(slot); }
+
+    // lock-free lookups, safe from any thread
+    bool find_name(std::string_view name, cached_user& out) const
+    {
+        const uint64_t key = name_key(name);
+        return find(key, [&](const payload& row) { return row.name() == name; }, out);
+    }
+
+    bool find_id(int64_t id, cached_user& out) const
+    {
+        const uint64_t key = id_key(id);
+        return find(key, [&](const payload& row) { return row.id == id; }, out);
+    }
+
+    // changes whenever a write_scope opens or closes and whenever the cache is cleared
+    uint64_t write_epoch() const { return epoch.load(); }
+
+    // write_scopes open right now
+    uint32_t open_writes() const { return writers_open.load(); }
+
+    // caches a row read from the table when no write_scope is open and the write epoch is still the
+    //  one seen before the read, returns false if it was not cached
+    bool fill(int64_t id, std::string_view name, std::string_view password, uint64_t read_epoch)
+    {
+        if (name.size() + password.size() > inline_bytes)
+        {
+            oversized_count.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(writer);
+        if (writers_open.load() != 0 || epoch.load() != read_epoch)
+        {
+            return false;
+        }
+        // the id must not evict the name just stored for it, or the id would be cached on its own
+        const slot* name_slot = store(name_key(name), id, name, password, [&](const payload& row) { return row.name() == name; }, NULL);
+        store(id_key(id), id, name, password, [&](const payload& row) { return row.id == id; }, name_slot);
+        return true;
+    }
+
+    // drops the row with this id and whatever name it was cached under
+    void invalidate_id(int64_t id)
+    {
+        std::lock_guard<std::mutex> lock(writer);
+        payload old;
+        if (erase(id_key(id), [&](const payload& row) { return row.id == id; }, &old))
+        {
+            const std::string_view name = old.name();
+            erase(name_key(name), [&](const payload& row) { return row.name() == name; }, NULL);
+        }
+    }
+
+    // drops the row cached under this name and the id it belongs to
+    void invalidate_name(std::string_view name)
+    {
+        std::lock_guard<std::mutex> lock(writer);
+        payload old;
+        if (erase(name_key(name), [&](const payload& row) { return row.name() == name; }, &old))
+        {
+            const int64_t id = old.id;
+            erase(id_key(id), [&](const payload& row) { return row.id == id; }, NULL);
+        }
+    }
+
+    void invalidate(const user_row& row)
+    {
+        invalidate_id(row.id);
+        invalidate_name(row.name);
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(writer);
+        for (size_t i = 0; i < slot_count; ++i)
+        {
+            if (slots[i].key.load(std::memory_order_relaxed) != 0)
+            {
+                write_slot(slots[i], 0, payload());
+            }
+        }
+        // a read that started before the clear must not fill afterwards
+        epoch.fetch_add(1);
+    }
+
+    // no row can be filled while any write_scope is open, or from a read that overlapped one. The
+    //  open count keeps fills out until the last of several overlapping scopes closes, and the
+    //  epoch moves on at both ends so a read that saw either side is never cached.
+    class write_scope
+    {
+    public:
+        explicit write_scope(user_cache& cache) : cache(cache)
+        {
+            cache.writers_open.fetch_add(1);
+            cache.epoch.fetch_add(1);
+        }
+
+        // the epoch moves before the count drops, so a fill can never see the count at 0 with the
+        //  epoch a read took while this scope was open
+        ~write_scope()
+        {
+            cache.epoch.fetch_add(1);
+            cache.writers_open.fetch_sub(1);
+        }
+
+        write_scope(const write_scope&) = delete;
+        write_scope& operator=(const write_scope&) = delete;
+
+    private:
+        user_cache& cache;
+    };
+
+    size_t evictions() const { return eviction_count.load(std::memory_order_relaxed); }
+    size_t oversized() const { return oversized_count.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t payload_words = 8;
+
+    // a decoded copy of a slot
+    struct payload
+    {
+        int64_t id = 0;
+        unsigned char name_size = 0;
+        unsigned char password_size = 0;
+        char text[inline_bytes] = {};
+
+        std::string_view name() const { return std::string_view(text, name_size); }
+        std::string_view password() const { return std::string_view(text + name_size, password_size); }
+    };
+
+    // every field is atomic so the optimistic reads are not data races, relaxed accesses between
+    //  the sequence loads are ordered by the fences in find and write_slot
+    struct slot
+    {
+        std::atomic<uint32_t> sequence{ 0 };
+        // set by readers, so mutable through the const lookups
+        mutable std::atomic<uint8_t> referenced{ 0 };
+        std::atomic<uint64_t> key{ 0 };
+        std::atomic<int64_t> id{ 0 };
+        std::atomic<uint64_t> words[payload_words] = {};
+    };
+
+    std::unique_ptr<slot[]> slots;
+    size_t slot_count;
+    size_t clock_hand = 0;
+    std::mutex writer;
+    std::atomic<uint64_t> epoch{ 0 };
+    std::atomic<uint32_t> writers_open{ 0 };
+    std::atomic<size_t> eviction_count{ 0 };
+    std::atomic<size_t> oversized_count{ 0 };
+
+    // name keys are odd and id keys are even with bit 1 set, so neither kind is ever 0 (an empty
+    //  slot) or equal to a key of the other kind
+    static uint64_t name_key(std::string_view name)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (char c : name)
+        {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        }
+        return hash | 1;
+    }
+
+    static uint64_t id_key(int64_t id)
+    {
+        uint64_t hash = static_cast<uint64_t>(id) + 0x9e3779b97f4a7c15ull;
+        hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+        hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+        hash ^= hash >> 31;
+        return (hash & ~uint64_t(1)) | 2;
+    }
+
+    size_t home(uint64_t key) const { return static_cast<size_t>(key >> 8) & (slot_count - 1); }
+
+    // copies a slot, returns false if a writer was in it
+    static bool read_slot(const slot& source, uint64_t key, payload& copy)
+    {
+        const uint32_t before = source.sequence.load(std::memory_order_acquire);
+        if ((before & 1) != 0 || source.key.load(std::memory_order_relaxed) != key)
+        {
+            return false;
+        }
+        uint64_t words[payload_words];
+        for (size_t w = 0; w < payload_words; ++w)
+        {
+            words[w] = source.words[w].load(std::memory_order_relaxed);
+        }
+        copy.id = source.id.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (source.sequence.load(std::memory_order_relaxed) != before)
+        {
+            return false;
+        }
+
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(words);
+        copy.name_size = bytes[0];
+        copy.password_size = bytes[1];
+        if (copy.name_size + copy.password_size > inline_bytes)
+        {
+            return false;
+        }
+        std::memcpy(copy.text, bytes + 2, inline_bytes);
+        return true;
+    }
+
+    // writer only, under the mutex
+    static void write_slot(slot& target, uint64_t key, const payload& row)
+    {
+        unsigned char bytes[payload_words * 8] = {};
+        bytes[0] = row.name_size;
+        bytes[1] = row.password_size;
+        std::memcpy(bytes + 2, row.text, inline_bytes);
+        uint64_t words[payload_words];
+        std::memcpy(words, bytes, sizeof(words));
+
+        const uint32_t sequence = target.sequence.load(std::memory_order_relaxed);
+        target.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        target.key.store(key, std::memory_order_relaxed);
+        target.id.store(row.id, std::memory_order_relaxed);
+        for (size_t w = 0; w < payload_words; ++w)
+        {
+            target.words[w].store(words[w], std::memory_order_relaxed);
+        }
+        target.referenced.store(0, std::memory_order_relaxed);
+        target.sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    template <typename Matches>
+    bool find(uint64_t key, Matches matches, cached_user& out) const
+    {
+        const size_t start = home(key);
+        payload copy;
+        for (size_t probe = 0; probe < probe_window; ++probe)
+        {
+            const slot& candidate = slots[(start + probe) & (slot_count - 1)];
+            if (candidate.key.load(std::memory_order_relaxed) != key)
+            {
+                continue;
+            }
+            // a slot rewritten mid copy is retried a few times before counting as a miss
+            for (int attempt = 0; attempt < 4; ++attempt)
+            {
+                if (read_slot(candidate, key, copy))
+                {
+                    if (!matches(copy))
+                    {
+                        break;
+                    }
+                    if (candidate.referenced.load(std::memory_order_relaxed) == 0)
+                    {
+                        candidate.referenced.store(1, std::memory_order_relaxed);
+                    }
+                    out.id = copy.id;
+                    out.name.assign(copy.name());
+                    out.password.assign(copy.password());
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // writes the row under key, never evicting keep, and returns the slot it went to
+    template <typename Matches>
+    const slot* store(uint64_t key, int64_t id, std::string_view name, std::string_view password, Matches matches, const slot* keep)
+    {
+        payload row;
+        row.id = id;
+        row.name_size = static_cast<unsigned char>(name.size());
+        row.password_size = static_cast<unsigned char>(password.size());
+        std::memcpy(row.text, name.data(), name.size());
+        std::memcpy(row.text + name.size(), password.data(), password.size());
+
+        // the key's own slot wins over an empty one earlier in the window, or the old row would
+        //  stay behind as a stale duplicate
+        const size_t start = home(key);
+        slot* target = NULL;
+        slot* empty = NULL;
+        payload existing;
+        for (size_t probe = 0; probe < probe_window && target == NULL; ++probe)
+        {
+            slot& candidate = slots[(start + probe) & (slot_count - 1)];
+            const uint64_t held = candidate.key.load(std::memory_order_relaxed);
+            if (held == key && read_slot(candidate, key, existing) && matches(existing))
+            {
+                target = &candidate;
+            }
+            else if (held == 0 && empty == NULL)
+            {
+                empty = &candidate;
+            }
+        }
+        if (target == NULL)
+        {
+            target = empty;
+        }
+        if (target == NULL)
+        {
+            // the victim's other key goes with it, so a cached name always has its id cached too and
+            //  invalidating by id can find the name a renamed row was cached under
+            target = &evict(start, keep);
+            const uint64_t victim_key = target->key.load(std::memory_order_relaxed);
+            payload victim;
+            if (victim_key != 0 && read_slot(*target, victim_key, victim))
+            {
+                const int64_t victim_id = victim.id;
+                const std::string_view victim_name = victim.name();
+                erase((victim_key & 1) != 0 ? id_key(victim_id) : name_key(victim_name),
+                    [&](const payload& other) { return other.id == victim_id && other.name() == victim_name; }, NULL);
+            }
+        }
+        write_slot(*target, key, row);
+        return target;
+    }
+
+    // CLOCK over the probe window starting where the hand last stopped, passing over keep
+    slot& evict(size_t start, const slot* keep)
+    {
+        for (size_t sweep = 0; sweep < 2 * probe_window; ++sweep)
+        {
+            slot& candidate = slots[(start + (clock_hand + sweep) % probe_window) & (slot_count - 1)];
+            if (&candidate == keep)
+            {
+                continue;
+            }
+            if (candidate.referenced.load(std::memory_order_relaxed) == 0)
+            {
+                clock_hand = (clock_hand + sweep + 1) % probe_window;
+                eviction_count.fetch_add(1, std::memory_order_relaxed);
+                return candidate;
+            }
+            candidate.referenced.store(0, std::memory_order_relaxed);
+        }
+        eviction_count.fetch_add(1, std::memory_order_relaxed);
+        return &slots[start] != keep ? slots[start] : slots[(start + 1) & (slot_count - 1)];
+    }
+
+    template <typename Matches>
+    bool erase(uint64_t key, Matches matches, payload* old)
+    {
+        const size_t start = home(key);
+        payload existing;
+        for (size_t probe = 0; probe < probe_window; ++probe)
+        {
+            slot& candidate = slots[(start + probe) & (slot_count - 1)];
+            if (candidate.key.load(std::memory_order_relaxed) == key && read_slot(candidate, key, existing) && matches(existing))
+            {
+                if (old != NULL)
+                {
+                    *old = existing;
+                }
+                write_slot(candidate, 0, payload());
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// looks users up in a user_cache, reading through to the table on a miss. One per connection,
+//  since it owns prepared statements.
+class user_reader
+{
+public:
+    user_reader(sqlite3* db, user_cache& cache) : db(db), cache(cache) {}
+
+    ~user_reader()
+    {
+        sqlite3_finalize(by_name_stmt);
+        sqlite3_finalize(by_id_stmt);
+    }
+
+    user_reader(const user_reader&) = delete;
+    user_reader& operator=(const user_reader&) = delete;
+
+    // the cache this reader fills, e.g. for a write to open a user_cache_statement on
+    user_cache& shared_cache() const { return cache; }
+
+    // counted per reader so lookups never write a counter shared between threads
+    size_t hits() const { return hit_count; }
+    size_t misses() const { return miss_count; }
+
+    // the one user with this name. Names shared by several users are reported as ambiguous and
+    //  never cached.
+    user_lookup by_name(std::string_view name, cached_user& out)
+    {
+        if (cache.find_name(name, out))
+        {
+            ++hit_count;
+            return user_lookup::found;
+        }
+        ++miss_count;
+        if (!prepare(by_name_stmt, "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME=?1 LIMIT 2"))
+        {
+            return user_lookup::failed;
+        }
+        sqlite3_bind_text(by_name_stmt, 1, name.data(), static_cast<int>(name.size()), SQLITE_STATIC);
+        return read_through(by_name_stmt, out);
+    }
+
+    user_lookup by_id(int64_t id, cached_user& out)
+    {
+        if (cache.find_id(id, out))
+        {
+            ++hit_count;
+            return user_lookup::found;
+        }
+        ++miss_count;
+        if (!prepare(by_id_stmt, "SELECT ID, NAME, PASSWORD FROM USERS WHERE ID=?1 LIMIT 2"))
+        {
+            return user_lookup::failed;
+        }
+        sqlite3_bind_int64(by_id_stmt, 1, id);
+        return read_through(by_id_stmt, out);
+    }
+
+private:
+    sqlite3* db;
+    user_cache& cache;
+    sqlite3_stmt* by_name_stmt = NULL;
+    sqlite3_stmt* by_id_stmt = NULL;
+    size_t hit_count = 0;
+    size_t miss_count = 0;
+
+    bool prepare(sqlite3_stmt*& stmt, const char* sql)
+    {
+        if (stmt == NULL)
+        {
+            return sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK;
+        }
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+        return true;
+    }
+
+    user_lookup read_through(sqlite3_stmt* stmt, cached_user& out)
+    {
+        const uint64_t read_epoch = cache.write_epoch();
+        int result = sqlite3_step(stmt);
+        if (result == SQLITE_DONE)
+        {
+            sqlite3_reset(stmt);
+            return user_lookup::not_found;
+        }
+        if (result != SQLITE_ROW)
+        {
+            sqlite3_reset(stmt);
+            return user_lookup::failed;
+        }
+
+        out.id = sqlite3_column_int64(stmt, 0);
+        const unsigned char* name = sqlite3_column_text(stmt, 1);
+        out.name.assign(name ? reinterpret_cast<const char*>(name) : "", static_cast<size_t>(sqlite3_column_bytes(stmt, 1)));
+        const unsigned char* password = sqlite3_column_text(stmt, 2);
+        out.password.assign(password ? reinterpret_cast<const char*>(password) : "", static_cast<size_t>(sqlite3_column_bytes(stmt, 2)));
+
+        result = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (result == SQLITE_ROW)
+        {
+            return user_lookup::ambiguous;
+        }
+        if (result != SQLITE_DONE)
+        {
+            return user_lookup::failed;
+        }
+        cache.fill(out.id, out.name, out.password, read_epoch);
+        return user_lookup::found;
+    }
+};
+
+// wraps a bulk_load_users row generator so every row it hands out is dropped from the cache first.
+//  Use it inside a write_scope that stays open until the load has committed, as the
+//  bulk_load_users overload below does.
+template <typename Generator>
+class invalidating_rows
+{
+public:
+    invalidating_rows(user_cache& cache, Generator next_row) : cache(cache), next_row(std::forward<Generator>(next_row)) {}
+
+    bool operator()(user_row& row)
+    {
+        if (!next_row(row))
+        {
+            return false;
+        }
+        cache.invalidate(row);
+        return true;
+    }
+
+private:
+    user_cache& cache;
+    Generator next_row;
+};
+
+// bulk_load_users for a table that cache holds rows of. Every loaded row is dropped from the cache,
+//  and nothing is filled until the load has committed or rolled back.
+template <typename Generator>
+bool bulk_load_users(sqlite3* db, user_cache& cache, Generator&& next_row, const bulk_load_options& options, bulk_load_stats& stats)
+{
+    user_cache::write_scope writing(cache);
+    return bulk_load_users(db, invalidating_rows<Generator&>(cache, next_row), options, stats);
+}
+
+// true unless sql is a SELECT (or VALUES) statement, the only kinds that never change a row
+inline bool may_change_users(std::string_view sql) noexcept
+{
+    sql_lexer lexer(sql);
+    const sql_token first = lexer.next_significant();
+    return !(first.is_keyword("select") || first.is_keyword("values"));
+}
+
+// a statement that can change USERS rows without saying which, e.g. an UPDATE. The cache takes no
+//  fills while it runs and is emptied when it is done, whether it succeeded or not.
+class user_cache_statement
+{
+public:
+    explicit user_cache_statement(user_cache& cache) : cache(cache), writing(cache) {}
+    ~user_cache_statement() { cache.clear(); }
+
+    user_cache_statement(const user_cache_statement&) = delete;
+    user_cache_statement& operator=(const user_cache_statement&) = delete;
+
+private:
+    user_cache& cache;
+    user_cache::write_scope writing;
+};
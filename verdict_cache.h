@@ -0,0 +1,260 @@
+// verdict_cache.h : Remembers the injection verdict for each statement shape so a repeat shape
+//  skips the injection rules.
+//
+// A shape can only carry a verdict that holds for every set of literals put back into it:
+//
+//  clean              no injection rule matches outside the literals and no OR compares two
+//                     literals or a column with itself, so no choice of literals can make it an
+//                     injection and the detector can be skipped
+//  injected           a column is compared with itself after an OR (OR x=x), or a UNION SELECT,
+//                     stacked statement or comment is part of the shape itself
+//  literal_dependent  an OR compares two literals (NAME = ? OR ? = ?). 1=1 and 1=2 share the shape,
+//                     so these statements still go through the detector every time
+//
+// A ? placeholder counts as a literal, so a shape written out by hand, e.g. for warm_up, gets the
+// same verdict as the statements it stands for.
+//
+// The cache is split into shards, each with its own reader/writer lock, and is bounded with a
+// CLOCK (second chance) eviction per shard. Reads only take the shared lock.
+
+#pragma once
+
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "injection_rules.h"
+#include "sql_shape.h"
+#include "tautology_detector.h"
+
+enum class shape_verdict
+{
+    clean,
+    injected,
+    literal_dependent
+};
+
+namespace verdict_cache_detail
+{
+    // a literal, or the ? that stands for one in a shape
+    inline bool is_value(const sql_token& token) noexcept
+    {
+        return token.kind == sql_token_kind::number || token.kind == sql_token_kind::string_literal || token.kind == sql_token_kind::blob_literal ||
+            (token.kind == sql_token_kind::unknown && token.text == "?");
+    }
+}
+
+// works out the verdict that holds for every statement with the same shape as sql
+inline shape_verdict classify_statement_shape(std::string_view sql) noexcept
+{
+    // only the tautology rule looks at literals, a match of any other rule holds for the whole shape
+    const injection_verdict rules = detect_injection(sql);
+    if (rules.detected && rules.rule != injection_rule::tautology)
+    {
+        return shape_verdict::injected;
+    }
+
+    sql_lexer lexer(sql);
+    shape_verdict verdict = shape_verdict::clean;
+
+    for (sql_token token = lexer.next_significant(); token.kind != sql_token_kind::end; token = lexer.next_significant())
+    {
+        if (!token.is_keyword("or"))
+        {
+            continue;
+        }
+
+        sql_lexer lookahead = lexer;
+        sql_token lhs, op, rhs;
+        if (!tautology_detail::read_or_operand(lookahead, lhs, op, rhs))
+        {
+            continue;
+        }
+
+        const bool lhs_literal = verdict_cache_detail::is_value(lhs);
+        const bool rhs_literal = verdict_cache_detail::is_value(rhs);
+        if (lhs_literal && rhs_literal)
+        {
+            verdict = shape_verdict::literal_dependent;
+        }
+        else if (!lhs_literal && !rhs_literal && tautology_detail::is_always_true(lhs, op, rhs))
+        {
+            return shape_verdict::injected;
+        }
+    }
+
+    return verdict;
+}
+
+class verdict_cache
+{
+public:
+    explicit verdict_cache(size_t capacity = 4096)
+    {
+        size_t per_shard = capacity / shard_count;
+        for (auto& shard : shards)
+        {
+            shard.init(per_shard == 0 ? 1 : per_shard);
+        }
+    }
+
+    verdict_cache(const verdict_cache&) = delete;
+    verdict_cache& operator=(const verdict_cache&) = delete;
+
+    // returns the injection verdict for sql, using the cached shape verdict when there is one
+    injection_verdict screen(std::string_view sql, const sql_fingerprint& fingerprint)
+    {
+        shape_verdict verdict;
+        if (!find(fingerprint, verdict))
+        {
+            verdict = classify_statement_shape(sql);
+            insert(fingerprint, verdict);
+        }
+
+        if (verdict == shape_verdict::clean)
+        {
+            return injection_verdict();
+        }
+        // the detector reports which rule gave the statement away
+        return detect_injection(sql);
+    }
+
+    // looks up the verdict for a shape, counting a hit or a miss
+    bool find(const sql_fingerprint& fingerprint, shape_verdict& verdict)
+    {
+        shard& s = shards[fingerprint.hash % shard_count];
+        std::shared_lock<std::shared_mutex> lock(s.mutex);
+        auto found = s.index.find(fingerprint.shape);
+        if (found == s.index.end())
+        {
+            s.misses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slot& entry = s.slots[found->second];
+        entry.referenced.store(true, std::memory_order_relaxed);
+        verdict = entry.verdict;
+        s.hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void insert(const sql_fingerprint& fingerprint, shape_verdict verdict)
+    {
+        shard& s = shards[fingerprint.hash % shard_count];
+        std::unique_lock<std::shared_mutex> lock(s.mutex);
+        if (s.index.find(fingerprint.shape) != s.index.end())
+        {
+            // another thread got here first
+            return;
+        }
+
+        // CLOCK: sweep past recently used slots, clearing their reference bit, until one can go
+        size_t victim = s.hand;
+        while (s.slots[victim].used && s.slots[victim].referenced.exchange(false, std::memory_order_relaxed))
+        {
+            victim = (victim + 1) % s.capacity;
+        }
+        s.hand = (victim + 1) % s.capacity;
+
+        slot& entry = s.slots[victim];
+        if (entry.used)
+        {
+            s.index.erase(entry.shape);
+            s.evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+        entry.shape = fingerprint.shape;
+        entry.verdict = verdict;
+        entry.used = true;
+        entry.referenced.store(false, std::memory_order_relaxed);
+        s.index.emplace(entry.shape, victim);
+    }
+
+    // loads known good statements (or shapes) from a file, one per line. Each line is classified
+    //  like any other statement, with ? standing for a literal, so a line that is not safe for every
+    //  literal is cached as injected or literal_dependent and its statements still go through the
+    //  detector. Returns the number of shapes loaded, or -1 if the file could not be opened.
+    long warm_up(const std::string& path)
+    {
+        std::ifstream input(path);
+        if (!input.is_open())
+        {
+            return -1;
+        }
+
+        long loaded = 0;
+        std::string line;
+        sql_fingerprint fingerprint;
+        while (std::getline(input, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+            if (line.find_first_not_of(" \t") == std::string::npos)
+            {
+                continue;
+            }
+            fingerprint.compute(line);
+            insert(fingerprint, classify_statement_shape(line));
+            ++loaded;
+        }
+        return loaded;
+    }
+
+    uint64_t hits() const { return sum(&shard::hits); }
+    uint64_t misses() const { return sum(&shard::misses); }
+    uint64_t evictions() const { return sum(&shard::evictions); }
+
+    double hit_ratio() const
+    {
+        uint64_t h = hits();
+        uint64_t total = h + misses();
+        return total == 0 ? 0 : static_cast<double>(h) / static_cast<double>(total);
+    }
+
+private:
+    static const size_t shard_count = 16;
+
+    struct slot
+    {
+        std::string shape;
+        shape_verdict verdict = shape_verdict::clean;
+        std::atomic<bool> referenced{ false };
+        bool used = false;
+    };
+
+    struct shard
+    {
+        std::shared_mutex mutex;
+        std::unordered_map<std::string, size_t> index;
+        std::unique_ptr<slot[]> slots;
+        size_t capacity = 0;
+        size_t hand = 0;
+        std::atomic<uint64_t> hits{ 0 };
+        std::atomic<uint64_t> misses{ 0 };
+        std::atomic<uint64_t> evictions{ 0 };
+
+        void init(size_t size)
+        {
+            capacity = size;
+            slots.reset(new slot[size]);
+            index.reserve(size);
+        }
+    };
+
+    shard shards[shard_count];
+
+    uint64_t sum(std::atomic<uint64_t> shard::*counter) const
+    {
+        uint64_t total = 0;
+        for (const auto& s : shards)
+        {
+            total += (s.*counter).load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+};